@@ -120,7 +120,7 @@ class AutoModelForCausalLM:
             model_type: The model type.
             model_file: The name of the model file in repo or directory.
             config: `AutoConfig` object.
-            lib: The path to a shared library or one of `avx2`, `avx`, `basic`.
+            lib: The path to a shared library or one of `auto`, `avx512`, `avx2`, `avx`, `basic`.
             local_files_only: Whether or not to only look at local files
             (i.e., do not try to download the model).
 
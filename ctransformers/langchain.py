@@ -36,7 +36,7 @@ class CTransformers(LLM):
     """The config parameters."""
 
     lib: Optional[Any] = None
-    """The path to a shared library or one of `avx2`, `avx`, `basic`."""
+    """The path to a shared library or one of `auto`, `avx512`, `avx2`, `avx`, `basic`."""
 
     @property
     def _identifying_params(self) -> Dict[str, Any]:
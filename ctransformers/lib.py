@@ -23,6 +23,9 @@ def find_library(path: Optional[str] = None, cuda: bool = False) -> str:
         elif platform.processor() == "arm":
             # Apple silicon doesn't support AVX/AVX2.
             path = "basic" if system == "Darwin" else ""
+        elif (lib_directory / "auto").is_dir():
+            # Chooses the kernels for the CPU at runtime.
+            path = "auto"
         else:
             from cpuinfo import get_cpu_info
 
@@ -35,7 +38,14 @@ def find_library(path: Optional[str] = None, cuda: bool = False) -> str:
                 )
                 flags = []
 
-            if "avx2" in flags:
+            avx512 = ["avx512f", "avx512bw", "avx512vl"]
+            if (
+                all(flag in flags for flag in avx512)
+                and ("avx512_vnni" in flags or "avx512vnni" in flags)
+                and (lib_directory / "avx512").is_dir()
+            ):
+                path = "avx512"
+            elif "avx2" in flags:
                 path = "avx2"
             elif "avx" in flags and "f16c" in flags:
                 path = "avx"
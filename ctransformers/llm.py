@@ -10,6 +10,7 @@ from ctypes import (
     c_bool,
     c_int,
     c_float,
+    c_char,
     c_char_p,
     c_void_p,
     POINTER,
@@ -29,6 +30,7 @@ from .utils import Vector, utf8_split_incomplete
 
 c_int_p = POINTER(c_int)
 c_float_p = POINTER(c_float)
+c_char_p_p = POINTER(c_char_p)
 llm_p = c_void_p
 
 
@@ -45,6 +47,7 @@ class Config:
     # eval
     batch_size: int = 8
     threads: int = -1
+    spin_us: int = 200
 
     # generate
     max_new_tokens: int = 256
@@ -55,6 +58,13 @@ class Config:
     # model
     context_length: int = -1
     gpu_layers: int = 0
+    kv_cache_type: Optional[str] = None
+    kv_cache_budget: int = 0
+    prompt_cache_size: int = 0
+    prompt_cache_dir: Optional[str] = None
+    prompt_cache_disk_size: int = 4096
+    fuse_weights: bool = False
+    repack_weights: bool = False
 
 
 docs = OrderedDict(
@@ -70,8 +80,16 @@ docs = OrderedDict(
     reset="Whether to reset the model state before generating text.",
     batch_size="The batch size to use for evaluating tokens in a single prompt.",
     threads="The number of threads to use for evaluating tokens.",
+    spin_us="The time in microseconds for idle threads to busy-wait for work before sleeping. Use `-1` to never sleep.",
     context_length="The maximum context length to use.",
     gpu_layers="The number of layers to run on GPU.",
+    kv_cache_type="The type of the KV cache: `f32`, `f16`, `q8_0` or `q4_0`. Uses the default type of the model if not set.",
+    kv_cache_budget="The maximum number of tokens to keep in the KV cache. When it is reached, the tokens that got the least attention are evicted, except for the first tokens and the most recent half. It does not let a conversation run past `context_length`. Disabled if `0`.",
+    prompt_cache_size="The memory in MB for caching the KV cache of prompts across models loaded from the same file, so that a prompt only evaluates the tokens after its longest cached prefix. Disabled if `0`.",
+    prompt_cache_dir="The directory to write cached prompts that do not fit in `prompt_cache_size` to.",
+    prompt_cache_disk_size="The disk space in MB for cached prompts in `prompt_cache_dir`.",
+    fuse_weights="Whether to fuse the q/k/v and gate/up weights of each layer when loading a model, for faster evaluation. The fused weights are copied out of the model file, so the model takes up to two thirds more memory. Only LLaMA models support it.",
+    repack_weights="Whether to interleave the rows of `q4_0` and `q8_0` weights when loading a model, for faster matrix multiplications. The repacked weights are copied out of the model file, so the model takes up about twice the memory. Only LLaMA models support it.",
 )
 
 
@@ -108,12 +126,29 @@ def load_library(path: Optional[str] = None, cuda: bool = False) -> Any:
         c_char_p,  # model_type
         c_int,  # context_length
         c_int,  # gpu_layers
+        c_char_p,  # kv_cache_type
+        c_bool,  # fuse_weights
+        c_bool,  # repack_weights
     ]
     lib.ctransformers_llm_create.restype = llm_p
 
     lib.ctransformers_llm_delete.argtypes = [llm_p]
     lib.ctransformers_llm_delete.restype = None
 
+    lib.ctransformers_llm_prompt_cache.argtypes = [
+        llm_p,
+        c_int,  # memory_size
+        c_char_p,  # dir
+        c_int,  # disk_size
+    ]
+    lib.ctransformers_llm_prompt_cache.restype = c_bool
+
+    lib.ctransformers_llm_kv_cache_budget.argtypes = [
+        llm_p,
+        c_int,  # budget
+    ]
+    lib.ctransformers_llm_kv_cache_budget.restype = c_bool
+
     lib.ctransformers_llm_tokenize.argtypes = [
         llm_p,
         c_char_p,  # text
@@ -127,6 +162,29 @@ def load_library(path: Optional[str] = None, cuda: bool = False) -> Any:
     ]
     lib.ctransformers_llm_detokenize.restype = c_char_p
 
+    lib.ctransformers_llm_batch_tokenize.argtypes = [
+        llm_p,
+        c_char_p_p,  # texts
+        c_int,  # n_texts
+        c_int_p,  # output
+        c_int,  # output_size
+        c_int_p,  # offsets
+        c_int,  # threads
+    ]
+    lib.ctransformers_llm_batch_tokenize.restype = c_int
+
+    lib.ctransformers_llm_batch_detokenize.argtypes = [
+        llm_p,
+        c_int_p,  # tokens
+        c_int_p,  # offsets
+        c_int,  # n_seqs
+        POINTER(c_char),  # output
+        c_int,  # output_size
+        c_int_p,  # output_offsets
+        c_int,  # threads
+    ]
+    lib.ctransformers_llm_batch_detokenize.restype = c_int
+
     lib.ctransformers_llm_is_eos_token.argtypes = [
         llm_p,
         c_int,  # token
@@ -148,6 +206,7 @@ def load_library(path: Optional[str] = None, cuda: bool = False) -> Any:
         c_int,  # n_tokens
         c_int,  # batch_size
         c_int,  # threads
+        c_int,  # spin_us
     ]
     lib.ctransformers_llm_batch_eval.restype = c_bool
 
@@ -193,7 +252,7 @@ class LLM:
             model_path: The path to a model file.
             model_type: The model type.
             config: `Config` object.
-            lib: The path to a shared library or one of `avx2`, `avx`, `basic`.
+            lib: The path to a shared library or one of `auto`, `avx512`, `avx2`, `avx`, `basic`.
         """
         config = config or Config()
         self._model_path = model_path
@@ -211,11 +270,33 @@ class LLM:
             model_type.encode(),
             config.context_length,
             config.gpu_layers,
+            (config.kv_cache_type or "").encode(),
+            config.fuse_weights,
+            config.repack_weights,
         )
         if self._llm is None:
             raise RuntimeError(
                 f"Failed to create LLM '{model_type}' from '{model_path}'."
             )
+        if config.kv_cache_budget > 0:
+            supported = self._lib.ctransformers_llm_kv_cache_budget(
+                self._llm, config.kv_cache_budget
+            )
+            if not supported:
+                raise RuntimeError(
+                    f"Model type '{model_type}' doesn't support the KV cache budget."
+                )
+        if config.prompt_cache_size > 0:
+            supported = self._lib.ctransformers_llm_prompt_cache(
+                self._llm,
+                config.prompt_cache_size,
+                (config.prompt_cache_dir or "").encode(),
+                config.prompt_cache_disk_size,
+            )
+            if not supported:
+                raise RuntimeError(
+                    f"Model type '{model_type}' doesn't support the prompt cache."
+                )
 
     @property
     def model_path(self) -> str:
@@ -307,6 +388,97 @@ class LLM:
             texts = texts.decode(errors="ignore")
         return texts
 
+    @doc
+    def batch_tokenize(
+        self,
+        texts: Sequence[str],
+        *,
+        threads: Optional[int] = None,
+    ) -> List[List[int]]:
+        """Converts multiple texts into lists of tokens in parallel.
+
+        Args:
+            texts: The texts to tokenize.
+            {params}
+
+        Returns:
+            The list of tokens for each text.
+        """
+        config = self.config
+        threads = get(threads, config.threads)
+
+        texts = [text.encode() for text in texts]
+        n_texts = len(texts)
+        inputs = (c_char_p * n_texts)(*texts)
+        offsets = (c_int * (n_texts + 1))()
+        size = sum(len(text) + 1 for text in texts)
+        while True:
+            output = (c_int * size)()
+            n_tokens = self.ctransformers_llm_batch_tokenize(
+                inputs,
+                n_texts,
+                output,
+                size,
+                offsets,
+                threads,
+            )
+            if n_tokens <= size:
+                break
+            size = n_tokens
+        return [output[offsets[i] : offsets[i + 1]] for i in range(n_texts)]
+
+    @doc
+    def batch_detokenize(
+        self,
+        sequences: Sequence[Sequence[int]],
+        decode: bool = True,
+        *,
+        threads: Optional[int] = None,
+    ) -> List[Union[str, bytes]]:
+        """Converts multiple lists of tokens to texts in parallel.
+
+        Args:
+            sequences: The lists of tokens.
+            decode: Whether to decode the texts as UTF-8 strings.
+            {params}
+
+        Returns:
+            The combined text of all tokens for each list.
+        """
+        config = self.config
+        threads = get(threads, config.threads)
+
+        n_seqs = len(sequences)
+        offsets = [0]
+        for tokens in sequences:
+            offsets.append(offsets[-1] + len(tokens))
+        tokens = [token for tokens in sequences for token in tokens]
+        tokens = (c_int * len(tokens))(*tokens)
+        offsets = (c_int * (n_seqs + 1))(*offsets)
+        output_offsets = (c_int * (n_seqs + 1))()
+        size = 8 * len(tokens)
+        while True:
+            output = (c_char * size)()
+            n_bytes = self.ctransformers_llm_batch_detokenize(
+                tokens,
+                offsets,
+                n_seqs,
+                output,
+                size,
+                output_offsets,
+                threads,
+            )
+            if n_bytes <= size:
+                break
+            size = n_bytes
+        output = output.raw
+        texts = [
+            output[output_offsets[i] : output_offsets[i + 1]] for i in range(n_seqs)
+        ]
+        if decode:
+            texts = [text.decode(errors="ignore") for text in texts]
+        return texts
+
     def is_eos_token(self, token: int) -> bool:
         """Checks if a token is an end-of-sequence token.
 
@@ -325,6 +497,7 @@ class LLM:
         *,
         batch_size: Optional[int] = None,
         threads: Optional[int] = None,
+        spin_us: Optional[int] = None,
     ) -> None:
         """Evaluates a list of tokens.
 
@@ -335,6 +508,7 @@ class LLM:
         config = self.config
         batch_size = get(batch_size, config.batch_size)
         threads = get(threads, config.threads)
+        spin_us = get(spin_us, config.spin_us)
 
         n_tokens = len(tokens)
         tokens = (c_int * n_tokens)(*tokens)
@@ -343,6 +517,7 @@ class LLM:
             n_tokens,
             batch_size,
             threads,
+            spin_us,
         )
         if not status:
             raise RuntimeError("Failed to evaluate tokens.")
@@ -2,6 +2,7 @@
 #define CTRANSFORMERS_MODELS_COMMON_H_
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <codecvt>
 #include <cstdio>
@@ -9,6 +10,8 @@
 #include <fstream>
 #include <locale>
 #include <map>
+#include <memory>
+#include <numeric>
 #include <queue>
 #include <random>
 #include <regex>
@@ -206,6 +209,415 @@ gpt_vocab::id gpt_sample_top_k_top_p(
   return logits_id[idx].second;
 }
 
+// Threads
+
+// https://github.com/ggerganov/llama.cpp/blob/cc45a7feb8412e84ff292207621412fffc0d3d51/examples/common.cpp#L67-L68
+int ct_get_threads(int threads) {
+  if (threads < 0) {
+    const int n = std::thread::hardware_concurrency();
+    threads = n > 0 ? (n <= 4 ? n : n / 2) : 4;
+  }
+  return std::max(threads, 1);
+}
+
+// Calls `fn(i)` for every `i` in `[0, n)` using up to `threads` threads.
+// Items are handed out one at a time so that uneven items (e.g. texts of
+// different lengths) are balanced across threads.
+template <typename Fn>
+void ct_parallel_for(const int n, int threads, const Fn &fn) {
+  threads = std::min(ct_get_threads(threads), n);
+  if (threads <= 1) {
+    for (int i = 0; i < n; i++) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<int> next(0);
+  const auto worker = [&]() {
+    for (int i = next++; i < n; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+  for (int i = 1; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : workers) {
+    t.join();
+  }
+}
+
+// KV cache
+
+// Returns the KV cache type named `name` ("f32", "f16", "q8_0" or "q4_0"), or
+// GGML_TYPE_COUNT if it is not supported.
+ggml_type ct_kv_type(const std::string &name) {
+  if (name == "f32") {
+    return GGML_TYPE_F32;
+  } else if (name == "f16") {
+    return GGML_TYPE_F16;
+  } else if (name == "q8_0") {
+    return GGML_TYPE_Q8_0;
+  } else if (name == "q4_0") {
+    return GGML_TYPE_Q4_0;
+  }
+  return GGML_TYPE_COUNT;
+}
+
+// Returns whether the keys and values of heads of `head_dim` values can be
+// stored as `type`. A quantized block must not span two heads and the dot
+// products of quantized rows take pairs of blocks.
+bool ct_kv_type_check(const ggml_type type, const int head_dim) {
+  const int n = ggml_is_quantized(type) ? 2 * ggml_blck_size(type) : 1;
+  if (head_dim % n != 0) {
+    fprintf(stderr,
+            "KV cache type '%s' needs a head size that is a multiple of %d "
+            "but it is %d.\n",
+            ggml_type_name(type), n, head_dim);
+    return false;
+  }
+  return true;
+}
+
+// A KV cache that is split in blocks of kBlockSize tokens, as in vLLM's
+// PagedAttention. A sequence keeps the blocks of its tokens in a block table,
+// so its tokens need not be next to each other in the cache. Blocks are not
+// shared between sequences: a model serves the one sequence of its LLM.
+//
+// Each layer of the cache is a matrix of n_blocks * kBlockSize rows of n_embd
+// keys (or values), where block b is rows [b * kBlockSize, (b + 1) *
+// kBlockSize). As free blocks are taken lowest first, the tokens of a sequence
+// are usually in consecutive rows. The memory of a block is only backed by
+// physical pages while it is in use.
+class KVCache {
+ public:
+  static constexpr int kBlockSize = 64;
+  // The first tokens, which get much of the attention whatever they are, are
+  // never evicted.
+  static constexpr int kSinkTokens = 4;
+
+  struct Sequence {
+    std::vector<int> blocks;
+    int n_tokens = 0;
+    // The number of tokens before the last ones that were evicted.
+    int n_evicted = 0;
+  };
+
+  ~KVCache() {
+    if (data_ != nullptr) {
+      ggml_lazy_free(data_, size_);
+    }
+  }
+
+  // Creates `memory_k` and `memory_v` in `ctx` for `n_ctx` tokens of
+  // `n_layer` layers with `n_embd` keys and values per token.
+  bool Init(ggml_context *ctx, const ggml_type type, const int n_layer,
+            const int n_embd, const int n_ctx) {
+    const int n_blocks = (n_ctx + kBlockSize - 1) / kBlockSize;
+    const int64_t n_elements =
+        (int64_t)n_layer * n_blocks * kBlockSize * n_embd;
+
+    const bool no_alloc = ggml_get_no_alloc(ctx);
+    ggml_set_no_alloc(ctx, true);
+    memory_k = ggml_new_tensor_1d(ctx, type, n_elements);
+    memory_v = ggml_new_tensor_1d(ctx, type, n_elements);
+    ggml_set_no_alloc(ctx, no_alloc);
+
+    size_ = ggml_nbytes(memory_k) + ggml_nbytes(memory_v);
+    data_ = (char *)ggml_lazy_alloc(size_);
+    if (data_ == nullptr) {
+      fprintf(stderr, "Failed to allocate %zu bytes for the KV cache.\n",
+              size_);
+      return false;
+    }
+    memory_k->data = data_;
+    memory_v->data = data_ + ggml_nbytes(memory_k);
+
+    n_layer_ = n_layer;
+    n_embd_ = n_embd;
+    n_blocks_ = n_blocks;
+    for (int i = 0; i < n_blocks; i++) {
+      free_.push(i);
+    }
+    return true;
+  }
+
+  // Makes room for `n` tokens after the first `n_past` tokens of `seq`, which
+  // include the evicted ones, and drops the tokens after them.
+  bool Reserve(Sequence &seq, int n_past, const int n) {
+    n_past = std::max(0, n_past - seq.n_evicted);
+    Truncate(seq, n_past + n);
+    while ((int)seq.blocks.size() * kBlockSize < n_past + n) {
+      const int block = Alloc();
+      if (block < 0) {
+        return false;
+      }
+      seq.blocks.push_back(block);
+    }
+    seq.n_tokens = n_past + n;
+    if (scores_ != nullptr) {
+      for (int i = n_past; i < seq.n_tokens; i++) {
+        scores_[Row(seq, i)] = 0.0f;
+      }
+    }
+    return true;
+  }
+
+  // Sums the attention weights that each token gets in Attention(), which are
+  // used by Evict().
+  void TrackScores() {
+    if (scores_ == nullptr) {
+      scores_.reset(new float[n_blocks_ * kBlockSize]());
+    }
+  }
+
+  // Evicts tokens of the first `n_past` tokens of `seq`, see Reserve(), so
+  // that at most `n_keep` of them are left. The first kSinkTokens tokens and
+  // the most recent half of the tokens are kept, and of the tokens between
+  // them the ones with the highest scores, see TrackScores(). The first
+  // kSinkTokens tokens are kept even if `n_keep` is less, such as when a batch
+  // has more tokens than the budget.
+  bool Evict(Sequence &seq, const int n_past, int n_keep) {
+    n_keep = std::max(n_keep, kSinkTokens);
+    const int n_tokens =
+        std::min(seq.n_tokens, std::max(0, n_past - seq.n_evicted));
+    if (n_tokens <= n_keep) {
+      return true;
+    }
+    // At least a block of tokens is evicted so that the rows are not moved
+    // for every new token.
+    const int n_left =
+        std::max(kSinkTokens, std::min(n_keep, n_tokens - kBlockSize));
+    const int n_recent = std::min(n_left / 2, n_left - kSinkTokens);
+    const int n_sink = kSinkTokens;
+    const int n_heavy = n_left - n_recent - n_sink;
+
+    std::vector<int> middle(n_tokens - n_recent - n_sink);
+    std::iota(middle.begin(), middle.end(), n_sink);
+    std::nth_element(middle.begin(), middle.begin() + n_heavy, middle.end(),
+                     [&](const int a, const int b) {
+                       const float score_a = Score(seq, a);
+                       const float score_b = Score(seq, b);
+                       return score_a > score_b ||
+                              (score_a == score_b && a > b);
+                     });
+    std::sort(middle.begin(), middle.begin() + n_heavy);
+
+    // The tokens that are kept in order, which move to the front.
+    std::vector<int> keep(n_sink);
+    std::iota(keep.begin(), keep.end(), 0);
+    keep.insert(keep.end(), middle.begin(), middle.begin() + n_heavy);
+    for (int i = n_tokens - n_recent; i < n_tokens; i++) {
+      keep.push_back(i);
+    }
+
+    int first = 0;
+    while (first < n_left && keep[first] == first) {
+      first++;
+    }
+    for (int i = first; i < n_left; i++) {
+      MoveToken(seq, keep[i], i);
+    }
+    Truncate(seq, n_left);
+    seq.n_tokens = n_left;
+    seq.n_evicted = n_past - n_left;
+    return true;
+  }
+
+  // Frees the blocks of `seq`.
+  void Release(Sequence &seq) {
+    for (const int block : seq.blocks) {
+      Free(block);
+    }
+    seq.blocks.clear();
+    seq.n_tokens = 0;
+    seq.n_evicted = 0;
+  }
+
+  // Returns the rows of the tokens of `seq` in a layer of the cache.
+  ggml_tensor *Rows(ggml_context *ctx, const Sequence &seq) const {
+    ggml_tensor *rows = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, seq.n_tokens);
+    int32_t *data = (int32_t *)rows->data;
+    for (int i = 0; i < seq.n_tokens; i++) {
+      data[i] = Row(seq, i);
+    }
+    return rows;
+  }
+
+  // Stores the keys `Kcur` and the values `Vcur` of the last tokens of layer
+  // `il` in the `rows` of their sequence.
+  void Store(ggml_context *ctx, ggml_cgraph *gf, ggml_tensor *rows,
+             ggml_tensor *Kcur, ggml_tensor *Vcur, const int il) const {
+    const int N = ggml_nelements(Kcur) / n_embd_;
+    if (Kcur->ne[0] != n_embd_) {
+      Kcur = ggml_reshape_2d(ctx, Kcur, n_embd_, N);
+    }
+    if (Vcur->ne[0] != n_embd_) {
+      Vcur = ggml_reshape_2d(ctx, Vcur, n_embd_, N);
+    }
+    rows = ggml_view_1d(ctx, rows, N, (rows->ne[0] - N) * rows->nb[0]);
+    ggml_build_forward_expand(
+        gf, ggml_set_rows(ctx, Layer(ctx, memory_k, n_embd_, 1, il), Kcur,
+                          rows));
+    ggml_build_forward_expand(
+        gf, ggml_set_rows(ctx, Layer(ctx, memory_v, n_embd_, 1, il), Vcur,
+                          rows));
+  }
+
+  // Returns the attention of the queries `Q` [head_dim, N, n_head] over the
+  // `rows` of layer `il`, see ggml_flash_attn_ext_paged. The result is
+  // [head_dim, n_head, N].
+  ggml_tensor *Attention(ggml_context *ctx, ggml_tensor *Q, ggml_tensor *rows,
+                         const int n_head_kv, const int il, const float scale,
+                         const float max_bias) const {
+    const int head_dim = Q->ne[0];
+    ggml_tensor *K = Layer(ctx, memory_k, head_dim, n_head_kv, il);
+    ggml_tensor *V = Layer(ctx, memory_v, head_dim, n_head_kv, il);
+    ggml_tensor *result =
+        ggml_flash_attn_ext_paged(ctx, Q, K, V, rows, scale, max_bias);
+    if (scores_ != nullptr) {
+      const bool no_alloc = ggml_get_no_alloc(ctx);
+      ggml_set_no_alloc(ctx, true);
+      ggml_tensor *scores =
+          ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_blocks_ * kBlockSize);
+      ggml_set_no_alloc(ctx, no_alloc);
+      scores->data = scores_.get();
+      ggml_flash_attn_ext_add_scores(result, scores);
+    }
+    return result;
+  }
+
+  // Returns the size of the keys and values of a token, see Save().
+  size_t TokenSize() const {
+    return n_layer_ * (ggml_row_size(memory_k->type, n_embd_) +
+                       ggml_row_size(memory_v->type, n_embd_));
+  }
+
+  // Copies the keys and values of the first `n` tokens of `seq` to `data`,
+  // token by token.
+  void Save(const Sequence &seq, const int n, char *data) const {
+    CopyTokens(seq, n, data, /*save=*/true);
+  }
+
+  // Replaces the tokens of `seq` with the `n` tokens in `data`, see Save().
+  bool Load(Sequence &seq, const int n, const char *data) {
+    Release(seq);
+    if (!Reserve(seq, 0, n)) {
+      return false;
+    }
+    CopyTokens(seq, n, const_cast<char *>(data), /*save=*/false);
+    return true;
+  }
+
+  ggml_tensor *memory_k = nullptr;
+  ggml_tensor *memory_v = nullptr;
+
+ private:
+  // The memory of `memory_k` and `memory_v`, which may outlive their context.
+  char *data_ = nullptr;
+  size_t size_ = 0;
+  int n_layer_ = 0;
+  int n_embd_ = 0;
+  int n_blocks_ = 0;
+  // Free blocks, lowest first so that the cache stays compact.
+  std::priority_queue<int, std::vector<int>, std::greater<int>> free_;
+  // The summed attention weights of each row, see TrackScores().
+  std::unique_ptr<float[]> scores_;
+
+  // Returns layer `il` of `memory` as [head_dim, n_rows, n_head].
+  ggml_tensor *Layer(ggml_context *ctx, ggml_tensor *memory, const int head_dim,
+                     const int n_head, const int il) const {
+    const size_t row_size = ggml_row_size(memory->type, n_embd_);
+    return ggml_view_3d(ctx, memory, head_dim, n_blocks_ * kBlockSize, n_head,
+                        row_size, ggml_row_size(memory->type, head_dim),
+                        il * BlockSize(memory) * n_blocks_);
+  }
+
+  // Returns the row of token `i` of `seq` in a layer.
+  int Row(const Sequence &seq, const int i) const {
+    return seq.blocks[i / kBlockSize] * kBlockSize + i % kBlockSize;
+  }
+
+  float Score(const Sequence &seq, const int i) const {
+    return scores_ != nullptr ? scores_[Row(seq, i)] : 0.0f;
+  }
+
+  // Drops the blocks of `seq` after the first `n_tokens` tokens.
+  void Truncate(Sequence &seq, const int n_tokens) {
+    const int n_blocks = (n_tokens + kBlockSize - 1) / kBlockSize;
+    while ((int)seq.blocks.size() > n_blocks) {
+      Free(seq.blocks.back());
+      seq.blocks.pop_back();
+    }
+  }
+
+  // Moves the keys, values and score of token `src` of `seq` to token `dst`.
+  void MoveToken(const Sequence &seq, const int src, const int dst) {
+    const int src_row = Row(seq, src);
+    const int dst_row = Row(seq, dst);
+    for (ggml_tensor *memory : {memory_k, memory_v}) {
+      const size_t row_size = ggml_row_size(memory->type, n_embd_);
+      for (int il = 0; il < n_layer_; il++) {
+        char *data = (char *)memory->data + il * n_blocks_ * BlockSize(memory);
+        memcpy(data + dst_row * row_size, data + src_row * row_size, row_size);
+      }
+    }
+    if (scores_ != nullptr) {
+      scores_[dst_row] = scores_[src_row];
+    }
+  }
+
+  size_t BlockSize(const ggml_tensor *memory) const {
+    return ggml_row_size(memory->type, n_embd_) * kBlockSize;
+  }
+
+  int Alloc() {
+    if (free_.empty()) {
+      fprintf(stderr, "KV cache is full.\n");
+      return -1;
+    }
+    const int block = free_.top();
+    free_.pop();
+    return block;
+  }
+
+  void Free(const int block) {
+    for (ggml_tensor *memory : {memory_k, memory_v}) {
+      const size_t size = BlockSize(memory);
+      for (int il = 0; il < n_layer_; il++) {
+        ggml_lazy_discard(
+            (char *)memory->data + (il * n_blocks_ + block) * size, size);
+      }
+    }
+    free_.push(block);
+  }
+
+  void CopyTokens(const Sequence &seq, const int n, char *data,
+                  const bool save) const {
+    const size_t k_row_size = ggml_row_size(memory_k->type, n_embd_);
+    const size_t v_row_size = ggml_row_size(memory_v->type, n_embd_);
+    for (int i = 0; i < n; i++) {
+      const int row = Row(seq, i);
+      for (int il = 0; il < n_layer_; il++) {
+        const size_t offset = (size_t)il * n_blocks_ * kBlockSize + row;
+        char *k = (char *)memory_k->data + offset * k_row_size;
+        char *v = (char *)memory_v->data + offset * v_row_size;
+        if (save) {
+          memcpy(data, k, k_row_size);
+          memcpy(data + k_row_size, v, v_row_size);
+        } else {
+          memcpy(k, data, k_row_size);
+          memcpy(v, data + k_row_size, v_row_size);
+        }
+        data += k_row_size + v_row_size;
+      }
+    }
+  }
+};
+
 // CUDA
 
 // https://github.com/ggerganov/llama.cpp/blob/332311234a0aa2974b2450710e22e09d90dd6b0b/llama.cpp#L719-L740
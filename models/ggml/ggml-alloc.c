@@ -356,6 +356,7 @@ static bool ggml_op_can_inplace(enum ggml_op op) {
         case GGML_OP_RMS_NORM:
         case GGML_OP_SET:
         case GGML_OP_SOFT_MAX:
+        case GGML_OP_SOFT_MAX_EXT:
         case GGML_OP_CONT:
             return true;
 
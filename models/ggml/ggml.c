@@ -3,6 +3,14 @@
 
 #include "ggml.h"
 
+// with GGML_CPU_VARIANT set (to avx, avx2 or avx512), only the kernels that depend on the
+// instruction set are compiled, under names suffixed with the variant - see ggml_cpu_init
+#ifdef GGML_CPU_VARIANT
+#define GGML_CPU_CONCAT(name, variant) name ## _ ## variant
+#define GGML_CPU_NAME(name, variant) GGML_CPU_CONCAT(name, variant)
+#define GGML_CPU_FN(name) GGML_CPU_NAME(name, GGML_CPU_VARIANT)
+#endif
+
 #ifdef GGML_USE_K_QUANTS
 #include "k_quants.h"
 #endif
@@ -93,6 +101,51 @@ static int sched_yield (void) {
     Sleep (0);
     return 0;
 }
+
+typedef SRWLOCK pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+
+static int pthread_mutex_init(pthread_mutex_t * mutex, void * unused) {
+    (void) unused;
+    InitializeSRWLock(mutex);
+    return 0;
+}
+
+static int pthread_mutex_destroy(pthread_mutex_t * mutex) {
+    (void) mutex;
+    return 0;
+}
+
+static int pthread_mutex_lock(pthread_mutex_t * mutex) {
+    AcquireSRWLockExclusive(mutex);
+    return 0;
+}
+
+static int pthread_mutex_unlock(pthread_mutex_t * mutex) {
+    ReleaseSRWLockExclusive(mutex);
+    return 0;
+}
+
+static int pthread_cond_init(pthread_cond_t * cond, void * unused) {
+    (void) unused;
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+static int pthread_cond_destroy(pthread_cond_t * cond) {
+    (void) cond;
+    return 0;
+}
+
+static int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+    return 0;
+}
+
+static int pthread_cond_broadcast(pthread_cond_t * cond) {
+    WakeAllConditionVariable(cond);
+    return 0;
+}
 #else
 #include <pthread.h>
 #include <stdatomic.h>
@@ -101,6 +154,7 @@ typedef void * thread_ret_t;
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #endif
@@ -432,20 +486,27 @@ static inline ggml_fp16_t ggml_compute_fp32_to_fp16(float f) {
 // global data
 //
 
+// the tables are filled by ggml_init and shared with the GGML_CPU_VARIANT builds
+#ifdef GGML_CPU_VARIANT
+#define GGML_TABLE extern
+#else
+#define GGML_TABLE
+#endif
+
 // precomputed gelu table for f16 (128 KB)
-static ggml_fp16_t table_gelu_f16[1 << 16];
+GGML_TABLE ggml_fp16_t ggml_table_gelu_f16[1 << 16];
 
 // precomputed quick gelu table for f16 (128 KB)
-static ggml_fp16_t table_gelu_quick_f16[1 << 16];
+GGML_TABLE ggml_fp16_t ggml_table_gelu_quick_f16[1 << 16];
 
 // precomputed silu table for f16 (128 KB)
-static ggml_fp16_t table_silu_f16[1 << 16];
+GGML_TABLE ggml_fp16_t ggml_table_silu_f16[1 << 16];
 
 // precomputed exp table for f16 (128 KB)
-static ggml_fp16_t table_exp_f16[1 << 16];
+GGML_TABLE ggml_fp16_t ggml_table_exp_f16[1 << 16];
 
 // precomputed f32 table for f16 (256 KB)
-static float table_f32_f16[1 << 16];
+GGML_TABLE float ggml_table_f32_f16[1 << 16];
 
 #if defined(__ARM_NEON) || defined(__wasm_simd128__)
 #define B1(c,s,n)  0x ## n ## c ,  0x ## n ## s
@@ -470,7 +531,7 @@ static const uint64_t table_b2b_1[1 << 8] = { B8(10, 00) }; // (!b) << 4
 inline static float ggml_lookup_fp16_to_fp32(ggml_fp16_t f) {
     uint16_t s;
     memcpy(&s, &f, sizeof(uint16_t));
-    return table_f32_f16[s];
+    return ggml_table_f32_f16[s];
 }
 
 #define GGML_FP16_TO_FP32(x) ggml_lookup_fp16_to_fp32(x)
@@ -478,23 +539,13 @@ inline static float ggml_lookup_fp16_to_fp32(ggml_fp16_t f) {
 
 #endif
 
-// note: do not use these inside ggml.c
-// these are meant to be used via the ggml.h API
-float ggml_fp16_to_fp32(ggml_fp16_t x) {
-    return (float) GGML_FP16_TO_FP32(x);
-}
-
-ggml_fp16_t ggml_fp32_to_fp16(float x) {
-    return GGML_FP32_TO_FP16(x);
-}
-
-void ggml_fp16_to_fp32_row(const ggml_fp16_t * x, float * y, int n) {
+static void fp16_to_fp32_row(const ggml_fp16_t * x, float * y, int n) {
     for (int i = 0; i < n; i++) {
         y[i] = GGML_FP16_TO_FP32(x[i]);
     }
 }
 
-void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n) {
+static void fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n) {
     int i = 0;
 #if defined(__F16C__)
     for (; i + 7 < n; i += 8) {
@@ -513,6 +564,26 @@ void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n) {
     }
 }
 
+#ifndef GGML_CPU_VARIANT
+
+// note: do not use these inside ggml.c
+// these are meant to be used via the ggml.h API
+float ggml_fp16_to_fp32(ggml_fp16_t x) {
+    return (float) GGML_FP16_TO_FP32(x);
+}
+
+ggml_fp16_t ggml_fp32_to_fp16(float x) {
+    return GGML_FP32_TO_FP16(x);
+}
+
+void ggml_fp16_to_fp32_row(const ggml_fp16_t * x, float * y, int n) {
+    fp16_to_fp32_row(x, y, n);
+}
+
+void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n) {
+    fp32_to_fp16_row(x, y, n);
+}
+
 //
 // timing
 //
@@ -563,6 +634,8 @@ int64_t ggml_cycles_per_ms(void) {
     return CLOCKS_PER_SEC/1000;
 }
 
+#endif // GGML_CPU_VARIANT
+
 #ifdef GGML_PERF
 #define ggml_perf_time_ms()       ggml_time_ms()
 #define ggml_perf_time_us()       ggml_time_us()
@@ -590,7 +663,9 @@ int64_t ggml_cycles_per_ms(void) {
 #endif
 #endif
 
+#ifndef GGML_CPU_VARIANT
 static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
+#endif
 
 //
 // quantization
@@ -670,7 +745,7 @@ static inline __m256 sum_i16_pairs_float(const __m256i x) {
 }
 
 static inline __m256 mul_sum_us8_pairs_float(const __m256i ax, const __m256i sy) {
-#if __AVXVNNI__
+#if __AVXVNNI__ || (__AVX512VNNI__ && __AVX512VL__)
     const __m256i zero = _mm256_setzero_si256();
     const __m256i summed_pairs = _mm256_dpbusd_epi32(zero, ax, sy);
     return _mm256_cvtepi32_ps(summed_pairs);
@@ -696,6 +771,18 @@ static inline __m256 mul_sum_i8_pairs_float(const __m256i x, const __m256i y) {
 #endif
 }
 
+// multiply int8_t, add the results of each 4 bytes and accumulate them to the int32_t of acc
+static inline __m256i mul_add_i8_quads(const __m256i acc, const __m256i x, const __m256i y) {
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+#if __AVXVNNI__ || (__AVX512VNNI__ && __AVX512VL__)
+    return _mm256_dpbusd_epi32(acc, ax, sy);
+#else
+    const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi16(1), dot));
+#endif
+}
+
 static inline __m128i packNibbles( __m256i bytes )
 {
     // Move bits within 16-bit lanes from 0000_abcd_0000_efgh into 0000_0000_abcd_efgh
@@ -939,6 +1026,20 @@ typedef struct {
 } block_q8_1;
 static_assert(sizeof(block_q8_1) == 2*sizeof(float) + QK8_1, "wrong q8_1 block size/padding");
 
+// blocks of 8 consecutive rows, created by ggml_repack
+// the quants of the rows are interleaved 4 bytes at a time: qs[32*k + 4*r + j] is byte 4*k + j of row r
+typedef struct {
+    ggml_fp16_t d[8];          // deltas
+    uint8_t qs[8 * QK4_0 / 2]; // nibbles / quants
+} block_q4_0x8;
+static_assert(sizeof(block_q4_0x8) == 8 * sizeof(block_q4_0), "wrong q4_0x8 block size/padding");
+
+typedef struct {
+    ggml_fp16_t d[8];          // deltas
+    int8_t  qs[8 * QK8_0];     // quants
+} block_q8_0x8;
+static_assert(sizeof(block_q8_0x8) == 8 * sizeof(block_q8_0), "wrong q8_0x8 block size/padding");
+
 // reference implementation for deterministic creation of model files
 static void quantize_row_q4_0_reference(const float * restrict x, block_q4_0 * restrict y, int k) {
     static const int qk = QK4_0;
@@ -1641,16 +1742,22 @@ static void ggml_vec_dot_q4_1_q8_1(const int n, float * restrict s, const void *
 static void ggml_vec_dot_q5_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 static void ggml_vec_dot_q5_1_q8_1(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 static void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
-
-static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
+static void ggml_vec_dot_q4_0_q8_0_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by);
+static void ggml_vec_dot_q8_0_q8_0_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by);
+static void ggml_vec_dot_q4_0x8_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+static void ggml_vec_dot_q8_0x8_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+static void ggml_vec_mad_q4_0_f32(const int n, float * restrict y, const void * restrict vx, const float v);
+static void ggml_vec_mad_q8_0_f32(const int n, float * restrict y, const void * restrict vx, const float v);
+
+static ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
     [GGML_TYPE_F32] = {
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_f32,
         .vec_dot_type             = GGML_TYPE_F32,
     },
     [GGML_TYPE_F16] = {
-        .to_float                 = (ggml_to_float_t) ggml_fp16_to_fp32_row,
-        .from_float               = (ggml_from_float_t) ggml_fp32_to_fp16_row,
-        .from_float_reference     = (ggml_from_float_t) ggml_fp32_to_fp16_row,
+        .to_float                 = (ggml_to_float_t) fp16_to_fp32_row,
+        .from_float               = (ggml_from_float_t) fp32_to_fp16_row,
+        .from_float_reference     = (ggml_from_float_t) fp32_to_fp16_row,
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_f16,
         .vec_dot_type             = GGML_TYPE_F16,
     },
@@ -1659,6 +1766,8 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_q4_0,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_0_reference,
         .vec_dot                  = ggml_vec_dot_q4_0_q8_0,
+        .vec_dot_x4               = ggml_vec_dot_q4_0_q8_0_x4,
+        .mad                      = ggml_vec_mad_q4_0_f32,
         .vec_dot_type             = GGML_TYPE_Q8_0,
     },
     [GGML_TYPE_Q4_1] = {
@@ -1687,6 +1796,8 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_q8_0,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q8_0_reference,
         .vec_dot                  = ggml_vec_dot_q8_0_q8_0,
+        .vec_dot_x4               = ggml_vec_dot_q8_0_q8_0_x4,
+        .mad                      = ggml_vec_mad_q8_0_f32,
         .vec_dot_type             = GGML_TYPE_Q8_0,
     },
     [GGML_TYPE_Q8_1] = {
@@ -1714,6 +1825,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_q4_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_K_reference,
         .vec_dot                  = ggml_vec_dot_q4_K_q8_K,
+        .vec_dot_x4               = ggml_vec_dot_q4_K_q8_K_x4,
         .vec_dot_type             = GGML_TYPE_Q8_K,
     },
     [GGML_TYPE_Q5_K] = {
@@ -1721,6 +1833,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_q5_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q5_K_reference,
         .vec_dot                  = ggml_vec_dot_q5_K_q8_K,
+        .vec_dot_x4               = ggml_vec_dot_q5_K_q8_K_x4,
         .vec_dot_type             = GGML_TYPE_Q8_K,
     },
     [GGML_TYPE_Q6_K] = {
@@ -1732,15 +1845,27 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
     },
     [GGML_TYPE_Q8_K] = {
         .from_float               = quantize_row_q8_K,
-    }
+    },
 #endif
+    [GGML_TYPE_Q4_0_8] = {
+        .vec_dot                  = ggml_vec_dot_q4_0x8_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .nrows                    = 8,
+    },
+    [GGML_TYPE_Q8_0_8] = {
+        .vec_dot                  = ggml_vec_dot_q8_0x8_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .nrows                    = 8,
+    },
 };
 
+#ifndef GGML_CPU_VARIANT
 // For internal test use
 ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type i) {
     GGML_ASSERT(i < GGML_TYPE_COUNT);
     return type_traits[i];
 }
+#endif
 
 
 //
@@ -3352,6 +3477,213 @@ static void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void *
 #endif
 }
 
+// the _x4 variants decode each block of x once and multiply it with the blocks of 4 rows of y
+// the result for each row of y is the same as the one of the single row kernel
+static void ggml_vec_dot_q4_0_q8_0_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by) {
+#if defined(__AVX2__)
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * restrict x = vx;
+    const block_q8_0 * restrict y[4];
+
+    __m256 acc[4];
+
+    for (int k = 0; k < 4; ++k) {
+        y[k]   = (const block_q8_0 *) ((const char *) vy + k*by);
+        acc[k] = _mm256_setzero_ps();
+    }
+
+    const __m256i off = _mm256_set1_epi8( 8 );
+
+    for (int i = 0; i < nb; ++i) {
+        const float dx = GGML_FP16_TO_FP32(x[i].d);
+
+        const __m256i bx = _mm256_sub_epi8( bytes_from_nibbles_32(x[i].qs), off );
+
+        for (int k = 0; k < 4; ++k) {
+            const __m256 d = _mm256_set1_ps( dx * GGML_FP16_TO_FP32(y[k][i].d) );
+
+            const __m256i qy = _mm256_loadu_si256((const __m256i *)y[k][i].qs);
+
+            const __m256 q = mul_sum_i8_pairs_float(bx, qy);
+
+            acc[k] = _mm256_fmadd_ps( d, q, acc[k] );
+        }
+    }
+
+    for (int k = 0; k < 4; ++k) {
+        s[k] = hsum_float_8(acc[k]);
+    }
+#else
+    for (int k = 0; k < 4; ++k) {
+        ggml_vec_dot_q4_0_q8_0(n, s + k, vx, (const char *) vy + k*by);
+    }
+#endif
+}
+
+static void ggml_vec_dot_q8_0_q8_0_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by) {
+#if defined(__AVX2__)
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * restrict x = vx;
+    const block_q8_0 * restrict y[4];
+
+    __m256 acc[4];
+
+    for (int k = 0; k < 4; ++k) {
+        y[k]   = (const block_q8_0 *) ((const char *) vy + k*by);
+        acc[k] = _mm256_setzero_ps();
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        const float dx = GGML_FP16_TO_FP32(x[i].d);
+
+        const __m256i bx = _mm256_loadu_si256((const __m256i *)x[i].qs);
+
+        for (int k = 0; k < 4; ++k) {
+            const __m256 d = _mm256_set1_ps(dx * GGML_FP16_TO_FP32(y[k][i].d));
+
+            const __m256i qy = _mm256_loadu_si256((const __m256i *)y[k][i].qs);
+
+            const __m256 q = mul_sum_i8_pairs_float(bx, qy);
+
+            acc[k] = _mm256_fmadd_ps( d, q, acc[k] );
+        }
+    }
+
+    for (int k = 0; k < 4; ++k) {
+        s[k] = hsum_float_8(acc[k]);
+    }
+#else
+    for (int k = 0; k < 4; ++k) {
+        ggml_vec_dot_q8_0_q8_0(n, s + k, vx, (const char *) vy + k*by);
+    }
+#endif
+}
+
+// the kernels of the interleaved types compute the dot products of y with 8 rows of x at once
+// each 32-byte load of x holds 4 quants of every row, so that the sums of the 8 rows end up in
+// the 8 lanes of one register and no horizontal sums are needed
+static void ggml_vec_dot_q4_0x8_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0x8 * restrict x = vx;
+    const block_q8_0   * restrict y = vy;
+
+#if defined(__AVX2__) && defined(__F16C__)
+    const __m256i m4  = _mm256_set1_epi8(0xF);
+    const __m256i off = _mm256_set1_epi8(8);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        __m256i sumi = _mm256_setzero_si256();
+
+        for (int k = 0; k < 4; ++k) {
+            const __m256i q  = _mm256_loadu_si256((const __m256i *)(x[i].qs + 32*k));
+            const __m256i lo = _mm256_sub_epi8(_mm256_and_si256(q, m4), off);
+            const __m256i hi = _mm256_sub_epi8(_mm256_and_si256(_mm256_srli_epi16(q, 4), m4), off);
+
+            int32_t ylo, yhi;
+            memcpy(&ylo, y[i].qs + 4*k,      sizeof(int32_t));
+            memcpy(&yhi, y[i].qs + 4*k + 16, sizeof(int32_t));
+
+            sumi = mul_add_i8_quads(sumi, lo, _mm256_set1_epi32(ylo));
+            sumi = mul_add_i8_quads(sumi, hi, _mm256_set1_epi32(yhi));
+        }
+
+        const __m256 d = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) x[i].d)),
+                                       _mm256_set1_ps(GGML_FP16_TO_FP32(y[i].d)));
+
+        acc = _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(sumi), acc);
+    }
+
+    _mm256_storeu_ps(s, acc);
+#else
+    float sumf[8] = { 0.0f };
+
+    for (int i = 0; i < nb; ++i) {
+        for (int r = 0; r < 8; ++r) {
+            int sumi = 0;
+
+            for (int k = 0; k < 4; ++k) {
+                for (int j = 0; j < 4; ++j) {
+                    const uint8_t q = x[i].qs[32*k + 4*r + j];
+
+                    sumi += ((q & 0x0F) - 8)*y[i].qs[4*k + j];
+                    sumi += ((q >>   4) - 8)*y[i].qs[4*k + j + 16];
+                }
+            }
+
+            sumf[r] += sumi*(GGML_FP16_TO_FP32(x[i].d[r])*GGML_FP16_TO_FP32(y[i].d));
+        }
+    }
+
+    memcpy(s, sumf, sizeof(sumf));
+#endif
+}
+
+static void ggml_vec_dot_q8_0x8_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0x8 * restrict x = vx;
+    const block_q8_0   * restrict y = vy;
+
+#if defined(__AVX2__) && defined(__F16C__)
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        __m256i sumi = _mm256_setzero_si256();
+
+        for (int k = 0; k < 8; ++k) {
+            const __m256i q = _mm256_loadu_si256((const __m256i *)(x[i].qs + 32*k));
+
+            int32_t qy;
+            memcpy(&qy, y[i].qs + 4*k, sizeof(int32_t));
+
+            sumi = mul_add_i8_quads(sumi, q, _mm256_set1_epi32(qy));
+        }
+
+        const __m256 d = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) x[i].d)),
+                                       _mm256_set1_ps(GGML_FP16_TO_FP32(y[i].d)));
+
+        acc = _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(sumi), acc);
+    }
+
+    _mm256_storeu_ps(s, acc);
+#else
+    float sumf[8] = { 0.0f };
+
+    for (int i = 0; i < nb; ++i) {
+        for (int r = 0; r < 8; ++r) {
+            int sumi = 0;
+
+            for (int k = 0; k < 8; ++k) {
+                for (int j = 0; j < 4; ++j) {
+                    sumi += x[i].qs[32*k + 4*r + j]*y[i].qs[4*k + j];
+                }
+            }
+
+            sumf[r] += sumi*(GGML_FP16_TO_FP32(x[i].d[r])*GGML_FP16_TO_FP32(y[i].d));
+        }
+    }
+
+    memcpy(s, sumf, sizeof(sumf));
+#endif
+}
+
 // compute GGML_VEC_DOT_UNROLL dot products at once
 // xs - x row stride in bytes
 inline static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
@@ -3438,6 +3770,138 @@ inline static void ggml_vec_mad_f32(const int n, float * restrict y, const float
 #endif
 }
 
+// y += x*v with x in f16
+inline static void ggml_vec_mad_f16_f32(const int n, float * restrict y, const ggml_fp16_t * restrict x, const float v) {
+    int i = 0;
+#if defined(__AVX512F__)
+    const __m512 vx = _mm512_set1_ps(v);
+    for (; i + 15 < n; i += 16) {
+        const __m512 ax = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + i)));
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(ax, vx, _mm512_loadu_ps(y + i)));
+    }
+#elif defined(__F16C__) && defined(__FMA__)
+    const __m256 vx = _mm256_set1_ps(v);
+    for (; i + 7 < n; i += 8) {
+        const __m256 ax = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i)));
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(ax, vx, _mm256_loadu_ps(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] += GGML_FP16_TO_FP32(x[i])*v;
+    }
+}
+
+// y += v[0]*x[0] + ... + v[3]*x[3], y is read and written once for the four rows
+inline static void ggml_vec_mad4_f16_f32(const int n, float * restrict y, const ggml_fp16_t * const * x, const float * restrict v) {
+    const ggml_fp16_t * restrict x0 = x[0];
+    const ggml_fp16_t * restrict x1 = x[1];
+    const ggml_fp16_t * restrict x2 = x[2];
+    const ggml_fp16_t * restrict x3 = x[3];
+    int i = 0;
+#if defined(__AVX512F__)
+    const __m512 v0 = _mm512_set1_ps(v[0]);
+    const __m512 v1 = _mm512_set1_ps(v[1]);
+    const __m512 v2 = _mm512_set1_ps(v[2]);
+    const __m512 v3 = _mm512_set1_ps(v[3]);
+    for (; i + 15 < n; i += 16) {
+        __m512 ay = _mm512_loadu_ps(y + i);
+        ay = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x0 + i))), v0, ay);
+        ay = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x1 + i))), v1, ay);
+        ay = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x2 + i))), v2, ay);
+        ay = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x3 + i))), v3, ay);
+        _mm512_storeu_ps(y + i, ay);
+    }
+#elif defined(__F16C__) && defined(__FMA__)
+    const __m256 v0 = _mm256_set1_ps(v[0]);
+    const __m256 v1 = _mm256_set1_ps(v[1]);
+    const __m256 v2 = _mm256_set1_ps(v[2]);
+    const __m256 v3 = _mm256_set1_ps(v[3]);
+    for (; i + 7 < n; i += 8) {
+        __m256 ay = _mm256_loadu_ps(y + i);
+        ay = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x0 + i))), v0, ay);
+        ay = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x1 + i))), v1, ay);
+        ay = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x2 + i))), v2, ay);
+        ay = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x3 + i))), v3, ay);
+        _mm256_storeu_ps(y + i, ay);
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] += GGML_FP16_TO_FP32(x0[i])*v[0] + GGML_FP16_TO_FP32(x1[i])*v[1] +
+                GGML_FP16_TO_FP32(x2[i])*v[2] + GGML_FP16_TO_FP32(x3[i])*v[3];
+    }
+}
+
+// y += x*v with x in q4_0, the nibbles are converted to f32 in registers
+static void ggml_vec_mad_q4_0_f32(const int n, float * restrict y, const void * restrict vx, const float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * restrict x = vx;
+
+    for (int i = 0; i < nb; i++) {
+        const float d = GGML_FP16_TO_FP32(x[i].d)*v;
+        float * restrict yb = y + i*qk;
+#if defined(__AVX512F__)
+        const __m512  vd = _mm512_set1_ps(d);
+        const __m128i qs = _mm_loadu_si128((const __m128i *) x[i].qs);
+        const __m128i m4 = _mm_set1_epi8(0xF);
+        const __m128i q0 = _mm_sub_epi8(_mm_and_si128(qs, m4), _mm_set1_epi8(8));
+        const __m128i q1 = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(qs, 4), m4), _mm_set1_epi8(8));
+        _mm512_storeu_ps(yb,      _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(q0)), vd, _mm512_loadu_ps(yb)));
+        _mm512_storeu_ps(yb + 16, _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(q1)), vd, _mm512_loadu_ps(yb + 16)));
+#elif defined(__AVX2__) && defined(__FMA__)
+        const __m256  vd = _mm256_set1_ps(d);
+        const __m128i qs = _mm_loadu_si128((const __m128i *) x[i].qs);
+        const __m128i m4 = _mm_set1_epi8(0xF);
+        const __m128i q0 = _mm_sub_epi8(_mm_and_si128(qs, m4), _mm_set1_epi8(8));
+        const __m128i q1 = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(qs, 4), m4), _mm_set1_epi8(8));
+        _mm256_storeu_ps(yb,      _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q0)), vd, _mm256_loadu_ps(yb)));
+        _mm256_storeu_ps(yb + 8,  _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q0, 8))), vd, _mm256_loadu_ps(yb + 8)));
+        _mm256_storeu_ps(yb + 16, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q1)), vd, _mm256_loadu_ps(yb + 16)));
+        _mm256_storeu_ps(yb + 24, _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q1, 8))), vd, _mm256_loadu_ps(yb + 24)));
+#else
+        for (int j = 0; j < qk/2; ++j) {
+            yb[j]        += ((x[i].qs[j] & 0x0F) - 8)*d;
+            yb[j + qk/2] += ((x[i].qs[j] >>   4) - 8)*d;
+        }
+#endif
+    }
+}
+
+// y += x*v with x in q8_0, the quants are converted to f32 in registers
+static void ggml_vec_mad_q8_0_f32(const int n, float * restrict y, const void * restrict vx, const float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * restrict x = vx;
+
+    for (int i = 0; i < nb; i++) {
+        const float d = GGML_FP16_TO_FP32(x[i].d)*v;
+        float * restrict yb = y + i*qk;
+#if defined(__AVX512F__)
+        const __m512 vd = _mm512_set1_ps(d);
+        for (int j = 0; j < qk; j += 16) {
+            const __m512 ax = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(x[i].qs + j))));
+            _mm512_storeu_ps(yb + j, _mm512_fmadd_ps(ax, vd, _mm512_loadu_ps(yb + j)));
+        }
+#elif defined(__AVX2__) && defined(__FMA__)
+        const __m256 vd = _mm256_set1_ps(d);
+        for (int j = 0; j < qk; j += 8) {
+            const __m256 ax = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(x[i].qs + j))));
+            _mm256_storeu_ps(yb + j, _mm256_fmadd_ps(ax, vd, _mm256_loadu_ps(yb + j)));
+        }
+#else
+        for (int j = 0; j < qk; ++j) {
+            yb[j] += x[i].qs[j]*d;
+        }
+#endif
+    }
+}
+
 //inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) { for (int i = 0; i < n; ++i) y[i] *= v;          }
 inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) {
 #if defined(GGML_USE_ACCELERATE)
@@ -3484,6 +3948,7 @@ inline static void ggml_vec_relu_f32 (const int n, float * y, const float * x) {
 static const float GELU_COEF_A    = 0.044715f;
 static const float GELU_QUICK_COEF    = -1.702f;
 static const float SQRT_2_OVER_PI = 0.79788456080286535587989211986876f;
+static const float SQRT_1_OVER_2  = 0.70710678118654752440084436210485f;
 
 inline static float ggml_gelu_f32(float x) {
     return 0.5f*x*(1.0f + tanhf(SQRT_2_OVER_PI*x*(1.0f + GELU_COEF_A*x*x)));
@@ -3492,19 +3957,36 @@ inline static float ggml_gelu_f32(float x) {
 inline static void ggml_vec_gelu_f16(const int n, ggml_fp16_t * y, const ggml_fp16_t * x) {
     const uint16_t * i16 = (const uint16_t *) x;
     for (int i = 0; i < n; ++i) {
-        y[i] = table_gelu_f16[i16[i]];
+        y[i] = ggml_table_gelu_f16[i16[i]];
     }
 }
 
-#ifdef GGML_GELU_FP16
-inline static void ggml_vec_gelu_f32(const int n, float * y, const float * x) {
+// y[i] = table[f16(x[i])] - with F16C, 8 values are converted to and from f16 at once
+inline static void ggml_vec_lookup_f16_f32(const int n, float * y, const float * x, const ggml_fp16_t * table) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 7 < n; i += 8) {
+        uint16_t t[8];
+        ggml_fp16_t r[8];
+        _mm_storeu_si128((__m128i *) t, _mm256_cvtps_ph(_mm256_loadu_ps(x + i), 0));
+        for (int j = 0; j < 8; ++j) {
+            r[j] = table[t[j]];
+        }
+        _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) r)));
+    }
+#endif
     uint16_t t;
-    for (int i = 0; i < n; ++i) {
+    for (; i < n; ++i) {
         ggml_fp16_t fp16 = GGML_FP32_TO_FP16(x[i]);
         memcpy(&t, &fp16, sizeof(uint16_t));
-        y[i] = GGML_FP16_TO_FP32(table_gelu_f16[t]);
+        y[i] = GGML_FP16_TO_FP32(table[t]);
     }
 }
+
+#ifdef GGML_GELU_FP16
+inline static void ggml_vec_gelu_f32(const int n, float * y, const float * x) {
+    ggml_vec_lookup_f16_f32(n, y, x, ggml_table_gelu_f16);
+}
 #else
 inline static void ggml_vec_gelu_f32(const int n, float * y, const float * x) {
     for (int i = 0; i < n; ++i) {
@@ -3520,18 +4002,13 @@ inline static float ggml_gelu_quick_f32(float x) {
 //inline static void ggml_vec_gelu_quick_f16(const int n, ggml_fp16_t * y, const ggml_fp16_t * x) {
 //    const uint16_t * i16 = (const uint16_t *) x;
 //    for (int i = 0; i < n; ++i) {
-//        y[i] = table_gelu_quick_f16[i16[i]];
+//        y[i] = ggml_table_gelu_quick_f16[i16[i]];
 //    }
 //}
 
 #ifdef GGML_GELU_QUICK_FP16
 inline static void ggml_vec_gelu_quick_f32(const int n, float * y, const float * x) {
-    uint16_t t;
-    for (int i = 0; i < n; ++i) {
-        ggml_fp16_t fp16 = GGML_FP32_TO_FP16(x[i]);
-        memcpy(&t, &fp16, sizeof(uint16_t));
-        y[i] = GGML_FP16_TO_FP32(table_gelu_quick_f16[t]);
-    }
+    ggml_vec_lookup_f16_f32(n, y, x, ggml_table_gelu_quick_f16);
 }
 #else
 inline static void ggml_vec_gelu_quick_f32(const int n, float * y, const float * x) {
@@ -3549,18 +4026,13 @@ inline static float ggml_silu_f32(float x) {
 //inline static void ggml_vec_silu_f16(const int n, ggml_fp16_t * y, const ggml_fp16_t * x) {
 //    const uint16_t * i16 = (const uint16_t *) x;
 //    for (int i = 0; i < n; ++i) {
-//        y[i] = table_silu_f16[i16[i]];
+//        y[i] = ggml_table_silu_f16[i16[i]];
 //    }
 //}
 
 #ifdef GGML_SILU_FP16
 inline static void ggml_vec_silu_f32(const int n, float * y, const float * x) {
-    uint16_t t;
-    for (int i = 0; i < n; ++i) {
-        ggml_fp16_t fp16 = GGML_FP32_TO_FP16(x[i]);
-        memcpy(&t, &fp16, sizeof(uint16_t));
-        y[i] = GGML_FP16_TO_FP32(table_silu_f16[t]);
-    }
+    ggml_vec_lookup_f16_f32(n, y, x, ggml_table_silu_f16);
 }
 #else
 inline static void ggml_vec_silu_f32(const int n, float * y, const float * x) {
@@ -3593,6 +4065,151 @@ inline static void ggml_vec_silu_backward_f32(const int n, float * dx, const flo
 }
 #endif
 
+inline static float ggml_gelu_erf_f32(float x) {
+    return 0.5f*x*(1.0f + erff(x*SQRT_1_OVER_2));
+}
+
+//
+// f32 activations without the f16 tables
+//
+// GGML_F32_VEC has no exp() or division, so the kernels below use their own vector type
+//
+
+#if defined(__AVX512F__)
+
+#define GGML_V_EPR 16
+
+#define GGML_V            __m512
+#define GGML_V_SET1       _mm512_set1_ps
+#define GGML_V_LOAD       _mm512_loadu_ps
+#define GGML_V_STORE      _mm512_storeu_ps
+#define GGML_V_ADD        _mm512_add_ps
+#define GGML_V_MUL        _mm512_mul_ps
+#define GGML_V_DIV        _mm512_div_ps
+#define GGML_V_MIN        _mm512_min_ps
+#define GGML_V_MAX        _mm512_max_ps
+#define GGML_V_ABS        _mm512_abs_ps
+#define GGML_V_FMA        _mm512_fmadd_ps // a*b + c
+#define GGML_V_ROUND(x)   _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+// r where x >= t, 0 elsewhere
+#define GGML_V_IF_GE(x, t, r) _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, t, _CMP_GE_OQ), r)
+// 2^n for integral n in [-126, 127]
+#define GGML_V_EXP2I(n)   _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23))
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+#define GGML_V_EPR 8
+
+#define GGML_V            __m256
+#define GGML_V_SET1       _mm256_set1_ps
+#define GGML_V_LOAD       _mm256_loadu_ps
+#define GGML_V_STORE      _mm256_storeu_ps
+#define GGML_V_ADD        _mm256_add_ps
+#define GGML_V_MUL        _mm256_mul_ps
+#define GGML_V_DIV        _mm256_div_ps
+#define GGML_V_MIN        _mm256_min_ps
+#define GGML_V_MAX        _mm256_max_ps
+#define GGML_V_ABS(x)     _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x)
+#define GGML_V_FMA        _mm256_fmadd_ps // a*b + c
+#define GGML_V_ROUND(x)   _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define GGML_V_IF_GE(x, t, r) _mm256_and_ps(_mm256_cmp_ps(x, t, _CMP_GE_OQ), r)
+#define GGML_V_EXP2I(n)   _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23))
+
+#endif
+
+#if defined(GGML_V_EPR)
+
+// exp(x) = 2^n*exp(r) with r = x - n*ln(2) and the Cephes polynomial for exp(r)
+// x is clamped to 87 from above so that 2^n is a normal float, below -87 (and for -inf) the result is 0
+inline static GGML_V ggml_v_expf(GGML_V x) {
+    const GGML_V lo = GGML_V_SET1(-87.0f);
+    const GGML_V xc = GGML_V_MIN(GGML_V_MAX(x, lo), GGML_V_SET1(87.0f));
+
+    const GGML_V n = GGML_V_ROUND(GGML_V_MUL(xc, GGML_V_SET1(1.44269504088896341f)));
+
+    // ln(2) = 0.693359375 - 2.12194440e-4, the first part is exact in f32
+    GGML_V r = GGML_V_FMA(n, GGML_V_SET1(-0.693359375f), xc);
+    r        = GGML_V_FMA(n, GGML_V_SET1(2.12194440e-4f), r);
+
+    GGML_V p = GGML_V_SET1(1.9875691500e-4f);
+    p = GGML_V_FMA(p, r, GGML_V_SET1(1.3981999507e-3f));
+    p = GGML_V_FMA(p, r, GGML_V_SET1(8.3334519073e-3f));
+    p = GGML_V_FMA(p, r, GGML_V_SET1(4.1665795894e-2f));
+    p = GGML_V_FMA(p, r, GGML_V_SET1(1.6666665459e-1f));
+    p = GGML_V_FMA(p, r, GGML_V_SET1(5.0000001201e-1f));
+    p = GGML_V_FMA(p, GGML_V_MUL(r, r), GGML_V_ADD(r, GGML_V_SET1(1.0f)));
+
+    return GGML_V_IF_GE(x, lo, GGML_V_MUL(p, GGML_V_EXP2I(n)));
+}
+
+// x*sigmoid(z) = x/(1 + exp(-z))
+inline static GGML_V ggml_v_mul_sigmoid(GGML_V x, GGML_V z) {
+    const GGML_V e = ggml_v_expf(GGML_V_MUL(z, GGML_V_SET1(-1.0f)));
+    return GGML_V_DIV(x, GGML_V_ADD(e, GGML_V_SET1(1.0f)));
+}
+
+// 0.5*x*(1 + tanh(z)) = x*sigmoid(2*z)
+inline static GGML_V ggml_v_gelu(GGML_V x) {
+    const GGML_V x2 = GGML_V_MUL(x, x);
+    const GGML_V z  = GGML_V_MUL(GGML_V_MUL(x, GGML_V_SET1(2.0f*SQRT_2_OVER_PI)),
+                                 GGML_V_FMA(x2, GGML_V_SET1(GELU_COEF_A), GGML_V_SET1(1.0f)));
+    return ggml_v_mul_sigmoid(x, z);
+}
+
+// erf(t) = 1 - q(t) for t >= 0, with q from Abramowitz and Stegun 7.1.26 (|error| < 1.5e-7)
+// so gelu_erf(x) = max(x, 0) - 0.5*|x|*q(|x|/sqrt(2))
+inline static GGML_V ggml_v_gelu_erf(GGML_V x) {
+    const GGML_V ax = GGML_V_ABS(x);
+    const GGML_V t  = GGML_V_MUL(ax, GGML_V_SET1(SQRT_1_OVER_2));
+    const GGML_V k  = GGML_V_DIV(GGML_V_SET1(1.0f), GGML_V_FMA(t, GGML_V_SET1(0.3275911f), GGML_V_SET1(1.0f)));
+
+    GGML_V p = GGML_V_SET1(1.061405429f);
+    p = GGML_V_FMA(p, k, GGML_V_SET1(-1.453152027f));
+    p = GGML_V_FMA(p, k, GGML_V_SET1(1.421413741f));
+    p = GGML_V_FMA(p, k, GGML_V_SET1(-0.284496736f));
+    p = GGML_V_FMA(p, k, GGML_V_SET1(0.254829592f));
+    p = GGML_V_MUL(p, k);
+
+    const GGML_V q = GGML_V_MUL(p, ggml_v_expf(GGML_V_MUL(GGML_V_MUL(t, t), GGML_V_SET1(-1.0f))));
+
+    return GGML_V_FMA(GGML_V_MUL(ax, GGML_V_SET1(-0.5f)), q, GGML_V_MAX(x, GGML_V_SET1(0.0f)));
+}
+
+inline static GGML_V ggml_v_silu(GGML_V x) {
+    return ggml_v_mul_sigmoid(x, x);
+}
+
+#endif
+
+// y = act(x + b), without b if it is NULL
+#if defined(GGML_V_EPR)
+#define GGML_VEC_BIAS_ACT_F32(name, act_v, act)                                      \
+inline static void ggml_vec_bias_##name##_f32(const int n, float * y, const float * x, const float * b) { \
+    int i = 0;                                                                        \
+    for (; i + GGML_V_EPR <= n; i += GGML_V_EPR) {                                    \
+        GGML_V v = GGML_V_LOAD(x + i);                                                \
+        if (b) {                                                                      \
+            v = GGML_V_ADD(v, GGML_V_LOAD(b + i));                                    \
+        }                                                                             \
+        GGML_V_STORE(y + i, act_v(v));                                                \
+    }                                                                                 \
+    for (; i < n; ++i) {                                                              \
+        y[i] = act(x[i] + (b ? b[i] : 0.0f));                                         \
+    }                                                                                 \
+}
+#else
+#define GGML_VEC_BIAS_ACT_F32(name, act_v, act)                                      \
+inline static void ggml_vec_bias_##name##_f32(const int n, float * y, const float * x, const float * b) { \
+    for (int i = 0; i < n; ++i) {                                                     \
+        y[i] = act(x[i] + (b ? b[i] : 0.0f));                                         \
+    }                                                                                 \
+}
+#endif
+
+GGML_VEC_BIAS_ACT_F32(gelu,     ggml_v_gelu,     ggml_gelu_f32)
+GGML_VEC_BIAS_ACT_F32(gelu_erf, ggml_v_gelu_erf, ggml_gelu_erf_f32)
+GGML_VEC_BIAS_ACT_F32(silu,     ggml_v_silu,     ggml_silu_f32)
+
 inline static void ggml_vec_sum_f32(const int n, float * s, const float * x) {
 #ifndef GGML_USE_ACCELERATE
     ggml_float sum = 0.0;
@@ -3648,6 +4265,348 @@ inline static void ggml_vec_argmax_f32(const int n, int * s, const float * x) {
     *s = idx;
 }
 
+#if defined(GGML_V_EPR)
+// y[i] = exp(x[i] - max), returns the sum of y
+inline static ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float max) {
+    ggml_float sum = 0.0;
+    int i = 0;
+
+    const GGML_V vmax = GGML_V_SET1(-max);
+
+    GGML_V vsum = GGML_V_SET1(0.0f);
+    for (; i + GGML_V_EPR <= n; i += GGML_V_EPR) {
+        const GGML_V val = ggml_v_expf(GGML_V_ADD(GGML_V_LOAD(x + i), vmax));
+        GGML_V_STORE(y + i, val);
+        vsum = GGML_V_ADD(vsum, val);
+    }
+
+    float t[GGML_V_EPR];
+    GGML_V_STORE(t, vsum);
+    for (int j = 0; j < GGML_V_EPR; ++j) {
+        sum += (ggml_float)t[j];
+    }
+
+    for (; i < n; ++i) {
+        const float val = x[i] == -INFINITY ? 0.0f : expf(x[i] - max);
+        sum += (ggml_float)val;
+        y[i] = val;
+    }
+    return sum;
+}
+#else
+// y[i] = exp(x[i] - max) via the f16 exp table, returns the sum of y
+inline static ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float max) {
+    ggml_float sum = 0.0;
+    int i = 0;
+#if defined(__F16C__)
+    const __m256 vmax = _mm256_set1_ps(max);
+    for (; i + 7 < n; i += 8) {
+        uint16_t t[8];
+        _mm_storeu_si128((__m128i *) t, _mm256_cvtps_ph(_mm256_sub_ps(_mm256_loadu_ps(x + i), vmax), 0));
+        for (int j = 0; j < 8; ++j) {
+            if (x[i + j] == -INFINITY) {
+                y[i + j] = 0.0f;
+            } else {
+                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[t[j]]);
+                sum += (ggml_float)val;
+                y[i + j] = val;
+            }
+        }
+    }
+#endif
+    uint16_t scvt;
+    for (; i < n; ++i) {
+        if (x[i] == -INFINITY) {
+            y[i] = 0.0f;
+        } else {
+            // const float val = (x[i] == -INFINITY) ? 0.0 : exp(x[i] - max);
+            ggml_fp16_t s = GGML_FP32_TO_FP16(x[i] - max);
+            memcpy(&scvt, &s, sizeof(scvt));
+            const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
+            sum += (ggml_float)val;
+            y[i] = val;
+        }
+    }
+    return sum;
+}
+#endif
+
+// y = (x - mean(x))/sqrt(var(x) + eps)*g + b, without b if it is NULL
+inline static void ggml_vec_norm_affine_f32(const int n, float * y, const float * x, const float * g, const float * b, const float eps) {
+    // the sums are reduced in ggml_float like ggml_compute_forward_norm_f32
+    ggml_float sum  = 0.0;
+    ggml_float sum2 = 0.0;
+    int k = 0;
+
+#if defined(GGML_SIMD)
+    const int np = (n & ~(GGML_F32_STEP - 1));
+
+    GGML_F32_VEC acc[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
+    for (k = 0; k < np; k += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            acc[j] = GGML_F32_VEC_ADD(acc[j], GGML_F32_VEC_LOAD(x + k + j*GGML_F32_EPR));
+        }
+    }
+    float sumf;
+    GGML_F32_VEC_REDUCE(sumf, acc);
+    sum = (ggml_float) sumf;
+#endif
+    for (; k < n; ++k) {
+        sum += (ggml_float)x[k];
+    }
+
+    const float mean = sum/n;
+
+    k = 0;
+#if defined(GGML_SIMD)
+    const GGML_F32_VEC vm = GGML_F32_VEC_SET1(-mean);
+
+    GGML_F32_VEC acc2[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
+    for (k = 0; k < np; k += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            const GGML_F32_VEC d = GGML_F32_VEC_ADD(GGML_F32_VEC_LOAD(x + k + j*GGML_F32_EPR), vm);
+            acc2[j] = GGML_F32_VEC_FMA(acc2[j], d, d);
+        }
+    }
+    float sum2f;
+    GGML_F32_VEC_REDUCE(sum2f, acc2);
+    sum2 = (ggml_float) sum2f;
+#endif
+    for (; k < n; ++k) {
+        const float v = x[k] - mean;
+        sum2 += (ggml_float)(v*v);
+    }
+
+    const float variance = sum2/n;
+    const float scale    = 1.0f/sqrtf(variance + eps);
+
+    k = 0;
+#if defined(GGML_SIMD)
+    const GGML_F32_VEC vs = GGML_F32_VEC_SET1(scale);
+
+    for (k = 0; k < np; k += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            const int o = k + j*GGML_F32_EPR;
+            // (x - mean)*scale, x*scale - mean*scale would cancel when |mean| is much larger than the deviation
+            const GGML_F32_VEC t = GGML_F32_VEC_MUL(GGML_F32_VEC_ADD(GGML_F32_VEC_LOAD(x + o), vm), vs);
+            if (b) {
+                GGML_F32_VEC_STORE(y + o, GGML_F32_VEC_FMA(GGML_F32_VEC_LOAD(b + o), t, GGML_F32_VEC_LOAD(g + o)));
+            } else {
+                GGML_F32_VEC_STORE(y + o, GGML_F32_VEC_MUL(t, GGML_F32_VEC_LOAD(g + o)));
+            }
+        }
+    }
+#endif
+    for (; k < n; ++k) {
+        y[k] = (x[k] - mean)*scale*g[k] + (b ? b[k] : 0.0f);
+    }
+}
+
+// y = x/sqrt(mean(x^2) + eps)*g
+inline static void ggml_vec_rms_norm_affine_f32(const int n, float * y, const float * x, const float * g, const float eps) {
+    // the sum is reduced in ggml_float like ggml_compute_forward_rms_norm_f32
+    ggml_float sum = 0.0;
+    int k = 0;
+
+#if defined(GGML_SIMD)
+    const int np = (n & ~(GGML_F32_STEP - 1));
+
+    GGML_F32_VEC acc[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
+    for (k = 0; k < np; k += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            const GGML_F32_VEC ax = GGML_F32_VEC_LOAD(x + k + j*GGML_F32_EPR);
+            acc[j] = GGML_F32_VEC_FMA(acc[j], ax, ax);
+        }
+    }
+    float sumf;
+    GGML_F32_VEC_REDUCE(sumf, acc);
+    sum = (ggml_float) sumf;
+#endif
+    for (; k < n; ++k) {
+        sum += (ggml_float)(x[k]*x[k]);
+    }
+
+    const float mean  = sum/n;
+    const float scale = 1.0f/sqrtf(mean + eps);
+
+    k = 0;
+#if defined(GGML_SIMD)
+    const GGML_F32_VEC vs = GGML_F32_VEC_SET1(scale);
+
+    for (k = 0; k < np; k += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            const int o = k + j*GGML_F32_EPR;
+            const GGML_F32_VEC t = GGML_F32_VEC_MUL(GGML_F32_VEC_LOAD(x + o), vs);
+            GGML_F32_VEC_STORE(y + o, GGML_F32_VEC_MUL(t, GGML_F32_VEC_LOAD(g + o)));
+        }
+    }
+#endif
+    for (; k < n; ++k) {
+        y[k] = x[k]*scale*g[k];
+    }
+}
+
+// kernels that are not tied to a tensor type
+// like type_traits, they are replaced at runtime in builds with GGML_CPU_DISPATCH
+typedef struct {
+    void       (*gelu_f32)           (const int n, float * y, const float * x);
+    void       (*gelu_quick_f32)     (const int n, float * y, const float * x);
+    void       (*silu_f32)           (const int n, float * y, const float * x);
+    ggml_float (*soft_max_f32)       (const int n, float * y, const float * x, float max);
+    void       (*mad_f32)            (const int n, float * y, const float * x, const float v);
+    void       (*mad_f16_f32)        (const int n, float * y, const ggml_fp16_t * x, const float v);
+    void       (*mad4_f16_f32)       (const int n, float * y, const ggml_fp16_t * const * x, const float * v);
+    void       (*norm_affine_f32)    (const int n, float * y, const float * x, const float * g, const float * b, const float eps);
+    void       (*rms_norm_affine_f32)(const int n, float * y, const float * x, const float * g, const float eps);
+    void       (*bias_gelu_f32)      (const int n, float * y, const float * x, const float * b);
+    void       (*bias_gelu_erf_f32)  (const int n, float * y, const float * x, const float * b);
+    void       (*bias_silu_f32)      (const int n, float * y, const float * x, const float * b);
+} ggml_vec_kernels_t;
+
+static ggml_vec_kernels_t vec_kernels = {
+    .gelu_f32            = ggml_vec_gelu_f32,
+    .gelu_quick_f32      = ggml_vec_gelu_quick_f32,
+    .silu_f32            = ggml_vec_silu_f32,
+    .soft_max_f32        = ggml_vec_soft_max_f32,
+    .mad_f32             = ggml_vec_mad_f32,
+    .mad_f16_f32         = ggml_vec_mad_f16_f32,
+    .mad4_f16_f32        = ggml_vec_mad4_f16_f32,
+    .norm_affine_f32     = ggml_vec_norm_affine_f32,
+    .rms_norm_affine_f32 = ggml_vec_rms_norm_affine_f32,
+    .bias_gelu_f32       = ggml_vec_bias_gelu_f32,
+    .bias_gelu_erf_f32   = ggml_vec_bias_gelu_erf_f32,
+    .bias_silu_f32       = ggml_vec_bias_silu_f32,
+};
+
+#ifdef GGML_CPU_VARIANT
+
+void GGML_CPU_FN(ggml_cpu_init)(ggml_type_traits_t * traits, ggml_vec_kernels_t * vec) {
+    memcpy(traits, type_traits, sizeof(type_traits));
+    *vec = vec_kernels;
+}
+
+#else
+
+//
+// runtime cpu dispatch
+//
+
+#ifdef GGML_CPU_DISPATCH
+
+// the kernels of ggml.c and k_quants.c are also compiled for each of these variants,
+// and ggml_init switches to the best one that the cpu supports
+void ggml_cpu_init_avx   (ggml_type_traits_t * traits, ggml_vec_kernels_t * vec);
+void ggml_cpu_init_avx2  (ggml_type_traits_t * traits, ggml_vec_kernels_t * vec);
+void ggml_cpu_init_avx512(ggml_type_traits_t * traits, ggml_vec_kernels_t * vec);
+
+enum ggml_cpu_level {
+    GGML_CPU_BASIC,
+    GGML_CPU_AVX,    // AVX + F16C
+    GGML_CPU_AVX2,   // AVX2 + FMA + F16C
+    GGML_CPU_AVX512, // AVX-512 F/BW/VL/VNNI
+    GGML_CPU_LEVEL_COUNT,
+};
+
+static const char * GGML_CPU_LEVEL_NAME[GGML_CPU_LEVEL_COUNT] = {
+    "basic",
+    "avx",
+    "avx2",
+    "avx512",
+};
+
+static enum ggml_cpu_level cpu_level = GGML_CPU_BASIC;
+
+static void ggml_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t r[4]) {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuidex(regs, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; ++i) {
+        r[i] = (uint32_t) regs[i];
+    }
+#else
+    __asm__ __volatile__("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3]) : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+// register state that the os saves on context switches
+static uint64_t ggml_xgetbv(void) {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t) edx << 32) | eax;
+#endif
+}
+
+static enum ggml_cpu_level ggml_cpu_detect(void) {
+    uint32_t r[4];
+    ggml_cpuid(0, 0, r);
+    const uint32_t max_leaf = r[0];
+
+    ggml_cpuid(1, 0, r);
+    const bool osxsave = r[2] & (1u << 27);
+    const bool avx     = r[2] & (1u << 28);
+    const bool f16c    = r[2] & (1u << 29);
+    const bool fma     = r[2] & (1u << 12);
+
+    // ymm state
+    if (!osxsave || (ggml_xgetbv() & 0x6) != 0x6 || !avx || !f16c) {
+        return GGML_CPU_BASIC;
+    }
+    if (max_leaf < 7) {
+        return GGML_CPU_AVX;
+    }
+
+    ggml_cpuid(7, 0, r);
+    const bool avx2       = r[1] & (1u << 5);
+    const bool avx512f    = r[1] & (1u << 16);
+    const bool avx512bw   = r[1] & (1u << 30);
+    const bool avx512vl   = r[1] & (1u << 31);
+    const bool avx512vnni = r[2] & (1u << 11);
+
+    if (!avx2 || !fma) {
+        return GGML_CPU_AVX;
+    }
+    // opmask and zmm state
+    if (!avx512f || !avx512bw || !avx512vl || !avx512vnni || (ggml_xgetbv() & 0xe6) != 0xe6) {
+        return GGML_CPU_AVX2;
+    }
+    return GGML_CPU_AVX512;
+}
+
+// selects the kernels of the best variant for this cpu
+// GGML_CPU=basic|avx|avx2|avx512 in the environment selects a lower one, for testing
+static void ggml_cpu_init(void) {
+    const enum ggml_cpu_level best = ggml_cpu_detect();
+    enum ggml_cpu_level level = best;
+
+    const char * name = getenv("GGML_CPU");
+    if (name != NULL) {
+        int i = 0;
+        while (i < GGML_CPU_LEVEL_COUNT && strcmp(name, GGML_CPU_LEVEL_NAME[i]) != 0) {
+            ++i;
+        }
+        if (i > (int) best) {
+            GGML_PRINT("%s: GGML_CPU=%s is unknown or not supported by this cpu, using %s\n", __func__, name, GGML_CPU_LEVEL_NAME[best]);
+        } else {
+            level = (enum ggml_cpu_level) i;
+        }
+    }
+
+    switch (level) {
+        case GGML_CPU_AVX:    ggml_cpu_init_avx   (type_traits, &vec_kernels); break;
+        case GGML_CPU_AVX2:   ggml_cpu_init_avx2  (type_traits, &vec_kernels); break;
+        case GGML_CPU_AVX512: ggml_cpu_init_avx512(type_traits, &vec_kernels); break;
+        default: break;
+    }
+    cpu_level = level;
+
+    GGML_PRINT_DEBUG("%s: using %s kernels\n", __func__, GGML_CPU_LEVEL_NAME[level]);
+}
+
+#endif // GGML_CPU_DISPATCH
+
 //
 // data types
 //
@@ -3672,8 +4631,10 @@ static const int GGML_BLCK_SIZE[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8]   = 1,
     [GGML_TYPE_I16]  = 1,
     [GGML_TYPE_I32]  = 1,
+    [GGML_TYPE_Q4_0_8] = QK4_0,
+    [GGML_TYPE_Q8_0_8] = QK8_0,
 };
-static_assert(GGML_TYPE_COUNT == 19, "GGML_BLCK_SIZE is outdated");
+static_assert(GGML_TYPE_COUNT == 21, "GGML_BLCK_SIZE is outdated");
 
 static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
     [GGML_TYPE_F32]  = sizeof(float),
@@ -3695,8 +4656,10 @@ static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8]   = sizeof(int8_t),
     [GGML_TYPE_I16]  = sizeof(int16_t),
     [GGML_TYPE_I32]  = sizeof(int32_t),
+    [GGML_TYPE_Q4_0_8] = sizeof(block_q4_0),
+    [GGML_TYPE_Q8_0_8] = sizeof(block_q8_0),
 };
-static_assert(GGML_TYPE_COUNT == 19, "GGML_TYPE_SIZE is outdated");
+static_assert(GGML_TYPE_COUNT == 21, "GGML_TYPE_SIZE is outdated");
 
 
 static const char * GGML_TYPE_NAME[GGML_TYPE_COUNT] = {
@@ -3717,8 +4680,10 @@ static const char * GGML_TYPE_NAME[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8]   = "i8",
     [GGML_TYPE_I16]  = "i16",
     [GGML_TYPE_I32]  = "i32",
+    [GGML_TYPE_Q4_0_8] = "q4_0_8",
+    [GGML_TYPE_Q8_0_8] = "q8_0_8",
 };
-static_assert(GGML_TYPE_COUNT == 19, "GGML_TYPE_NAME is outdated");
+static_assert(GGML_TYPE_COUNT == 21, "GGML_TYPE_NAME is outdated");
 
 static bool GGML_IS_QUANTIZED[GGML_TYPE_COUNT] = {
     [GGML_TYPE_F32]  = false,
@@ -3738,8 +4703,10 @@ static bool GGML_IS_QUANTIZED[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8]   = false,
     [GGML_TYPE_I16]  = false,
     [GGML_TYPE_I32]  = false,
+    [GGML_TYPE_Q4_0_8] = true,
+    [GGML_TYPE_Q8_0_8] = true,
 };
-static_assert(GGML_TYPE_COUNT == 19, "GGML_IS_QUANTIZED is outdated");
+static_assert(GGML_TYPE_COUNT == 21, "GGML_IS_QUANTIZED is outdated");
 
 static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "NONE",
@@ -3762,9 +4729,12 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "REPEAT_BACK",
     "REPEAT2",
     "SILU_BACK",
+    "SWIGLU",
     "NORM",
     "RMS_NORM",
     "RMS_NORM_BACK",
+    "NORM_AFFINE",
+    "BIAS_ACT",
 
     "MUL_MAT",
     "OUT_PROD",
@@ -3779,11 +4749,13 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "TRANSPOSE",
     "GET_ROWS",
     "GET_ROWS_BACK",
+    "SET_ROWS",
     "DIAG",
     "DIAG_MASK_INF",
     "DIAG_MASK_ZERO",
     "SOFT_MAX",
     "SOFT_MAX_BACK",
+    "SOFT_MAX_EXT",
     "ROPE",
     "ROPE_BACK",
     "ALIBI",
@@ -3794,6 +4766,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "POOL_2D",
 
     "FLASH_ATTN",
+    "FLASH_ATTN_EXT",
     "FLASH_FF",
     "FLASH_ATTN_BACK",
     "WIN_PART",
@@ -3812,7 +4785,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CROSS_ENTROPY_LOSS_BACK",
 };
 
-static_assert(GGML_OP_COUNT == 60, "GGML_OP_COUNT != 60");
+static_assert(GGML_OP_COUNT == 66, "GGML_OP_COUNT != 66");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -3835,9 +4808,12 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "repeat_back(x)",
     "repeat2(x)",
     "silu_back(x)",
+    "swiglu(x)",
     "norm(x)",
     "rms_norm(x)",
     "rms_norm_back(x)",
+    "norm_affine(x)",
+    "act(x+b)",
 
     "X*Y",
     "X*Y",
@@ -3852,11 +4828,13 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "transpose(x)",
     "get_rows(x)",
     "get_rows_back(x)",
+    "set_rows(x)",
     "diag(x)",
     "diag_mask_inf(x)",
     "diag_mask_zero(x)",
     "soft_max(x)",
     "soft_max_back(x)",
+    "soft_max_ext(x)",
     "rope(x)",
     "rope_back(x)",
     "alibi(x)",
@@ -3867,6 +4845,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "pool_2d(x)",
 
     "flash_attn(x)",
+    "flash_attn_ext(x)",
     "flash_ff(x)",
     "flash_attn_back(x)",
     "win_part(x)",
@@ -3885,7 +4864,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "cross_entropy_loss_back(x,y)",
 };
 
-static_assert(GGML_OP_COUNT == 60, "GGML_OP_COUNT != 60");
+static_assert(GGML_OP_COUNT == 66, "GGML_OP_COUNT != 66");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
@@ -3922,6 +4901,7 @@ static void ggml_setup_op_has_task_pass(void) {
     {   // FINALIZE
         bool * p = GGML_OP_HAS_FINALIZE;
 
+        p[GGML_OP_FLASH_ATTN_EXT         ] = true;
         p[GGML_OP_CROSS_ENTROPY_LOSS     ] = true;
     }
 }
@@ -4133,6 +5113,11 @@ float ggml_type_sizef(enum ggml_type type) {
     return ((float)(GGML_TYPE_SIZE[type]))/GGML_BLCK_SIZE[type];
 }
 
+size_t ggml_row_size(enum ggml_type type, int64_t ne) {
+    assert(ne % GGML_BLCK_SIZE[type] == 0);
+    return GGML_TYPE_SIZE[type]*ne/GGML_BLCK_SIZE[type];
+}
+
 const char * ggml_type_name(enum ggml_type type) {
     return GGML_TYPE_NAME[type];
 }
@@ -4320,11 +5305,11 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
             for (int i = 0; i < (1 << 16); ++i) {
                 uint16_t ui = i;
                 memcpy(&ii, &ui, sizeof(ii));
-                const float f = table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
-                table_gelu_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_f32(f));
-                table_gelu_quick_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_quick_f32(f));
-                table_silu_f16[i] = GGML_FP32_TO_FP16(ggml_silu_f32(f));
-                table_exp_f16[i]  = GGML_FP32_TO_FP16(expf(f));
+                const float f = ggml_table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
+                ggml_table_gelu_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_f32(f));
+                ggml_table_gelu_quick_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_quick_f32(f));
+                ggml_table_silu_f16[i] = GGML_FP32_TO_FP16(ggml_silu_f32(f));
+                ggml_table_exp_f16[i]  = GGML_FP32_TO_FP16(expf(f));
             }
 
             const uint64_t t_end = ggml_time_us(); UNUSED(t_end);
@@ -4332,6 +5317,10 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
             GGML_PRINT_DEBUG("%s: GELU, Quick GELU, SILU and EXP tables initialized in %f ms\n", __func__, (t_end - t_start)/1000.0f);
         }
 
+#ifdef GGML_CPU_DISPATCH
+        ggml_cpu_init();
+#endif
+
         // initialize g_state
         {
             const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
@@ -4490,6 +5479,62 @@ size_t ggml_get_max_tensor_size(const struct ggml_context * ctx) {
     return max_size;
 }
 
+static size_t ggml_page_size(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void * ggml_lazy_alloc(size_t size) {
+#if defined(_WIN32)
+    // committed pages are charged against the commit limit but only get physical memory on first access
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void * data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+void ggml_lazy_free(void * data, size_t size) {
+    if (data == NULL) {
+        return;
+    }
+#if defined(_WIN32)
+    UNUSED(size);
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, size);
+#endif
+}
+
+void ggml_lazy_discard(void * data, size_t size) {
+    const uintptr_t page  = ggml_page_size();
+    const uintptr_t begin = ((uintptr_t) data + page - 1) & ~(page - 1);
+    const uintptr_t end   = ((uintptr_t) data + size) & ~(page - 1);
+    if (begin >= end) {
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree((void *) begin, end - begin, MEM_DECOMMIT);
+    VirtualAlloc((void *) begin, end - begin, MEM_COMMIT, PAGE_READWRITE);
+#else
+    // mapping fresh pages over the range drops the old ones
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    mmap((void *) begin, end - begin, PROT_READ | PROT_WRITE, flags, -1, 0);
+#endif
+}
+
 // IMPORTANT:
 // when creating "opt" tensors, always save and load the scratch buffer
 // this is an error prone process, but it is necessary to support inplace
@@ -5753,6 +6798,59 @@ struct ggml_tensor * ggml_silu_back(
     return result;
 }
 
+// ggml_swiglu
+
+struct ggml_tensor * ggml_swiglu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    GGML_ASSERT(a->ne[0] % 2 == 0);
+
+    bool is_node = false;
+
+    if (a->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    const int64_t ne[4] = { a->ne[0]/2, a->ne[1], a->ne[2], a->ne[3] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, a->n_dims, ne);
+
+    result->op   = GGML_OP_SWIGLU;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+
+    return result;
+}
+
+// ggml_bias_act
+
+struct ggml_tensor * ggml_bias_act(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        enum ggml_act_op      op) {
+    GGML_ASSERT(a->type == GGML_TYPE_F32);
+    GGML_ASSERT(b == NULL || (b->type == GGML_TYPE_F32 && ggml_is_vector(b) && b->ne[0] == a->ne[0]));
+
+    bool is_node = false;
+
+    if (a->grad || (b && b->grad)) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+
+    ggml_set_op_params_i32(result, 0, (int32_t) op);
+
+    result->op   = GGML_OP_BIAS_ACT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+
+    return result;
+}
+
 // ggml_norm
 
 static struct ggml_tensor * ggml_norm_impl(
@@ -5846,13 +6944,65 @@ struct ggml_tensor * ggml_rms_norm_back(
     return result;
 }
 
+// ggml_norm_affine
 
-// ggml_mul_mat
-
-struct ggml_tensor * ggml_mul_mat(
+static struct ggml_tensor * ggml_norm_affine_impl(
         struct ggml_context * ctx,
         struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b,
+        float eps,
+        bool rms) {
+    GGML_ASSERT(a->type == GGML_TYPE_F32);
+    GGML_ASSERT(w->type == GGML_TYPE_F32 && ggml_is_vector(w) && w->ne[0] == a->ne[0]);
+    GGML_ASSERT(b == NULL || ggml_are_same_shape(w, b));
+
+    bool is_node = false;
+
+    if (a->grad || w->grad || (b && b->grad)) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+
+    int32_t params[] = { 0, rms };
+    memcpy(params + 0, &eps, sizeof(float));
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op   = GGML_OP_NORM_AFFINE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = w;
+    result->src[2] = b;
+
+    return result;
+}
+
+struct ggml_tensor * ggml_norm_affine(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b) {
+    // the eps of ggml_norm
+    return ggml_norm_affine_impl(ctx, a, w, b, 1e-5f, false);
+}
+
+struct ggml_tensor * ggml_rms_norm_affine(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * w,
+        float eps) {
+    return ggml_norm_affine_impl(ctx, a, w, NULL, eps, true);
+}
+
+
+// ggml_mul_mat
+
+struct ggml_tensor * ggml_mul_mat(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
     GGML_ASSERT(ggml_can_mul_mat(a, b));
     GGML_ASSERT(!ggml_is_transposed(a));
 
@@ -6530,6 +7680,36 @@ struct ggml_tensor * ggml_get_rows_back(
     return result;
 }
 
+// ggml_set_rows
+
+struct ggml_tensor * ggml_set_rows(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c) {
+    GGML_ASSERT(ggml_is_matrix(a) && ggml_is_matrix(b) && b->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_vector(c) && c->type == GGML_TYPE_I32 && c->ne[0] == b->ne[1]);
+    GGML_ASSERT(a->ne[0] == b->ne[0] && a->nb[0] == GGML_TYPE_SIZE[a->type] && b->nb[0] == sizeof(float));
+    GGML_ASSERT(a->type == GGML_TYPE_F32 || type_traits[a->type].from_float != NULL);
+
+    bool is_node = false;
+
+    if (a->grad || b->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+    ggml_format_name(result, "%s (set rows)", a->name);
+
+    result->op   = GGML_OP_SET_ROWS;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = b;
+    result->src[1] = c;
+
+    return result;
+}
+
 // ggml_diag
 
 struct ggml_tensor * ggml_diag(
@@ -6665,7 +7845,6 @@ struct ggml_tensor * ggml_soft_max_inplace(
     return ggml_soft_max_impl(ctx, a, true);
 }
 
-
 // ggml_soft_max_back
 
 static struct ggml_tensor * ggml_soft_max_back_impl(
@@ -6703,6 +7882,56 @@ struct ggml_tensor * ggml_soft_max_back_inplace(
     return ggml_soft_max_back_impl(ctx, a, b, true);
 }
 
+// ggml_soft_max_ext
+
+static struct ggml_tensor * ggml_soft_max_ext_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        float                 scale,
+        int                   n_past,
+        float                 max_bias,
+        bool                  inplace) {
+    GGML_ASSERT(a->type == GGML_TYPE_F32);
+
+    bool is_node = false;
+
+    if (a->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+
+    int32_t params[] = { 0, 0, n_past };
+    memcpy(params + 0, &scale,    sizeof(float));
+    memcpy(params + 1, &max_bias, sizeof(float));
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op   = GGML_OP_SOFT_MAX_EXT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+
+    return result;
+}
+
+struct ggml_tensor * ggml_soft_max_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        float                 scale,
+        int                   n_past,
+        float                 max_bias) {
+    return ggml_soft_max_ext_impl(ctx, a, scale, n_past, max_bias, false);
+}
+
+struct ggml_tensor * ggml_soft_max_ext_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        float                 scale,
+        int                   n_past,
+        float                 max_bias) {
+    return ggml_soft_max_ext_impl(ctx, a, scale, n_past, max_bias, true);
+}
+
 // ggml_rope
 
 static struct ggml_tensor * ggml_rope_impl(
@@ -7067,6 +8296,77 @@ struct ggml_tensor * ggml_flash_attn(
     return result;
 }
 
+// ggml_flash_attn_ext
+
+static struct ggml_tensor * ggml_flash_attn_ext_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * q,
+        struct ggml_tensor  * k,
+        struct ggml_tensor  * v,
+        struct ggml_tensor  * rows,
+        float                 scale,
+        float                 max_bias) {
+    GGML_ASSERT(q->type == GGML_TYPE_F32);
+    GGML_ASSERT(k->ne[0] == q->ne[0] && v->ne[0] == q->ne[0]);
+    GGML_ASSERT((rows ? rows->ne[0] : k->ne[1]) >= q->ne[1] && v->ne[1] == k->ne[1]);
+    GGML_ASSERT(v->ne[2] == k->ne[2] && q->ne[2] % k->ne[2] == 0);
+    GGML_ASSERT(q->ne[3] == 1 && k->ne[3] == 1 && v->ne[3] == 1);
+    GGML_ASSERT(q->ne[0] % ggml_blck_size(k->type) == 0 && q->ne[0] % ggml_blck_size(v->type) == 0);
+
+    bool is_node = false;
+
+    if (q->grad || k->grad || v->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, q->ne[0], q->ne[2], q->ne[1]);
+
+    float params[] = { scale, max_bias };
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op   = GGML_OP_FLASH_ATTN_EXT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = q;
+    result->src[1] = k;
+    result->src[2] = v;
+    result->src[3] = rows;
+
+    return result;
+}
+
+struct ggml_tensor * ggml_flash_attn_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * q,
+        struct ggml_tensor  * k,
+        struct ggml_tensor  * v,
+        float                 scale,
+        float                 max_bias) {
+    return ggml_flash_attn_ext_impl(ctx, q, k, v, NULL, scale, max_bias);
+}
+
+struct ggml_tensor * ggml_flash_attn_ext_paged(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * q,
+        struct ggml_tensor  * k,
+        struct ggml_tensor  * v,
+        struct ggml_tensor  * rows,
+        float                 scale,
+        float                 max_bias) {
+    GGML_ASSERT(rows->type == GGML_TYPE_I32 && ggml_is_vector(rows) && ggml_is_contiguous(rows));
+    GGML_ASSERT(v->nb[0] == ggml_type_size(v->type)); // v by rows
+    return ggml_flash_attn_ext_impl(ctx, q, k, v, rows, scale, max_bias);
+}
+
+void ggml_flash_attn_ext_add_scores(
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * scores) {
+    GGML_ASSERT(a->op == GGML_OP_FLASH_ATTN_EXT);
+    GGML_ASSERT(scores->type == GGML_TYPE_F32 && ggml_is_vector(scores) && ggml_is_contiguous(scores));
+    GGML_ASSERT(scores->ne[0] == a->src[1]->ne[1]);
+    a->src[4] = scores;
+}
+
 // ggml_flash_ff
 
 struct ggml_tensor * ggml_flash_ff(
@@ -9872,7 +11172,7 @@ static void ggml_compute_forward_gelu_f32(
     const int ir1 = MIN(ir0 + dr, nr);
 
     for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_f32(nc,
+        vec_kernels.gelu_f32(nc,
                 (float *) ((char *) dst->data  + i1*( dst->nb[1])),
                 (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
@@ -9931,7 +11231,7 @@ static void ggml_compute_forward_gelu_quick_f32(
     const int ir1 = MIN(ir0 + dr, nr);
 
     for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_quick_f32(nc,
+        vec_kernels.gelu_quick_f32(nc,
                 (float *) ((char *) dst->data  + i1*( dst->nb[1])),
                 (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
@@ -9990,7 +11290,7 @@ static void ggml_compute_forward_silu_f32(
     const int ir1 = MIN(ir0 + dr, nr);
 
     for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_silu_f32(nc,
+        vec_kernels.silu_f32(nc,
                 (float *) ((char *) dst->data  + i1*( dst->nb[1])),
                 (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
@@ -10085,6 +11385,128 @@ static void ggml_compute_forward_silu_back(
     }
 }
 
+// ggml_compute_forward_swiglu
+
+static void ggml_compute_forward_swiglu_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_is_contiguous_except_dim_1(src0));
+    GGML_ASSERT(ggml_is_contiguous_except_dim_1(dst));
+    GGML_ASSERT(src0->ne[0] == 2*dst->ne[0]);
+    GGML_ASSERT(ggml_nrows(src0) == ggml_nrows(dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = dst->ne[0];
+    const int nr = ggml_nrows(dst);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        float * y = (float *) ((char *) dst->data  + i1*( dst->nb[1]));
+        float * x = (float *) ((char *) src0->data + i1*(src0->nb[1]));
+
+        // same as ggml_mul(ggml_silu(x[:nc]), x[nc:])
+        vec_kernels.silu_f32(nc, y, x);
+        ggml_vec_mul_f32 (nc, y, y, x + nc);
+    }
+}
+
+static void ggml_compute_forward_swiglu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_swiglu_f32(params, src0, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_bias_act
+
+static void ggml_compute_forward_bias_act_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+    GGML_ASSERT(src1 == NULL || ggml_is_contiguous(src1));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS;
+
+    void (*act)(const int, float *, const float *, const float *) = NULL;
+    switch ((enum ggml_act_op) ggml_get_op_params_i32(dst, 0)) {
+        case GGML_ACT_OP_GELU:     act = vec_kernels.bias_gelu_f32;     break;
+        case GGML_ACT_OP_GELU_ERF: act = vec_kernels.bias_gelu_erf_f32; break;
+        case GGML_ACT_OP_SILU:     act = vec_kernels.bias_silu_f32;     break;
+    }
+    GGML_ASSERT(act != NULL);
+
+    const float * b = src1 ? (const float *) src1->data : NULL;
+
+    const int64_t nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        act(ne00,
+                (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
+                (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03),
+                b);
+    }
+}
+
+static void ggml_compute_forward_bias_act(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_bias_act_f32(params, src0, src1, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
 // ggml_compute_forward_norm
 
 static void ggml_compute_forward_norm_f32(
@@ -10391,38 +11813,112 @@ static void ggml_compute_forward_rms_norm_back(
     }
 }
 
-// ggml_compute_forward_mul_mat
+// ggml_compute_forward_norm_affine
 
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-// helper function to determine if it is better to use BLAS or not
-// for large matrices, BLAS is faster
-static bool ggml_compute_forward_mul_mat_use_blas(
+static void ggml_compute_forward_norm_affine_f32(
+        const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    //const int64_t ne00 = src0->ne[0];
-    //const int64_t ne01 = src0->ne[1];
+        const struct ggml_tensor * src2,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
-    const int64_t ne10 = src1->ne[0];
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    const int64_t ne0 = dst->ne[0];
-    const int64_t ne1 = dst->ne[1];
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    GGML_ASSERT(ggml_is_contiguous(src1) && (src2 == NULL || ggml_is_contiguous(src2)));
 
-    // TODO: find the optimal values for these
-    if (ggml_is_contiguous(src0) &&
-        ggml_is_contiguous(src1) &&
-        (ne0 >= 32 && ne1 >= 32 && ne10 >= 32)) {
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-        /*printf("BLAS: %d %d %d %d %d\n", ne0, ne1, ne10, ne00, ne01);*/
-        return true;
-    }
+    GGML_TENSOR_UNARY_OP_LOCALS;
 
-    return false;
-}
-#endif
+    float eps;
+    memcpy(&eps, dst->op_params, sizeof(float));
 
-static void ggml_compute_forward_mul_mat(
-        const struct ggml_compute_params * params,
+    const bool rms = ggml_get_op_params_i32(dst, 1) != 0;
+
+    const float * g = (const float *) src1->data;
+    const float * b = src2 ? (const float *) src2->data : NULL;
+
+    const int64_t nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+        float       * y = (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+        if (rms) {
+            vec_kernels.rms_norm_affine_f32(ne00, y, x, g, eps);
+        } else {
+            vec_kernels.norm_affine_f32(ne00, y, x, g, b, eps);
+        }
+    }
+}
+
+static void ggml_compute_forward_norm_affine(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_norm_affine_f32(params, src0, src1, src2, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_mul_mat
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+// helper function to determine if it is better to use BLAS or not
+// for large matrices, BLAS is faster
+static bool ggml_compute_forward_mul_mat_use_blas(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    //const int64_t ne00 = src0->ne[0];
+    //const int64_t ne01 = src0->ne[1];
+
+    const int64_t ne10 = src1->ne[0];
+
+    const int64_t ne0 = dst->ne[0];
+    const int64_t ne1 = dst->ne[1];
+
+    // TODO: find the optimal values for these
+    if (ggml_is_contiguous(src0) &&
+        ggml_is_contiguous(src1) &&
+        type_traits[src0->type].nrows == 0 &&
+        (ne0 >= 32 && ne1 >= 32 && ne10 >= 32)) {
+
+        /*printf("BLAS: %d %d %d %d %d\n", ne0, ne1, ne10, ne00, ne01);*/
+        return true;
+    }
+
+    return false;
+}
+#endif
+
+static void ggml_compute_forward_mul_mat(
+        const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
               struct ggml_tensor * dst) {
@@ -10530,16 +12026,24 @@ static void ggml_compute_forward_mul_mat(
 
     if (params->type == GGML_TASK_INIT) {
         if (src1->type != vec_dot_type) {
-            char * wdata = params->wdata;
             const size_t row_size = ne10*GGML_TYPE_SIZE[vec_dot_type]/GGML_BLCK_SIZE[vec_dot_type];
 
-            for (int64_t i13 = 0; i13 < ne13; ++i13) {
-                for (int64_t i12 = 0; i12 < ne12; ++i12) {
-                    for (int64_t i11 = 0; i11 < ne11; ++i11) {
-                        from_float_to_vec_dot((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
-                        wdata += row_size;
-                    }
-                }
+            // parallelize by src1 rows
+            const int64_t nr1 = ne11*ne12*ne13;
+            const int64_t dr1 = (nr1 + nth - 1)/nth;
+
+            const int64_t ir10 = dr1*ith;
+            const int64_t ir11 = MIN(ir10 + dr1, nr1);
+
+            char * wdata = (char *) params->wdata + ir10*row_size;
+
+            for (int64_t ir1 = ir10; ir1 < ir11; ++ir1) {
+                const int64_t i13 = (ir1/(ne12*ne11));
+                const int64_t i12 = (ir1 - i13*ne12*ne11)/ne11;
+                const int64_t i11 = (ir1 - i13*ne12*ne11 - i12*ne11);
+
+                from_float_to_vec_dot((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
+                wdata += row_size;
             }
         }
 
@@ -10550,52 +12054,90 @@ static void ggml_compute_forward_mul_mat(
         return;
     }
 
+    // rows that vec_dot processes at once
+    const int64_t nrows = MAX(1, type_traits[type].nrows);
+
+    GGML_ASSERT(ne01 % nrows == 0);
+
     // parallelize by src0 rows
-    const int64_t dr = (ne01 + nth - 1)/nth;
+    const int64_t dr = (ne01/nrows + nth - 1)/nth*nrows;
 
-    const int64_t ir10 = dr*ith;
+    const int64_t ir10 = MIN(dr*ith, ne01);
     const int64_t ir11 = MIN(ir10 + dr, ne01);
 
-    // src1 rows
-    const int64_t nr1 = ne11*ne12*ne13;
-
     const void * wdata    = (src1->type == vec_dot_type) ? src1->data : params->wdata;
     const size_t row_size = ne10*GGML_TYPE_SIZE[vec_dot_type]/GGML_BLCK_SIZE[vec_dot_type];
 
-    for (int64_t ir1 = 0; ir1 < nr1; ++ir1) {
-        const int64_t i13 = (ir1/(ne12*ne11));
-        const int64_t i12 = (ir1 - i13*ne12*ne11)/ne11;
-        const int64_t i11 = (ir1 - i13*ne12*ne11 - i12*ne11);
-
-        const int64_t ir0 = (ir1/ne11)%(ne02*ne03);
-        const int64_t i03 = (ir0/(ne02));
-        // Hack for "Falcon multi-query-attention key stutter" / alternative to ggml_repeat2.
-        // See https://github.com/ggerganov/llama.cpp/issues/1602#issuecomment-1606087470:
-        // GG: this is likely the correct way to broadcast, though need some more thought
-        //     therefore leaving the comments to remind us for now
-        const int64_t i02 = (i12 / (ne12 / ne02));
-        // Original from PR/224 (and also essential/correct for non-broadcast matmuls in Falcon)
-        // const int64_t i02 = (ir0 - i03*ne02);
+    // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
+    //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
+    //       the original src1 data pointer, so we should index using the indices directly
+    // TODO: this is a bit of a hack, we should probably have a better way to handle this
+    const bool   src1_packed = src1_cont || src1->type != vec_dot_type;
+    const size_t src1_nb1    = src1_packed ? row_size           : nb11;
+    const size_t src1_nb2    = src1_packed ? row_size*ne11      : nb12;
+    const size_t src1_nb3    = src1_packed ? row_size*ne11*ne12 : nb13;
+
+    ggml_vec_dot_x4_t const vec_dot_x4 = type_traits[type].vec_dot_x4;
+
+    // with several src1 rows, multiply blocks of blck_0 src0 rows with blocks of blck_1 src1 rows,
+    // so that the src0 rows are read from memory once per block of src1 rows instead of once per src1 row
+    // within a block, vec_dot_x4 reuses each decoded block of a src0 row for 4 src1 rows
+    const int64_t blck_0 = 16;
+    const int64_t blck_1 = 16;
+
+    for (int64_t i13 = 0; i13 < ne13; ++i13) {
+        for (int64_t i12 = 0; i12 < ne12; ++i12) {
+            const int64_t ir0 = (i13*ne12 + i12)%(ne02*ne03);
+            const int64_t i03 = (ir0/(ne02));
+            // Hack for "Falcon multi-query-attention key stutter" / alternative to ggml_repeat2.
+            // See https://github.com/ggerganov/llama.cpp/issues/1602#issuecomment-1606087470:
+            // GG: this is likely the correct way to broadcast, though need some more thought
+            //     therefore leaving the comments to remind us for now
+            const int64_t i02 = (i12 / (ne12 / ne02));
+            // Original from PR/224 (and also essential/correct for non-broadcast matmuls in Falcon)
+            // const int64_t i02 = (ir0 - i03*ne02);
+
+            const char * src0_row = (const char *) src0->data + (  0 + i02*nb02 + i03*nb03     );
+            const char * src1_row = (const char *) wdata      + (i12*src1_nb2 + i13*src1_nb3);
+                  char * dst_row  = (char *) dst->data        + (i12*nb2 + i13*nb3);
+
+            for (int64_t iir1 = 0; iir1 < ne11; iir1 += blck_1) {
+                const int64_t ir1_end = MIN(iir1 + blck_1, ne11);
+
+                for (int64_t iir0 = ir10; iir0 < ir11; iir0 += blck_0) {
+                    const int64_t ir0_end = MIN(iir0 + blck_0, ir11);
+
+                    if (nrows > 1) {
+                        // the blocks of each nrows src0 rows are interleaved, see ggml_repack
+                        for (int64_t ir = iir0; ir < ir0_end; ir += nrows) {
+                            for (int64_t i11 = iir1; i11 < ir1_end; ++i11) {
+                                vec_dot(ne00, (float *) (dst_row + i11*nb1) + ir, src0_row + ir*nb01, src1_row + i11*src1_nb1);
+                            }
+                        }
+                        continue;
+                    }
 
-        const int64_t i1 = i11;
-        const int64_t i2 = i12;
-        const int64_t i3 = i13;
+                    for (int64_t ir = iir0; ir < ir0_end; ++ir) {
+                        int64_t i11 = iir1;
 
-        const char * src0_row = (const char *) src0->data + (  0 + i02*nb02 + i03*nb03     );
+                        if (vec_dot_x4) {
+                            for (; i11 + 4 <= ir1_end; i11 += 4) {
+                                float tmp[4];
 
-        // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
-        //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
-        //       the original src1 data pointer, so we should index using the indices directly
-        // TODO: this is a bit of a hack, we should probably have a better way to handle this
-        const char * src1_col = (const char *) wdata +
-            (src1_cont || src1->type != vec_dot_type
-             ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
-             : (i11*nb11 + i12*nb12 + i13*nb13));
+                                vec_dot_x4(ne00, tmp, src0_row + ir*nb01, src1_row + i11*src1_nb1, src1_nb1);
 
-        float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3));
+                                for (int k = 0; k < 4; ++k) {
+                                    ((float *) (dst_row + (i11 + k)*nb1))[ir] = tmp[k];
+                                }
+                            }
+                        }
 
-        for (int64_t ir = ir10; ir < ir11; ++ir) {
-            vec_dot(ne00, &dst_col[ir], src0_row + ir*nb01, src1_col);
+                        for (; i11 < ir1_end; ++i11) {
+                            vec_dot(ne00, (float *) (dst_row + i11*nb1) + ir, src0_row + ir*nb01, src1_row + i11*src1_nb1);
+                        }
+                    }
+                }
+            }
         }
     }
 
@@ -11119,6 +12661,47 @@ static void ggml_compute_forward_get_rows(
     //}
 }
 
+// ggml_compute_forward_set_rows
+
+static void ggml_compute_forward_set_rows(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int nc = src0->ne[0];
+    const int nr = src0->ne[1];
+
+    GGML_ASSERT(dst->ne[0] == nc);
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+
+    const ggml_from_float_t from_float = type_traits[dst->type].from_float;
+
+    // rows per thread
+    const int dr = (nr + params->nth - 1)/params->nth;
+
+    const int ir0 = dr*params->ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i = ir0; i < ir1; ++i) {
+        const int r = ((int32_t *) src1->data)[i];
+
+        GGML_ASSERT(r >= 0 && r < dst->ne[1]);
+
+        const float * x = (float *) ((char *) src0->data + i*src0->nb[1]);
+        void        * y = (char *) dst->data + r*dst->nb[1];
+
+        if (dst->type == GGML_TYPE_F32) {
+            ggml_vec_cpy_f32(nc, (float *) y, x);
+        } else {
+            from_float(x, y, nc);
+        }
+    }
+}
+
 // ggml_compute_forward_get_rows_back
 
 static void ggml_compute_forward_get_rows_back_f32_f16(
@@ -11417,21 +13000,7 @@ static void ggml_compute_forward_soft_max_f32(
         float max = -INFINITY;
         ggml_vec_max_f32(nc, &max, sp);
 
-        ggml_float sum = 0.0;
-
-        uint16_t scvt;
-        for (int i = 0; i < nc; i++) {
-            if (sp[i] == -INFINITY) {
-                dp[i] = 0.0f;
-            } else {
-                // const float val = (sp[i] == -INFINITY) ? 0.0 : exp(sp[i] - max);
-                ggml_fp16_t s = GGML_FP32_TO_FP16(sp[i] - max);
-                memcpy(&scvt, &s, sizeof(scvt));
-                const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
-                sum += (ggml_float)val;
-                dp[i] = val;
-            }
-        }
+        ggml_float sum = vec_kernels.soft_max_f32(nc, dp, sp, max);
 
         assert(sum > 0.0);
 
@@ -11463,6 +13032,95 @@ static void ggml_compute_forward_soft_max(
     }
 }
 
+// ggml_compute_forward_soft_max_ext
+
+static void ggml_compute_forward_soft_max_ext_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS;
+
+    float scale;
+    float max_bias;
+    memcpy(&scale,    (int32_t *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias, (int32_t *) dst->op_params + 1, sizeof(float));
+
+    const int n_past = ggml_get_op_params_i32(dst, 2);
+
+    // the alibi slopes of ggml_compute_forward_alibi_f32
+    const int   n_head = ne02;
+    const int   n_heads_log2_floor = 1 << (int) floor(log2(n_head));
+    const float m0 = powf(2.0f, -(max_bias) / n_heads_log2_floor);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_heads_log2_floor);
+
+    const int64_t nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+        float       * y = (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+        // the row i01 sees the columns up to n_past + i01, the others are masked to -inf
+        const int nc = (int) MIN(ne00, n_past + i01 + 1);
+
+        float slope = 0.0f;
+        if (max_bias > 0.0f) {
+            slope = i02 < n_heads_log2_floor ? powf(m0, i02 + 1) : powf(m1, 2*(i02 - n_heads_log2_floor) + 1);
+        }
+
+        float max = -INFINITY;
+        for (int i = 0; i < nc; ++i) {
+            y[i] = x[i]*scale + slope*i;
+            max  = MAX(max, y[i]);
+        }
+
+        const ggml_float sum = vec_kernels.soft_max_f32(nc, y, y, max);
+        assert(sum > 0.0);
+
+        ggml_vec_scale_f32(nc, y, (float) (1.0/sum));
+
+        for (int i = nc; i < ne00; ++i) {
+            y[i] = 0.0f;
+        }
+    }
+}
+
+static void ggml_compute_forward_soft_max_ext(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_soft_max_ext_f32(params, src0, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
 // ggml_compute_forward_soft_max_back
 
 static void ggml_compute_forward_soft_max_back_f32(
@@ -11714,6 +13372,8 @@ static void ggml_compute_forward_alibi(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_8:
+        case GGML_TYPE_Q8_0_8:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -11789,6 +13449,8 @@ static void ggml_compute_forward_clamp(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_8:
+        case GGML_TYPE_Q8_0_8:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -13138,7 +14800,7 @@ static void ggml_compute_forward_flash_attn_f32(
                         } else {
                             ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
                             memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt[j]]);
+                            const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
                             sump[j] += (ggml_float)val;
                             SS[j] = val;
                         }
@@ -13333,7 +14995,7 @@ static void ggml_compute_forward_flash_attn_f16(
                         } else {
                             ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
                             memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt[j]]);
+                            const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
                             sump[j] += (ggml_float)val;
                             SS[j] = val;
                         }
@@ -13416,72 +15078,464 @@ static void ggml_compute_forward_flash_attn(
     }
 }
 
-// ggml_compute_forward_flash_ff
-
-static void ggml_compute_forward_flash_ff_f16(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * a,  // F16
-        const struct ggml_tensor * b0, // F16 fc_w
-        const struct ggml_tensor * b1, // F32 fc_b
-        const struct ggml_tensor * c0, // F16 proj_w
-        const struct ggml_tensor * c1, // F32 proj_b
-        struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+// ggml_compute_forward_flash_attn_ext
 
-    GGML_TENSOR_LOCALS(int64_t, nea,  a,   ne);
-    GGML_TENSOR_LOCALS(size_t,  nba,  a,   nb);
-    GGML_TENSOR_LOCALS(int64_t, neb0, b0,  ne);
-    GGML_TENSOR_LOCALS(size_t,  nbb0, b0,  nb);
-    GGML_TENSOR_LOCALS(int64_t, neb1, b1,  ne);
-    GGML_TENSOR_LOCALS(size_t,  nbb1, b1,  nb);
-    GGML_TENSOR_LOCALS(int64_t, nec0, c0,  ne);
-    GGML_TENSOR_LOCALS(size_t,  nbc0, c0,  nb);
-    GGML_TENSOR_LOCALS(int64_t, nec1, c1,  ne);
-    GGML_TENSOR_LOCALS(size_t,  nbc1, c1,  nb);
-    GGML_TENSOR_LOCALS(int64_t, ne,   dst, ne);
-    GGML_TENSOR_LOCALS(size_t,  nb,   dst, nb);
+// number of keys whose scores are computed before they are folded into the output
+#define GGML_FLASH_ATTN_EXT_BLOCK 128
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+// exp(x) is subnormal below this
+#define GGML_FLASH_ATTN_EXT_MIN_EXP -87.0f
 
-    const int64_t D = nea0;
-    //const int64_t N = nea1;
-    const int64_t M = neb01;
+// the keys are the rows of k, or with ggml_flash_attn_ext_paged the rows of k listed in the row table
+static int64_t ggml_flash_attn_ext_n_kv(const struct ggml_tensor * node) {
+    return node->src[3] ? node->src[3]->ne[0] : node->src[1]->ne[1];
+}
 
-    GGML_ASSERT(ne0 == nea0);
-    GGML_ASSERT(ne1 == nea1);
-    GGML_ASSERT(ne2 == nea2);
+// a transposed v is read by dot products over the keys of a block, they are kept as long as with
+// ggml_mul_mat by making the block span all the keys
+static int64_t ggml_flash_attn_ext_block(const struct ggml_tensor * node) {
+    const struct ggml_tensor * v = node->src[2];
+    if (v->nb[0] != ggml_type_size(v->type)) {
+        return node->src[1]->ne[1];
+    }
+    return GGML_FLASH_ATTN_EXT_BLOCK;
+}
 
-    GGML_ASSERT(nba0  == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbb00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbb10 == sizeof(float));
-    GGML_ASSERT(nbc00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbc10 == sizeof(float));
+// per thread: q converted to the vec_dot_type of k, the scores of a block of keys in f32 and in
+// the vec_dot_type of v, and a row of a quantized v converted to f32
+// with ggml_flash_attn_ext_add_scores also the scores of the keys of a row and the sums of their
+// weights over the rows of the thread
+static size_t ggml_flash_attn_ext_wsize(const struct ggml_tensor * node) {
+    const int64_t n_scores = node->src[4] ? 2*ggml_flash_attn_ext_n_kv(node) : 0;
+    return sizeof(float)*(2*node->src[0]->ne[0] + 2*ggml_flash_attn_ext_block(node) + n_scores);
+}
 
-    GGML_ASSERT(neb00 == D);
-    GGML_ASSERT(neb01 == M);
-    GGML_ASSERT(neb10 == M);
-    GGML_ASSERT(neb11 == 1);
+// number of parts the keys of a row are split into
+// a single query has few rows to spread over the threads, so the keys are split as well and the
+// parts are merged in the FINALIZE phase. this is non-decreasing in nth, the work size of the plan
+// is an upper bound for any number of tasks the node ends up with
+static int64_t ggml_flash_attn_ext_n_split(const struct ggml_tensor * node, int nth) {
+    const int64_t N = node->src[0]->ne[1];
+    if (N != 1 || nth == 1) {
+        return 1;
+    }
 
-    GGML_ASSERT(nec00 == M);
-    GGML_ASSERT(nec01 == D);
-    GGML_ASSERT(nec10 == D);
-    GGML_ASSERT(nec11 == 1);
+    const int64_t nr = ggml_nrows(node);
+    const int64_t nb = (ggml_flash_attn_ext_n_kv(node) + GGML_FLASH_ATTN_EXT_BLOCK - 1)/GGML_FLASH_ATTN_EXT_BLOCK;
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+    // a few parts per thread so that the threads finish at about the same time
+    return MAX(1, MIN((4*nth + nr - 1)/nr, nb));
+}
 
-    if (params->type == GGML_TASK_INIT) {
-        return;
+// the unnormalized output, the max score and the sum of the weights of each part of the keys
+// with ggml_flash_attn_ext_add_scores also the scores of the keys of each row, which are only
+// turned into weights once the parts are merged
+static size_t ggml_flash_attn_ext_psize(const struct ggml_tensor * node, int nth) {
+    const int64_t n_split = ggml_flash_attn_ext_n_split(node, nth);
+    if (n_split == 1) {
+        return 0;
     }
+    const int64_t n_scores = node->src[4] ? ggml_flash_attn_ext_n_kv(node) : 0;
+    return GGML_PAD(sizeof(float)*((node->src[0]->ne[0] + 2)*n_split + n_scores)*ggml_nrows(node), CACHE_LINE_SIZE);
+}
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+static void ggml_compute_forward_flash_attn_ext_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        struct ggml_tensor * dst) {
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne);
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb);
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne);
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb);
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb);
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // key ic is row rows[ic] of k and v with a row table, else row ic
+    const int32_t * rows = dst->src[3] ? (const int32_t *) dst->src[3]->data : NULL;
+
+    // the weights of the keys are added to scores, see ggml_flash_attn_ext_add_scores
+    float * scores = dst->src[4] ? (float *) dst->src[4]->data : NULL;
+
+    const int64_t D    = neq0;
+    const int64_t N    = neq1;
+    const int64_t n_kv = ggml_flash_attn_ext_n_kv(dst);
+    const int64_t P    = n_kv - N;
+
+    // a row table of consecutive rows is an offset of k and v, which is faster to read without
+    // the table
+    int64_t row0 = 0;
+    if (rows) {
+        int64_t ic = 1;
+        while (ic < n_kv && rows[ic] == rows[0] + ic) {
+            ++ic;
+        }
+        if (ic == n_kv) {
+            row0 = rows[0];
+            rows = NULL;
+        }
+    }
+
+    const int64_t n_head    = neq2;
+    const int64_t n_head_kv = nek2;
+
+    // v is stored by rows like k (nbv0 is the size of an element), or transposed (nbv1 is)
+    const bool v_trans = nbv0 != ggml_type_size(v->type);
+
+    GGML_ASSERT(nbq0 == sizeof(float));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(!v_trans || nbv1 == ggml_type_size(v->type));
+    GGML_ASSERT(!v_trans || !ggml_is_quantized(v->type));
+    GGML_ASSERT(!v_trans || !rows);
+    GGML_ASSERT(nb0 == sizeof(float) && ggml_is_contiguous(dst));
+
+    if (params->type == GGML_TASK_INIT) {
+        return;
+    }
+
+    // parallelize by rows of the result, the rows of a head are next to each other so that the
+    // threads read the k and v of few heads
+    const int64_t nr = n_head*N;
+
+    const int64_t n_split = ggml_flash_attn_ext_n_split(dst, nth);
+
+    // [D + 2] per part, see ggml_flash_attn_ext_psize
+    float * partials = (float *) params->wdata;
+
+    // [n_kv] per row after the parts
+    float * split_scores = partials + nr*n_split*(D + 2);
+
+    // ggml_flash_attn_ext_wsize per thread after them
+    float * wbase = (float *) ((char *) params->wdata + ggml_flash_attn_ext_psize(dst, nth));
+    const size_t wsize = ggml_flash_attn_ext_wsize(dst)/sizeof(float) + CACHE_LINE_SIZE_F32;
+
+    const int64_t B = ggml_flash_attn_ext_block(dst);
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        if (n_split == 1) {
+            if (scores) {
+                // add the sums of the threads
+                for (int jth = 0; jth < nth; ++jth) {
+                    const float * ssum = wbase + jth*wsize + 2*D + 2*B + n_kv;
+                    for (int64_t ic = 0; ic < n_kv; ++ic) {
+                        scores[rows ? rows[ic] : row0 + ic] += ssum[ic];
+                    }
+                }
+            }
+            return;
+        }
+
+        // merge the parts of each row, scaling them to a common max score
+        for (int64_t ir = 0; ir < nr; ++ir) {
+            const float * pp = partials + ir*n_split*(D + 2);
+
+            float smax = -INFINITY;
+            for (int64_t is = 0; is < n_split; ++is) {
+                if (pp[is*(D + 2) + D + 1] > 0.0f) {
+                    smax = MAX(smax, pp[is*(D + 2) + D]);
+                }
+            }
+
+            const int64_t iq2 = ir/N;
+            const int64_t iq1 = ir - iq2*N;
+
+            float * out = (float *) ((char *) dst->data + iq2*nb1 + iq1*nb2);
+            memset(out, 0, D*sizeof(float));
+
+            float sum = 0.0f;
+            for (int64_t is = 0; is < n_split; ++is) {
+                const float * acc = pp + is*(D + 2);
+                if (acc[D + 1] == 0.0f || acc[D] - smax < GGML_FLASH_ATTN_EXT_MIN_EXP) {
+                    continue;
+                }
+                const float ms = expf(acc[D] - smax);
+                vec_kernels.mad_f32(D, out, acc, ms);
+                sum += ms*acc[D + 1];
+            }
+
+            ggml_vec_scale_f32(D, out, 1.0f/sum);
+
+            if (scores) {
+                // a single query sees all the keys
+                float * sr = split_scores + ir*n_kv;
+                vec_kernels.soft_max_f32(n_kv, sr, sr, smax);
+                for (int64_t ic = 0; ic < n_kv; ++ic) {
+                    scores[rows ? rows[ic] : row0 + ic] += sr[ic]/sum;
+                }
+            }
+        }
+        return;
+    }
+
+    float scale;
+    float max_bias;
+    memcpy(&scale,    (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias, (float *) dst->op_params + 1, sizeof(float));
+
+    // the alibi slopes of ggml_compute_forward_alibi_f32
+    const int   n_heads_log2_floor = 1 << (int) floor(log2(n_head));
+    const float m0 = powf(2.0f, -(max_bias) / n_heads_log2_floor);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_heads_log2_floor);
+
+    const enum ggml_type    k_vec_dot_type = type_traits[k->type].vec_dot_type;
+    const enum ggml_type    v_vec_dot_type = type_traits[v->type].vec_dot_type;
+    ggml_vec_dot_t    const k_vec_dot      = type_traits[k->type].vec_dot;
+    ggml_vec_dot_t    const v_vec_dot      = type_traits[v->type].vec_dot;
+    ggml_from_float_t const q_from_float   = type_traits[k_vec_dot_type].from_float;
+    ggml_from_float_t const s_from_float   = type_traits[v_vec_dot_type].from_float;
+    ggml_vec_mad_t    const v_mad          = type_traits[v->type].mad;
+    ggml_to_float_t   const v_to_float     = type_traits[v->type].to_float;
+
+    float * wdata = wbase + ith*wsize;
+
+    void  * q_conv = wdata;          // [D]
+    float * S      = wdata + D;      // [B]
+    void  * S_conv = wdata + D + B;  // [B]
+    float * V32    = wdata + D + 2*B; // [D]
+
+    // the scores of the keys of a row and the sums of their weights, see ggml_flash_attn_ext_wsize
+    float * row_scores = scores ? wdata + 2*D + 2*B        : NULL; // [n_kv]
+    float * ssum       = scores ? wdata + 2*D + 2*B + n_kv : NULL; // [n_kv]
+    if (ssum) {
+        memset(ssum, 0, n_kv*sizeof(float));
+    }
+
+    // a task is a part of the keys of a row, the parts are split evenly between the threads
+    const int64_t nt = nr*n_split;
+
+    // task range for this thread
+    const int64_t it0 = nt*ith/nth;
+    const int64_t it1 = nt*(ith + 1)/nth;
+
+    // keys per part, a multiple of GGML_FLASH_ATTN_EXT_BLOCK
+    const int64_t n_part = GGML_PAD((n_kv + n_split - 1)/n_split, GGML_FLASH_ATTN_EXT_BLOCK);
+
+    for (int64_t it = it0; it < it1; ++it) {
+        const int64_t ir  = it/n_split;
+        const int64_t is  = it - ir*n_split;
+        const int64_t iq2 = ir/N;
+        const int64_t iq1 = ir - iq2*N;
+        const int64_t ik2 = iq2/(n_head/n_head_kv);
+
+        // the query at position P + iq1 only sees the keys up to its own position
+        const int64_t n_keys = P + iq1 + 1;
+
+        // key range of this part
+        const int64_t ic_start = MIN(is*n_part, n_keys);
+        const int64_t ic_end   = MIN(ic_start + n_part, n_keys);
+
+        // the weighted sum of v is accumulated in the result, or in the partial of this part, with
+        // weights relative to exp(smax)
+        float * acc = n_split == 1
+            ? (float *) ((char *) dst->data + iq2*nb1 + iq1*nb2)
+            : partials + it*(D + 2);
+        memset(acc, 0, D*sizeof(float));
+
+        float smax = -INFINITY;
+        float sum  = 0.0f;
+
+        if (ic_start == ic_end) {
+            acc[D]     = smax;
+            acc[D + 1] = sum;
+            continue;
+        }
+
+        float slope = 0.0f;
+        if (max_bias > 0.0f) {
+            slope = iq2 < n_heads_log2_floor ? powf(m0, iq2 + 1) : powf(m1, 2*(iq2 - n_heads_log2_floor) + 1);
+        }
+
+        const float * pq = (const float *) ((const char *) q->data + iq1*nbq1 + iq2*nbq2);
+        const void  * qv = pq;
+        if (k_vec_dot_type != GGML_TYPE_F32) {
+            q_from_float(pq, q_conv, D);
+            qv = q_conv;
+        }
+
+        const char * pk = (const char *) k->data + ik2*nbk2 + row0*nbk1;
+        const char * pv = (const char *) v->data + ik2*nbv2 + row0*nbv1;
+
+        float * sr = NULL;
+        if (scores) {
+            sr = n_split == 1 ? row_scores : split_scores + ir*n_kv;
+        }
+
+        for (int64_t ic0 = ic_start; ic0 < ic_end; ic0 += B) {
+            const int64_t nc = MIN(B, ic_end - ic0);
+
+            float bmax = -INFINITY;
+            for (int64_t ic = 0; ic < nc; ++ic) {
+                const int64_t ik1 = rows ? rows[ic0 + ic] : ic0 + ic;
+                k_vec_dot(D, S + ic, pk + ik1*nbk1, qv);
+                S[ic] = S[ic]*scale + slope*(ic0 + ic);
+                bmax  = MAX(bmax, S[ic]);
+            }
+
+            if (sr) {
+                memcpy(sr + ic0, S, nc*sizeof(float));
+            }
+
+            // the weights that would underflow to subnormals are flushed to zero, they are slow to
+            // compute with and do not change the result
+            if (bmax > smax) {
+                if (smax - bmax < GGML_FLASH_ATTN_EXT_MIN_EXP) {
+                    memset(acc, 0, D*sizeof(float));
+                    sum = 0.0f;
+                } else {
+                    const float ms = expf(smax - bmax);
+                    ggml_vec_scale_f32(D, acc, ms);
+                    sum *= ms;
+                }
+                smax = bmax;
+            }
+
+            sum += (float) vec_kernels.soft_max_f32(nc, S, S, smax);
+
+            if (!v_trans) {
+                int64_t ic = 0;
+                if (v->type == GGML_TYPE_F16) {
+                    // four rows at a time so that acc is read and written once for each of them
+                    for (; ic + 3 < nc; ic += 4) {
+                        const ggml_fp16_t * pvr[4];
+                        for (int j = 0; j < 4; ++j) {
+                            const int64_t iv1 = rows ? rows[ic0 + ic + j] : ic0 + ic + j;
+                            pvr[j] = (const ggml_fp16_t *) (pv + iv1*nbv1);
+                        }
+                        vec_kernels.mad4_f16_f32(D, acc, pvr, S + ic);
+                    }
+                }
+                for (; ic < nc; ++ic) {
+                    if (S[ic] == 0.0f) {
+                        continue;
+                    }
+                    const int64_t iv1 = rows ? rows[ic0 + ic] : ic0 + ic;
+                    const void * pvr = pv + iv1*nbv1;
+                    if (v->type == GGML_TYPE_F16) {
+                        vec_kernels.mad_f16_f32(D, acc, pvr, S[ic]);
+                    } else if (v->type == GGML_TYPE_F32) {
+                        vec_kernels.mad_f32(D, acc, pvr, S[ic]);
+                    } else if (v_mad) {
+                        v_mad(D, acc, pvr, S[ic]);
+                    } else {
+                        v_to_float(pvr, V32, D);
+                        vec_kernels.mad_f32(D, acc, V32, S[ic]);
+                    }
+                }
+            } else {
+                const void * sv = S;
+                if (v_vec_dot_type != GGML_TYPE_F32) {
+                    s_from_float(S, S_conv, nc);
+                    sv = S_conv;
+                }
+                for (int64_t i0 = 0; i0 < D; ++i0) {
+                    float s;
+                    v_vec_dot(nc, &s, pv + i0*nbv0 + ic0*nbv1, sv);
+                    acc[i0] += s;
+                }
+            }
+        }
+
+        if (n_split == 1) {
+            ggml_vec_scale_f32(D, acc, 1.0f/sum);
+            if (sr) {
+                vec_kernels.soft_max_f32(n_keys, sr, sr, smax);
+                ggml_vec_mad_f32(n_keys, ssum, sr, 1.0f/sum);
+            }
+        } else {
+            acc[D]     = smax;
+            acc[D + 1] = sum;
+        }
+    }
+}
+
+static void ggml_compute_forward_flash_attn_ext(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        struct ggml_tensor * dst) {
+    switch (q->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_flash_attn_ext_f32(params, q, k, v, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_flash_ff
+
+static void ggml_compute_forward_flash_ff_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * a,  // F16
+        const struct ggml_tensor * b0, // F16 fc_w
+        const struct ggml_tensor * b1, // F32 fc_b
+        const struct ggml_tensor * c0, // F16 proj_w
+        const struct ggml_tensor * c1, // F32 proj_b
+        struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    GGML_TENSOR_LOCALS(int64_t, nea,  a,   ne);
+    GGML_TENSOR_LOCALS(size_t,  nba,  a,   nb);
+    GGML_TENSOR_LOCALS(int64_t, neb0, b0,  ne);
+    GGML_TENSOR_LOCALS(size_t,  nbb0, b0,  nb);
+    GGML_TENSOR_LOCALS(int64_t, neb1, b1,  ne);
+    GGML_TENSOR_LOCALS(size_t,  nbb1, b1,  nb);
+    GGML_TENSOR_LOCALS(int64_t, nec0, c0,  ne);
+    GGML_TENSOR_LOCALS(size_t,  nbc0, c0,  nb);
+    GGML_TENSOR_LOCALS(int64_t, nec1, c1,  ne);
+    GGML_TENSOR_LOCALS(size_t,  nbc1, c1,  nb);
+    GGML_TENSOR_LOCALS(int64_t, ne,   dst, ne);
+    GGML_TENSOR_LOCALS(size_t,  nb,   dst, nb);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t D = nea0;
+    //const int64_t N = nea1;
+    const int64_t M = neb01;
+
+    GGML_ASSERT(ne0 == nea0);
+    GGML_ASSERT(ne1 == nea1);
+    GGML_ASSERT(ne2 == nea2);
+
+    GGML_ASSERT(nba0  == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbb00 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbb10 == sizeof(float));
+    GGML_ASSERT(nbc00 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbc10 == sizeof(float));
+
+    GGML_ASSERT(neb00 == D);
+    GGML_ASSERT(neb01 == M);
+    GGML_ASSERT(neb10 == M);
+    GGML_ASSERT(neb11 == 1);
+
+    GGML_ASSERT(nec00 == M);
+    GGML_ASSERT(nec01 == D);
+    GGML_ASSERT(nec10 == D);
+    GGML_ASSERT(nec11 == 1);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    if (params->type == GGML_TASK_INIT) {
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
     // parallelize by a rows using ggml_vec_dot_f32
 
@@ -13729,7 +15783,7 @@ static void ggml_compute_forward_flash_attn_back_f32(
                             } else {
                                 ggml_fp16_t s = GGML_FP32_TO_FP16(SR[j] - max);
                                 memcpy(&scvt[j], &s, sizeof(uint16_t));
-                                const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt[j]]);
+                                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
                                 sump[j] += (ggml_float)val;
                                 SW[j] = val;
                             }
@@ -14395,7 +16449,7 @@ static void ggml_compute_forward_cross_entropy_loss_f32(
                     // const float val = (s0[i] == -INFINITY) ? 0.0 : exp(s0[i] - max);
                     ggml_fp16_t s = GGML_FP32_TO_FP16(s0[i] - max);
                     memcpy(&scvt, &s, sizeof(scvt));
-                    const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
+                    const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
                     sum += (ggml_float)val;
                     st[i] = val;
                 }
@@ -14552,7 +16606,7 @@ static void ggml_compute_forward_cross_entropy_loss_back_f32(
                     // const float val = (s0[i] == -INFINITY) ? 0.0 : exp(s0[i] - max);
                     ggml_fp16_t s = GGML_FP32_TO_FP16(s0[i] - max);
                     memcpy(&scvt, &s, sizeof(scvt));
-                    const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
+                    const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
                     sum += (ggml_float)val;
                     sm[i] = val;
                 }
@@ -14690,6 +16744,14 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_silu_back(params, tensor->src[0], tensor->src[1], tensor);
             } break;
+        case GGML_OP_SWIGLU:
+            {
+                ggml_compute_forward_swiglu(params, tensor->src[0], tensor);
+            } break;
+        case GGML_OP_BIAS_ACT:
+            {
+                ggml_compute_forward_bias_act(params, tensor->src[0], tensor->src[1], tensor);
+            } break;
         case GGML_OP_NORM:
             {
                 ggml_compute_forward_norm(params, tensor->src[0], tensor);
@@ -14702,6 +16764,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_rms_norm_back(params, tensor->src[0], tensor->src[1], tensor);
             } break;
+        case GGML_OP_NORM_AFFINE:
+            {
+                ggml_compute_forward_norm_affine(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
+            } break;
         case GGML_OP_MUL_MAT:
             {
                 ggml_compute_forward_mul_mat(params, tensor->src[0], tensor->src[1], tensor);
@@ -14750,6 +16816,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_get_rows_back(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                ggml_compute_forward_set_rows(params, tensor->src[0], tensor->src[1], tensor);
+            } break;
         case GGML_OP_DIAG:
             {
                 ggml_compute_forward_diag(params, tensor->src[0], tensor);
@@ -14770,6 +16840,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_soft_max_back(params, tensor->src[0], tensor->src[1], tensor);
             } break;
+        case GGML_OP_SOFT_MAX_EXT:
+            {
+                ggml_compute_forward_soft_max_ext(params, tensor->src[0], tensor);
+            } break;
         case GGML_OP_ROPE:
             {
                 ggml_compute_forward_rope(params, tensor->src[0], tensor);
@@ -14809,6 +16883,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
                 const bool masked = t != 0;
                 ggml_compute_forward_flash_attn(params, tensor->src[0], tensor->src[1], tensor->src[2], masked, tensor);
             } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                ggml_compute_forward_flash_attn_ext(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
+            } break;
         case GGML_OP_FLASH_FF:
             {
                 ggml_compute_forward_flash_ff(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor->src[3], tensor->src[4], tensor);
@@ -15088,6 +17166,14 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_SWIGLU:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
+        case GGML_OP_BIAS_ACT:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_NORM:
             {
                 GGML_ASSERT(false); // TODO: not implemented
@@ -15106,6 +17192,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_NORM_AFFINE:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_MUL_MAT:
             {
                 // https://cs231n.github.io/optimization-2/#staged
@@ -15331,6 +17421,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_DIAG:
             {
                 GGML_ASSERT(false); // TODO: not implemented
@@ -15372,6 +17466,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_SOFT_MAX_EXT:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_ROPE:
             {
                 // necessary for llama
@@ -15590,6 +17688,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                             inplace);
                 }
             } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_FLASH_FF:
             {
                 GGML_ASSERT(false); // not supported
@@ -15932,111 +18034,593 @@ typedef pthread_t ggml_thread_t;
 //#define ggml_lock_lock    pthread_spin_lock
 //#define ggml_lock_unlock  pthread_spin_unlock
 
-typedef int ggml_lock_t;
+typedef int ggml_lock_t;
+
+#define ggml_lock_init(x)    UNUSED(x)
+#define ggml_lock_destroy(x) UNUSED(x)
+#if defined(__x86_64__) || (defined(_MSC_VER) && defined(_M_AMD64))
+#define ggml_lock_lock(x)    _mm_pause()
+#else
+#define ggml_lock_lock(x)    UNUSED(x)
+#endif
+#define ggml_lock_unlock(x)  UNUSED(x)
+
+#define GGML_LOCK_INITIALIZER 0
+
+typedef pthread_t ggml_thread_t;
+
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
+
+#endif
+
+// Android's libc implementation "bionic" does not support setting affinity
+#if defined(__linux__) && !defined(__BIONIC__)
+static void set_numa_thread_affinity(int thread_n, int n_threads) {
+    if (!ggml_is_numa()) {
+        return;
+    }
+
+    // run thread on node_num thread_n / (threads per node)
+    const int node_num = thread_n / ((n_threads + g_state.numa.n_nodes - 1) / g_state.numa.n_nodes);
+    struct ggml_numa_node * node = &g_state.numa.nodes[node_num];
+    size_t setsize = CPU_ALLOC_SIZE(g_state.numa.total_cpus);
+
+    cpu_set_t * cpus = CPU_ALLOC(g_state.numa.total_cpus);
+    CPU_ZERO_S(setsize, cpus);
+    for (size_t i = 0; i < node->n_cpus; ++i) {
+        CPU_SET_S(node->cpus[i], setsize, cpus);
+    }
+
+    int rv = pthread_setaffinity_np(pthread_self(), setsize, cpus);
+    if (rv) {
+            fprintf(stderr, "warning: pthread_setaffinity_np() failed: %s\n",
+                    strerror(rv));
+    }
+
+    CPU_FREE(cpus);
+}
+
+static void clear_numa_thread_affinity(void) {
+    if (!ggml_is_numa()) {
+        return;
+    }
+
+    size_t setsize = CPU_ALLOC_SIZE(g_state.numa.total_cpus);
+
+    cpu_set_t * cpus = CPU_ALLOC(g_state.numa.total_cpus);
+    CPU_ZERO_S(setsize, cpus);
+    for (unsigned i = 0; i < g_state.numa.total_cpus; ++i) {
+        CPU_SET_S(i, setsize, cpus);
+    }
+
+    int rv = pthread_setaffinity_np(pthread_self(), setsize, cpus);
+    if (rv) {
+        fprintf(stderr, "warning: pthread_setaffinity_np() failed: %s\n",
+            strerror(rv));
+    }
+
+    CPU_FREE(cpus);
+}
+#else
+// TODO: Windows etc.
+// (the linux implementation may also work on BSD, someone should test)
+static void set_numa_thread_affinity(int thread_n, int n_threads) { UNUSED(thread_n); UNUSED(n_threads);  }
+static void clear_numa_thread_affinity(void) {}
+#endif
+
+struct ggml_compute_state_shared {
+    const struct ggml_cgraph * cgraph;
+    const struct ggml_cplan  * cplan;
+
+    int64_t perf_node_start_cycles;
+    int64_t perf_node_start_time_us;
+
+    const int n_threads;
+
+    // synchronization primitives
+    atomic_int n_active;   // num active threads
+    atomic_int step_n;     // active step of a group of graph nodes
+    atomic_int n_item;     // next task of the active step
+    atomic_int n_sleeping; // num threads sleeping until step_n changes
+
+    bool (*abort_callback)(void * data); // abort ggml_graph_compute when true
+    void * abort_callback_data;
+};
+
+struct ggml_compute_state {
+    ggml_thread_t thrd;
+    int ith;
+    struct ggml_compute_state_shared * shared;
+    struct ggml_threadpool * threadpool; // set for the workers of a thread pool
+};
+
+//
+// thread pool
+//
+// workers are created once and parked on a condition variable between graphs
+// the calling thread of ggml_graph_compute() is always worker 0
+//
+
+struct ggml_threadpool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond_start; // signaled when a new graph is dispatched or the pool is stopped
+    pthread_cond_t  cond_done;  // signaled when a worker has finished the current graph
+    pthread_cond_t  cond_node;  // signaled when the active graph node changes and threads are sleeping
+
+    int n_threads;
+    int spin_us;
+
+    // protected by mutex
+    int  n_graph;  // number of graphs dispatched so far
+    int  n_active; // number of threads computing the current graph, may be less than n_threads
+    int  n_done;   // number of workers that have finished the current graph
+    bool stop;
+    struct ggml_compute_state_shared * shared; // the graph being computed
+
+    struct ggml_compute_state * workers;
+};
+
+static thread_ret_t ggml_graph_compute_thread(void * data);
+
+static thread_ret_t ggml_threadpool_thread(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * pool = state->threadpool;
+
+    set_numa_thread_affinity(state->ith, pool->n_threads);
+
+    int n_graph = 0;
+
+    while (true) {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->stop && pool->n_graph == n_graph) {
+            pthread_cond_wait(&pool->cond_start, &pool->mutex);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        n_graph = pool->n_graph;
+        // workers that are not part of this graph must not touch shared: the caller does not wait
+        // for them, so it may already be gone
+        const bool active = state->ith < pool->n_active;
+        struct ggml_compute_state_shared * shared = active ? pool->shared : NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (active) {
+            struct ggml_compute_state worker = {
+                /*.thrd       =*/ state->thrd,
+                /*.ith        =*/ state->ith,
+                /*.shared     =*/ shared,
+                /*.threadpool =*/ pool,
+            };
+            ggml_graph_compute_thread(&worker);
+
+            pthread_mutex_lock(&pool->mutex);
+            pool->n_done++;
+            pthread_cond_broadcast(&pool->cond_done);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+
+    return 0;
+}
+
+struct ggml_threadpool * ggml_threadpool_new(int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = GGML_DEFAULT_N_THREADS;
+    }
+
+    struct ggml_threadpool * pool = malloc(sizeof(struct ggml_threadpool));
+    GGML_ASSERT(pool);
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_start, NULL);
+    pthread_cond_init(&pool->cond_done, NULL);
+    pthread_cond_init(&pool->cond_node, NULL);
+
+    pool->n_threads = n_threads;
+    pool->spin_us   = GGML_DEFAULT_SPIN_US;
+    pool->n_graph   = 0;
+    pool->n_active  = 0;
+    pool->n_done    = 0;
+    pool->stop      = false;
+    pool->shared    = NULL;
+    pool->workers   = malloc(sizeof(struct ggml_compute_state)*n_threads);
+    GGML_ASSERT(pool->workers);
+
+    // worker 0 is the thread calling ggml_graph_compute()
+    for (int j = 1; j < n_threads; ++j) {
+        pool->workers[j] = (struct ggml_compute_state) {
+            .thrd       = 0,
+            .ith        = j,
+            .shared     = NULL,
+            .threadpool = pool,
+        };
+
+        const int rc = ggml_thread_create(&pool->workers[j].thrd, NULL, ggml_threadpool_thread, &pool->workers[j]);
+        GGML_ASSERT(rc == 0);
+    }
+
+    return pool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond_start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int j = 1; j < pool->n_threads; ++j) {
+        const int rc = ggml_thread_join(pool->workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+    }
+
+    pthread_cond_destroy(&pool->cond_node);
+    pthread_cond_destroy(&pool->cond_done);
+    pthread_cond_destroy(&pool->cond_start);
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool->workers);
+    free(pool);
+}
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * pool) {
+    return pool->n_threads;
+}
+
+void ggml_threadpool_set_spin_us(struct ggml_threadpool * pool, int spin_us) {
+    pool->spin_us = spin_us;
+}
+
+// wait until the active step of the graph is no longer `last` and return the new one
+// without a thread pool, threads always busy-wait
+static int ggml_graph_compute_wait(struct ggml_compute_state_shared * shared, int last) {
+    struct ggml_threadpool * pool = shared->cplan->threadpool;
+    const int spin_us = pool != NULL ? pool->spin_us : -1;
+
+    int step_n;
+
+    if (spin_us != 0) {
+        const int64_t t_end = ggml_time_us() + spin_us;
+        for (int i = 1; ; ++i) {
+            step_n = atomic_load(&shared->step_n);
+            if (step_n != last) {
+                return step_n;
+            }
+            // checking the time is more expensive than checking step_n
+            if (spin_us > 0 && i % 1024 == 0 && ggml_time_us() >= t_end) {
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    atomic_fetch_add(&shared->n_sleeping, 1);
+    while ((step_n = atomic_load(&shared->step_n)) == last) {
+        pthread_cond_wait(&pool->cond_node, &pool->mutex);
+    }
+    atomic_fetch_sub(&shared->n_sleeping, 1);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return step_n;
+}
+
+// wake up the threads sleeping in ggml_graph_compute_wait() after step_n has changed
+static void ggml_graph_compute_wake(struct ggml_compute_state_shared * shared) {
+    if (atomic_load(&shared->n_sleeping) == 0) {
+        return;
+    }
+
+    struct ggml_threadpool * pool = shared->cplan->threadpool;
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_broadcast(&pool->cond_node);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
+    int64_t cycles_cur  = ggml_perf_cycles()  - st->perf_node_start_cycles;
+    int64_t time_us_cur = ggml_perf_time_us() - st->perf_node_start_time_us;
+
+    node->perf_runs++;
+    node->perf_cycles  += cycles_cur;
+    node->perf_time_us += time_us_cur;
+}
+
+// max number of nodes that are computed concurrently
+#define GGML_MAX_GROUP_NODES 16
+
+// get the range of bytes that a tensor can access, including the gaps of non-contiguous views
+static void ggml_tensor_mem_range(const struct ggml_tensor * tensor, const char ** begin, const char ** end) {
+    *begin = tensor->data;
+    *end   = tensor->data;
+
+    if (tensor->data == NULL || ggml_nelements(tensor) == 0) {
+        return;
+    }
+
+    int64_t size = GGML_TYPE_SIZE[tensor->type] + (tensor->ne[0]/GGML_BLCK_SIZE[tensor->type] - 1)*tensor->nb[0];
+    for (int i = 1; i < GGML_MAX_DIMS; ++i) {
+        size += (tensor->ne[i] - 1)*tensor->nb[i];
+    }
+
+    *end = *begin + size;
+}
+
+static bool ggml_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a_begin, * a_end;
+    const char * b_begin, * b_end;
+
+    ggml_tensor_mem_range(a, &a_begin, &a_end);
+    ggml_tensor_mem_range(b, &b_begin, &b_end);
+
+    return a_begin < b_end && b_begin < a_end;
+}
+
+// ops that only change the view of the memory of their source
+static bool ggml_op_is_noop(enum ggml_op op) {
+    return op == GGML_OP_NONE || op == GGML_OP_VIEW || op == GGML_OP_RESHAPE ||
+           op == GGML_OP_PERMUTE || op == GGML_OP_TRANSPOSE;
+}
+
+// the sources that an op reads, the other ones only provide a shape
+static int ggml_op_n_src_read(const struct ggml_tensor * node) {
+    return node->op == GGML_OP_REPEAT ? 1 : GGML_MAX_SRC;
+}
+
+// ops that must not be computed concurrently with other nodes
+static bool ggml_node_is_barrier(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_MAP_UNARY:
+        case GGML_OP_MAP_BINARY:
+        case GGML_OP_MAP_CUSTOM1:
+        case GGML_OP_MAP_CUSTOM2:
+        case GGML_OP_MAP_CUSTOM3:
+            return true; // user callbacks may have side effects
+        default:
+            break;
+    }
+
+    if (node->backend != GGML_BACKEND_CPU) {
+        return true;
+    }
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        if (node->src[i] && node->src[i]->backend != GGML_BACKEND_CPU) {
+            return true;
+        }
+    }
+
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_CLBLAST)
+    // may be offloaded even when the tensors are on the CPU
+    if (node->op == GGML_OP_MUL_MAT || node->op == GGML_OP_OUT_PROD) {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+// check if node `a` reads or writes memory that node `b` writes
+static bool ggml_nodes_conflict(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (ggml_tensors_overlap(a, b)) {
+        return true;
+    }
+
+    for (int i = 0; i < ggml_op_n_src_read(a); ++i) {
+        if (a->src[i] && ggml_tensors_overlap(a->src[i], b)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// check if node `n` can not be computed concurrently with the nodes [start, n) of the graph
+static bool ggml_graph_node_conflicts(const struct ggml_cgraph * cgraph, int start, int n) {
+    const struct ggml_tensor * node = cgraph->nodes[n];
+
+    if (ggml_op_is_noop(node->op)) {
+        return false;
+    }
+    if (ggml_node_is_barrier(node)) {
+        return true;
+    }
+
+    for (int i = start; i < n; ++i) {
+        const struct ggml_tensor * prev = cgraph->nodes[i];
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#if defined(__x86_64__) || (defined(_MSC_VER) && defined(_M_AMD64))
-#define ggml_lock_lock(x)    _mm_pause()
-#else
-#define ggml_lock_lock(x)    UNUSED(x)
-#endif
-#define ggml_lock_unlock(x)  UNUSED(x)
+        if (ggml_op_is_noop(prev->op)) {
+            continue;
+        }
+        if (ggml_node_is_barrier(prev) || ggml_nodes_conflict(node, prev) || ggml_nodes_conflict(prev, node)) {
+            return true;
+        }
+    }
 
-#define GGML_LOCK_INITIALIZER 0
+    return false;
+}
 
-typedef pthread_t ggml_thread_t;
+// min amount of work per task, below which the cost of distributing a node to more threads is larger than the gain
+// matrix-vector products (single-token decode) are memory bound and benefit less from more threads
+#define GGML_MIN_TASK_WORK     16384
+#define GGML_MIN_TASK_WORK_VEC 65536
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+// estimate the number of tasks that are worth using for a node from its amount of work and number of rows
+static int ggml_graph_node_max_tasks(const struct ggml_tensor * node) {
+    const struct ggml_tensor * src0 = node->src[0];
 
-#endif
+    int64_t work;    // approx. number of operations
+    int64_t n_rows;  // number of parts that the op splits the work into
+    int64_t min_work = GGML_MIN_TASK_WORK;
 
-// Android's libc implementation "bionic" does not support setting affinity
-#if defined(__linux__) && !defined(__BIONIC__)
-static void set_numa_thread_affinity(int thread_n, int n_threads) {
-    if (!ggml_is_numa()) {
-        return;
-    }
+    switch (node->op) {
+        case GGML_OP_MUL_MAT:
+            {
+                const int64_t nr1 = node->src[1]->ne[1]*node->src[1]->ne[2]*node->src[1]->ne[3];
 
-    // run thread on node_num thread_n / (threads per node)
-    const int node_num = thread_n / ((n_threads + g_state.numa.n_nodes - 1) / g_state.numa.n_nodes);
-    struct ggml_numa_node * node = &g_state.numa.nodes[node_num];
-    size_t setsize = CPU_ALLOC_SIZE(g_state.numa.total_cpus);
+                work   = src0->ne[0]*src0->ne[1]*nr1;
+                n_rows = src0->ne[1];
 
-    cpu_set_t * cpus = CPU_ALLOC(g_state.numa.total_cpus);
-    CPU_ZERO_S(setsize, cpus);
-    for (size_t i = 0; i < node->n_cpus; ++i) {
-        CPU_SET_S(node->cpus[i], setsize, cpus);
-    }
+                if (nr1 == 1) {
+                    min_work = GGML_MIN_TASK_WORK_VEC;
+                }
+            } break;
+        case GGML_OP_CPY:
+        case GGML_OP_DUP:
+        case GGML_OP_SET_ROWS:
+            {
+                work   = ggml_nelements(src0);
+                n_rows = src0->ne[1];
+            } break;
+        case GGML_OP_ADD:
+        case GGML_OP_MUL:
+            {
+                work   = ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+            {
+                work   = 3*ggml_nelements(node);
+                n_rows = src0->ne[1];
+            } break;
+        case GGML_OP_NORM_AFFINE:
+            {
+                work   = 4*ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_SOFT_MAX_EXT:
+        case GGML_OP_DIAG_MASK_INF:
+        case GGML_OP_DIAG_MASK_ZERO:
+            {
+                work   = 4*ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_ROPE:
+            {
+                work   = 8*ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_UNARY:
+        case GGML_OP_SWIGLU:
+            {
+                work   = 4*ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_BIAS_ACT:
+            {
+                // an exp and a division per element
+                work   = 8*ggml_nelements(node);
+                n_rows = ggml_nrows(node);
+            } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                // a dot product with q and a multiply-add into the result for each key, the keys of
+                // a single query are split in blocks between the tasks
+                const int64_t n_kv = ggml_flash_attn_ext_n_kv(node);
 
-    int rv = pthread_setaffinity_np(pthread_self(), setsize, cpus);
-    if (rv) {
-            fprintf(stderr, "warning: pthread_setaffinity_np() failed: %s\n",
-                    strerror(rv));
+                work   = 2*ggml_nelements(node)*n_kv;
+                n_rows = ggml_nrows(node);
+                if (node->src[0]->ne[1] == 1) {
+                    n_rows *= (n_kv + GGML_FLASH_ATTN_EXT_BLOCK - 1)/GGML_FLASH_ATTN_EXT_BLOCK;
+                }
+            } break;
+        default:
+            return INT_MAX;
     }
 
-    CPU_FREE(cpus);
+    return (int) MAX(1, MIN(n_rows, work/min_work));
 }
 
-static void clear_numa_thread_affinity(void) {
-    if (!ggml_is_numa()) {
-        return;
+// max distance between matmuls that share the conversion of their src1
+#define GGML_MAX_SHARED_INIT_DIST 64
+
+// check if a matmul converts src1 to the vec_dot_type of src0 in the work buffer during its INIT phase
+static bool ggml_mul_mat_converts_src1(const struct ggml_tensor * node) {
+    if (node->op != GGML_OP_MUL_MAT || ggml_node_is_barrier(node)) {
+        return false;
     }
+    if (node->src[1]->type == type_traits[node->src[0]->type].vec_dot_type) {
+        return false;
+    }
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(node->src[0], node->src[1], node)) {
+        return false;
+    }
+#endif
+    return true;
+}
 
-    size_t setsize = CPU_ALLOC_SIZE(g_state.numa.total_cpus);
+// find an earlier matmul of the graph that converts the same src1 to the same type as node n, or return -1
+// src1 must not be written by the nodes in between
+static int ggml_graph_find_shared_init(const struct ggml_cgraph * cgraph, int n) {
+    const struct ggml_tensor * node = cgraph->nodes[n];
 
-    cpu_set_t * cpus = CPU_ALLOC(g_state.numa.total_cpus);
-    CPU_ZERO_S(setsize, cpus);
-    for (unsigned i = 0; i < g_state.numa.total_cpus; ++i) {
-        CPU_SET_S(i, setsize, cpus);
+    if (!ggml_mul_mat_converts_src1(node)) {
+        return -1;
     }
 
-    int rv = pthread_setaffinity_np(pthread_self(), setsize, cpus);
-    if (rv) {
-        fprintf(stderr, "warning: pthread_setaffinity_np() failed: %s\n",
-            strerror(rv));
+    const enum ggml_type vec_dot_type = type_traits[node->src[0]->type].vec_dot_type;
+
+    for (int i = n - 1; i >= 0 && i >= n - GGML_MAX_SHARED_INIT_DIST; --i) {
+        const struct ggml_tensor * prev = cgraph->nodes[i];
+
+        if (prev->op == GGML_OP_MUL_MAT && prev->src[1] == node->src[1] &&
+            type_traits[prev->src[0]->type].vec_dot_type == vec_dot_type && ggml_mul_mat_converts_src1(prev)) {
+            return i;
+        }
+        if (!ggml_op_is_noop(prev->op) && ggml_tensors_overlap(prev, node->src[1])) {
+            return -1;
+        }
     }
 
-    CPU_FREE(cpus);
+    return -1;
 }
-#else
-// TODO: Windows etc.
-// (the linux implementation may also work on BSD, someone should test)
-static void set_numa_thread_affinity(int thread_n, int n_threads) { UNUSED(thread_n); UNUSED(n_threads);  }
-static void clear_numa_thread_affinity(void) {}
-#endif
 
-struct ggml_compute_state_shared {
-    const struct ggml_cgraph * cgraph;
-    const struct ggml_cplan  * cplan;
+// set the number of tasks and the part of the work buffer of node i
+static void ggml_graph_compute_node_params(const struct ggml_cplan * cplan, int i, struct ggml_compute_params * params) {
+    params->nth   = cplan->n_tasks[i];
+    params->wsize = cplan->work_sizes[i];
+    params->wdata = cplan->work_data ? cplan->work_data + cplan->work_offs[i] : NULL;
+}
 
-    int64_t perf_node_start_cycles;
-    int64_t perf_node_start_time_us;
+// get the number of tasks of the INIT phase of a node
+// 0 means that the INIT phase runs on a single thread with the n_tasks of the node
+// the ops that split their INIT phase by ith / nth return at least 1
+static int ggml_graph_node_n_init_tasks(const struct ggml_cplan * cplan, const struct ggml_tensor * node) {
+    if (node->op != GGML_OP_MUL_MAT) {
+        return 0;
+    }
+    if (!ggml_mul_mat_converts_src1(node)) {
+        return 1;
+    }
 
-    const int n_threads;
+    const struct ggml_tensor * src1 = node->src[1];
 
-    // synchronization primitives
-    atomic_int n_active; // num active threads
-    atomic_int node_n;   // active graph node
+    // quantization of src1 rows
+    const int64_t nr1 = ggml_nrows(src1);
 
-    bool (*abort_callback)(void * data); // abort ggml_graph_compute when true
-    void * abort_callback_data;
-};
+    return (int) MAX(1, MIN(MIN(cplan->n_threads, nr1), nr1*src1->ne[0]/GGML_MIN_TASK_WORK));
+}
 
-struct ggml_compute_state {
-    ggml_thread_t thrd;
-    int ith;
-    struct ggml_compute_state_shared * shared;
-};
+// get the number of tasks of node i in the step of a group
+static int ggml_graph_node_n_step_tasks(const struct ggml_cgraph * cgraph, const struct ggml_cplan * cplan, int i, bool init) {
+    if (!init) {
+        return cplan->n_tasks[i];
+    }
+    if (cplan->skip_init[i]) {
+        return 0;
+    }
 
-static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
-    int64_t cycles_cur  = ggml_perf_cycles()  - st->perf_node_start_cycles;
-    int64_t time_us_cur = ggml_perf_time_us() - st->perf_node_start_time_us;
+    const int n_init_tasks = ggml_graph_node_n_init_tasks(cplan, cgraph->nodes[i]);
 
-    node->perf_runs++;
-    node->perf_cycles  += cycles_cur;
-    node->perf_time_us += time_us_cur;
+    return n_init_tasks > 1 ? n_init_tasks : 0;
 }
 
 static thread_ret_t ggml_graph_compute_thread(void * data) {
@@ -16046,15 +18630,23 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     const struct ggml_cplan  * cplan  = state->shared->cplan;
 
     const int * n_tasks_arr = cplan->n_tasks;
+    const int * group_end   = cplan->group_end;
+    const int   n_groups    = cplan->n_groups;
     const int   n_threads   = state->shared->n_threads;
 
-    set_numa_thread_affinity(state->ith, n_threads);
+    // pool workers are pinned once when they are created
+    if (cplan->threadpool == NULL || state->ith == 0) {
+        set_numa_thread_affinity(state->ith, n_threads);
+    }
 
-    int node_n = -1;
+    // each group has two steps: 2*group_n computes the INIT phases that are split between threads
+    // and 2*group_n + 1 computes the COMPUTE phases
+    int step_n = -1;
 
     while (true) {
         if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
-            state->shared->node_n += 1;
+            state->shared->step_n += 1;
+            ggml_graph_compute_wake(state->shared);
             return (thread_ret_t) GGML_EXIT_ABORTED;
         }
         if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
@@ -16064,41 +18656,57 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
                 /*.type  =*/ GGML_TASK_FINALIZE,
                 /*.ith   =*/ 0,
                 /*.nth   =*/ 0,
-                /*.wsize =*/ cplan->work_size,
-                /*.wdata =*/ cplan->work_data,
+                /*.wsize =*/ 0,
+                /*.wdata =*/ NULL,
             };
 
-            if (node_n != -1) {
+            if (step_n != -1 && step_n % 2 == 1) {
                 /* FINALIZE */
-                struct ggml_tensor * node = state->shared->cgraph->nodes[node_n];
-                if (GGML_OP_HAS_FINALIZE[node->op]) {
-                    params.nth = n_tasks_arr[node_n];
-                    ggml_compute_forward(&params, node);
+                const int group_n = step_n/2;
+                const int end     = group_end[group_n];
+
+                for (int i = group_n > 0 ? group_end[group_n - 1] : 0; i < end; ++i) {
+                    struct ggml_tensor * node = cgraph->nodes[i];
+                    if (GGML_OP_HAS_FINALIZE[node->op]) {
+                        params.type = GGML_TASK_FINALIZE;
+                        ggml_graph_compute_node_params(cplan, i, &params);
+                        ggml_compute_forward(&params, node);
+                    }
+                    ggml_graph_compute_perf_stats_node(node, state->shared);
                 }
-                ggml_graph_compute_perf_stats_node(node, state->shared);
             }
 
             // distribute new work or execute it direct if 1T
-            while (++node_n < cgraph->n_nodes) {
-                GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, node_n, cgraph->n_nodes);
+            while (++step_n < 2*n_groups) {
+                const int group_n = step_n/2;
+                const int start   = group_n > 0 ? group_end[group_n - 1] : 0;
+                const int end     = group_end[group_n];
 
-                struct ggml_tensor * node = cgraph->nodes[node_n];
-                const int n_tasks = n_tasks_arr[node_n];
+                if (step_n % 2 == 1) {
+                    // the INIT phases are done
+                    break;
+                }
+
+                GGML_PRINT_DEBUG_5("%s: %d-%d/%d\n", __func__, start, end, cgraph->n_nodes);
 
                 state->shared->perf_node_start_cycles  = ggml_perf_cycles();
                 state->shared->perf_node_start_time_us = ggml_perf_time_us();
 
-                params.nth = n_tasks;
+                if (end - start == 1 && n_tasks_arr[start] == 1) {
+                    // TODO: maybe push step_n to the atomic but if other threads see n_tasks is 1,
+                    // they do something more efficient than spinning (?)
+                    struct ggml_tensor * node = cgraph->nodes[start];
+
+                    ggml_graph_compute_node_params(cplan, start, &params);
 
-                /* INIT */
-                if (GGML_OP_HAS_INIT[node->op]) {
-                    params.type = GGML_TASK_INIT;
-                    ggml_compute_forward(&params, node);
-                }
+                    /* INIT */
+                    if (GGML_OP_HAS_INIT[node->op] && !cplan->skip_init[start]) {
+                        params.type = GGML_TASK_INIT;
+                        params.nth  = ggml_graph_node_n_init_tasks(cplan, node) > 0 ? 1 : n_tasks_arr[start];
+                        ggml_compute_forward(&params, node);
+                        params.nth  = n_tasks_arr[start];
+                    }
 
-                if (n_tasks == 1) {
-                    // TODO: maybe push node_n to the atomic but if other threads see n_tasks is 1,
-                    // they do something more efficient than spinning (?)
                     params.type = GGML_TASK_COMPUTE;
                     ggml_compute_forward(&params, node);
 
@@ -16108,43 +18716,90 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
                     }
 
                     ggml_graph_compute_perf_stats_node(node, state->shared);
-                } else {
-                    break;
+
+                    // skip the COMPUTE step of the group
+                    ++step_n;
+
+                    if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                /* INIT */
+                bool split_init = false;
+                for (int i = start; i < end; ++i) {
+                    struct ggml_tensor * node = cgraph->nodes[i];
+                    if (!GGML_OP_HAS_INIT[node->op] || cplan->skip_init[i]) {
+                        continue;
+                    }
+
+                    const int n_init_tasks = ggml_graph_node_n_init_tasks(cplan, node);
+                    if (n_init_tasks > 1) {
+                        split_init = true;
+                        continue;
+                    }
+
+                    params.type = GGML_TASK_INIT;
+                    ggml_graph_compute_node_params(cplan, i, &params);
+                    if (n_init_tasks == 1) {
+                        params.nth = 1;
+                    }
+                    ggml_compute_forward(&params, node);
                 }
 
-                if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
+                if (split_init) {
                     break;
                 }
             }
 
+            atomic_store(&state->shared->n_item,   0);
             atomic_store(&state->shared->n_active, n_threads);
-            atomic_store(&state->shared->node_n,   node_n);
+            atomic_store(&state->shared->step_n,   step_n);
+            ggml_graph_compute_wake(state->shared);
         } else {
             // wait for other threads to finish
-            const int last = node_n;
-            do {
-                //sched_yield();
-                node_n = atomic_load(&state->shared->node_n);
-            } while (node_n == last);
+            step_n = ggml_graph_compute_wait(state->shared, step_n);
         }
 
         // check if we should stop
-        if (node_n >= cgraph->n_nodes) break;
+        if (step_n >= 2*n_groups) break;
+
+        /* INIT or COMPUTE */
+        // the tasks of the nodes in the group are numbered consecutively and taken by the threads in order
+        const int  group_n = step_n/2;
+        const int  end     = group_end[group_n];
+        const bool init    = step_n % 2 == 0;
 
-        /* COMPUTE */
-        struct ggml_tensor * node = cgraph->nodes[node_n];
-        const int n_tasks = n_tasks_arr[node_n];
+        int i       = group_n > 0 ? group_end[group_n - 1] : 0;
+        int first   = 0; // number of the first task of node i
+        int n_tasks = ggml_graph_node_n_step_tasks(cgraph, cplan, i, init);
 
         struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_COMPUTE,
-            /*.ith   =*/ state->ith,
-            /*.nth   =*/ n_tasks,
-            /*.wsize =*/ cplan->work_size,
-            /*.wdata =*/ cplan->work_data,
+            /*.type  =*/ init ? GGML_TASK_INIT : GGML_TASK_COMPUTE,
+            /*.ith   =*/ 0,
+            /*.nth   =*/ 0,
+            /*.wsize =*/ 0,
+            /*.wdata =*/ NULL,
         };
 
-        if (state->ith < n_tasks) {
-            ggml_compute_forward(&params, node);
+        while (true) {
+            const int task = atomic_fetch_add(&state->shared->n_item, 1);
+
+            while (i < end && task >= first + n_tasks) {
+                first += n_tasks;
+                if (++i < end) {
+                    n_tasks = ggml_graph_node_n_step_tasks(cgraph, cplan, i, init);
+                }
+            }
+            if (i >= end) {
+                break;
+            }
+
+            ggml_graph_compute_node_params(cplan, i, &params);
+            params.ith = task - first;
+            params.nth = n_tasks;
+            ggml_compute_forward(&params, cgraph->nodes[i]);
         }
     }
 
@@ -16161,49 +18816,53 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
     struct ggml_cplan cplan;
     memset(&cplan, 0, sizeof(struct ggml_cplan));
 
+    // the nodes of the current group start at group_start
+    int group_start = 0;
+
+    // the node whose INIT phase computes the part of the work buffer of each node,
+    // and the last node that uses the part of the work buffer of each node
+    int init_node[GGML_MAX_NODES];
+    int last_use [GGML_MAX_NODES];
+
     // thread scheduling for the different operations + work buffer size estimation
     for (int i = 0; i < cgraph->n_nodes; i++) {
         int n_tasks = 1;
+        size_t cur = 0;
 
         struct ggml_tensor * node = cgraph->nodes[i];
 
         switch (node->op) {
             case GGML_OP_CPY:
             case GGML_OP_DUP:
+            case GGML_OP_SET_ROWS:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
                     if (ggml_is_quantized(node->type)) {
                         cur = GGML_TYPE_SIZE[GGML_TYPE_F32] * node->ne[0] * n_tasks;
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_ADD:
             case GGML_OP_ADD1:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     if (ggml_is_quantized(node->src[0]->type)) {
                         cur = GGML_TYPE_SIZE[GGML_TYPE_F32] * node->src[0]->ne[0] * n_tasks;
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_ACC:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     if (ggml_is_quantized(node->src[0]->type)) {
                         cur = GGML_TYPE_SIZE[GGML_TYPE_F32] * node->src[1]->ne[0] * n_tasks;
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_SUB:
             case GGML_OP_DIV:
@@ -16244,10 +18903,13 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     }
                 } break;
             case GGML_OP_SILU_BACK:
+            case GGML_OP_SWIGLU:
+            case GGML_OP_BIAS_ACT:
             case GGML_OP_MUL:
             case GGML_OP_NORM:
             case GGML_OP_RMS_NORM:
             case GGML_OP_RMS_NORM_BACK:
+            case GGML_OP_NORM_AFFINE:
                 {
                     n_tasks = n_threads;
                 } break;
@@ -16263,7 +18925,7 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     //n_tasks = MIN(n_threads, MAX(1, nr0/128));
                     //printf("nr0 = %8d, nr1 = %8d, nr0*nr1 = %8d, n_tasks%d\n", nr0, nr1, nr0*nr1, n_tasks);
 
-                    size_t cur = 0;
+                    cur = 0;
                     const enum ggml_type vec_dot_type = type_traits[node->src[0]->type].vec_dot_type;
 
 #if defined(GGML_USE_CUBLAS)
@@ -16293,8 +18955,6 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     } else {
                         cur = 0;
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_SCALE:
                 {
@@ -16316,6 +18976,7 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
             case GGML_OP_DIAG_MASK_INF:
             case GGML_OP_SOFT_MAX:
             case GGML_OP_SOFT_MAX_BACK:
+            case GGML_OP_SOFT_MAX_EXT:
             case GGML_OP_ROPE:
             case GGML_OP_ROPE_BACK:
                 {
@@ -16337,7 +18998,7 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     GGML_ASSERT(node->src[1]->ne[2] == 1);
                     GGML_ASSERT(node->src[1]->ne[3] == 1);
 
-                    size_t cur = 0;
+                    cur = 0;
                     const int nk = node->src[0]->ne[0];
 
                     if (node->src[0]->type == GGML_TYPE_F16 &&
@@ -16355,8 +19016,6 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     } else {
                         GGML_ASSERT(false);
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_CONV_2D:
                 {
@@ -16380,7 +19039,7 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     UNUSED(ne03);
                     UNUSED(ne2);
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     if (node->src[0]->type == GGML_TYPE_F16 &&
                         node->src[1]->type == GGML_TYPE_F32) {
@@ -16391,8 +19050,6 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     } else {
                         GGML_ASSERT(false);
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_POOL_1D:
             case GGML_OP_POOL_2D:
@@ -16403,7 +19060,7 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
 
@@ -16416,14 +19073,19 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                         cur  = sizeof(float)*ne11*n_tasks; // TODO: this can become (n_tasks-1)
                         cur += sizeof(float)*ne11*n_tasks; // this is overestimated by x2
                     }
+                } break;
+            case GGML_OP_FLASH_ATTN_EXT:
+                {
+                    n_tasks = n_threads;
 
-                    work_size = MAX(work_size, cur);
+                    cur  = ggml_flash_attn_ext_psize(node, n_tasks);
+                    cur += ggml_flash_attn_ext_wsize(node)*n_tasks;
                 } break;
             case GGML_OP_FLASH_FF:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     if (node->src[1]->type == GGML_TYPE_F32) {
                         cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
@@ -16434,14 +19096,12 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                         cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
                         cur += sizeof(float)*node->src[1]->ne[1]*n_tasks; // this is overestimated by x2
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_FLASH_ATTN_BACK:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = 0;
+                    cur = 0;
 
                     const int64_t    D = node->src[0]->ne[0];
                     const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
@@ -16455,8 +19115,6 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                         cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
                         cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
                     }
-
-                    work_size = MAX(work_size, cur);
                 } break;
             case GGML_OP_WIN_PART:
             case GGML_OP_WIN_UNPART:
@@ -16472,17 +19130,13 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
-
-                    work_size = MAX(work_size, cur);
+                    cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
                 } break;
             case GGML_OP_CROSS_ENTROPY_LOSS_BACK:
                 {
                     n_tasks = n_threads;
 
-                    size_t cur = ggml_type_size(node->type)*node->src[0]->ne[0]*n_tasks;
-
-                    work_size = MAX(work_size, cur);
+                    cur = ggml_type_size(node->type)*node->src[0]->ne[0]*n_tasks;
                 } break;
             case GGML_OP_NONE:
                 {
@@ -16494,13 +19148,97 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                 } break;
         }
 
+        // idle threads move on to the tasks of the other nodes in the group
+        n_tasks = MIN(n_tasks, ggml_graph_node_max_tasks(node));
+
         cplan.n_tasks[i] = n_tasks;
+
+        // group the node with the previous ones if it does not depend on them
+        if (i > group_start && (i - group_start >= GGML_MAX_GROUP_NODES || ggml_graph_node_conflicts(cgraph, group_start, i))) {
+            cplan.group_end[cplan.n_groups++] = i;
+            group_start = i;
+        }
+
+        if (cur > 0) {
+            cur += CACHE_LINE_SIZE*(n_tasks - 1);
+        }
+
+        cplan.work_sizes[i] = GGML_PAD(cur, CACHE_LINE_SIZE);
+
+        // matmuls with the same src1 convert it only once
+        init_node[i] = i;
+        last_use [i] = i;
+
+        const int shared = ggml_graph_find_shared_init(cgraph, i);
+        if (shared != -1) {
+            init_node[i] = init_node[shared];
+            last_use[init_node[i]] = i;
+            cplan.skip_init[i] = true;
+        }
     }
 
-    if (work_size > 0) {
-        work_size += CACHE_LINE_SIZE*(n_threads - 1);
+    if (cgraph->n_nodes > 0) {
+        cplan.group_end[cplan.n_groups++] = cgraph->n_nodes;
+    }
+
+    // each node of a group gets its own part of the work buffer
+    // the parts that are used by later groups are placed after them and are kept until their last use
+    size_t shared_size = 0;
+    {
+        int  n_live = 0;
+        int  live[GGML_MAX_NODES];
+        bool shared_part[GGML_MAX_NODES] = { false };
+
+        for (int g = 0; g < cplan.n_groups; ++g) {
+            const int start = g > 0 ? cplan.group_end[g - 1] : 0;
+            const int end   = cplan.group_end[g];
+
+            // release the parts whose last use was in a previous group
+            int n_kept = 0;
+            for (int j = 0; j < n_live; ++j) {
+                if (last_use[live[j]] >= start) {
+                    live[n_kept++] = live[j];
+                }
+            }
+            n_live = n_kept;
+
+            size_t group_size = 0;
+
+            for (int i = start; i < end; ++i) {
+                if (init_node[i] != i) {
+                    cplan.work_offs [i] = cplan.work_offs [init_node[i]];
+                    cplan.work_sizes[i] = cplan.work_sizes[init_node[i]];
+                    continue;
+                }
+
+                if (last_use[i] < end) {
+                    cplan.work_offs[i] = group_size;
+                    group_size += cplan.work_sizes[i];
+                } else {
+                    size_t offs = 0;
+                    for (int j = 0; j < n_live; ++j) {
+                        offs = MAX(offs, cplan.work_offs[live[j]] + cplan.work_sizes[live[j]]);
+                    }
+                    // shared parts are offset by work_size below
+                    cplan.work_offs[i] = offs;
+                    shared_size = MAX(shared_size, offs + cplan.work_sizes[i]);
+                    shared_part[i] = true;
+                    live[n_live++] = i;
+                }
+            }
+
+            work_size = MAX(work_size, group_size);
+        }
+
+        for (int i = 0; i < cgraph->n_nodes; ++i) {
+            if (shared_part[init_node[i]]) {
+                cplan.work_offs[i] += work_size;
+            }
+        }
     }
 
+    work_size += shared_size;
+
     cplan.n_threads = n_threads;
     cplan.work_size = work_size;
     cplan.work_data = NULL;
@@ -16533,14 +19271,30 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
         /*.perf_node_start_time_us =*/ 0,
         /*.n_threads               =*/ n_threads,
         /*.n_active                =*/ n_threads,
-        /*.node_n                  =*/ -1,
+        /*.step_n                  =*/ -1,
+        /*.n_item                  =*/ 0,
+        /*.n_sleeping              =*/ 0,
         /*.abort_callback          =*/ NULL,
         /*.abort_callback_data     =*/ NULL,
     };
     struct ggml_compute_state * workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
 
-    // create thread pool
-    if (n_threads > 1) {
+    struct ggml_threadpool * pool = cplan->threadpool;
+    if (pool != NULL) {
+        GGML_ASSERT(n_threads <= pool->n_threads);
+    }
+
+    if (pool != NULL && n_threads > 1) {
+        // wake up the parked workers
+        pthread_mutex_lock(&pool->mutex);
+        pool->shared = &state_shared;
+        pool->n_active = n_threads;
+        pool->n_done = 0;
+        pool->n_graph++;
+        pthread_cond_broadcast(&pool->cond_start);
+        pthread_mutex_unlock(&pool->mutex);
+    } else if (n_threads > 1) {
+        // create thread pool
         for (int j = 1; j < n_threads; ++j) {
             workers[j] = (struct ggml_compute_state) {
                 .thrd   = 0,
@@ -16554,6 +19308,7 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     }
     workers[0].ith = 0;
     workers[0].shared = &state_shared;
+    workers[0].threadpool = pool;
 
     const int64_t perf_start_cycles  = ggml_perf_cycles();
     const int64_t perf_start_time_us = ggml_perf_time_us();
@@ -16564,8 +19319,16 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     // don't leave affinity set on the main thread
     clear_numa_thread_affinity();
 
-    // join or kill thread pool
-    if (n_threads > 1) {
+    if (pool != NULL && n_threads > 1) {
+        // wait for the workers to stop using the shared state before it goes out of scope
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->n_done < n_threads - 1) {
+            pthread_cond_wait(&pool->cond_done, &pool->mutex);
+        }
+        pool->shared = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+    } else if (n_threads > 1) {
+        // join or kill thread pool
         for (int j = 1; j < n_threads; j++) {
             const int rc = ggml_thread_join(workers[j].thrd, NULL);
             GGML_ASSERT(rc == 0);
@@ -16603,7 +19366,12 @@ void ggml_graph_reset(struct ggml_cgraph * cgraph) {
 }
 
 void ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads) {
+    ggml_graph_compute_with_ctx_threadpool(ctx, cgraph, n_threads, NULL);
+}
+
+void ggml_graph_compute_with_ctx_threadpool(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool) {
     struct ggml_cplan cplan = ggml_graph_plan(cgraph, n_threads);
+    cplan.threadpool = threadpool;
 
     struct ggml_object * obj = ggml_new_object(ctx, GGML_OBJECT_WORK_BUFFER, cplan.work_size);
 
@@ -18326,10 +21094,74 @@ size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, i
     return result;
 }
 
+enum ggml_type ggml_repack_type(enum ggml_type type) {
+    switch (type) {
+        case GGML_TYPE_Q4_0: return GGML_TYPE_Q4_0_8;
+        case GGML_TYPE_Q8_0: return GGML_TYPE_Q8_0_8;
+        default:             return GGML_TYPE_COUNT;
+    }
+}
+
+int ggml_repack_nrows(enum ggml_type type) {
+    const enum ggml_type rtype = ggml_repack_type(type);
+    return rtype == GGML_TYPE_COUNT ? 1 : type_traits[rtype].nrows;
+}
+
+void ggml_repack(enum ggml_type type, const void * src, void * dst, int nrows, int n_per_row) {
+    GGML_ASSERT(ggml_repack_type(type) != GGML_TYPE_COUNT);
+    GGML_ASSERT(nrows % 8 == 0);
+    GGML_ASSERT(n_per_row % GGML_BLCK_SIZE[type] == 0);
+
+    const int    nb       = n_per_row/GGML_BLCK_SIZE[type];
+    const size_t row_size = nb*GGML_TYPE_SIZE[type];
+
+    // the 8 rows being interleaved, since src and dst can overlap
+    char * rows = malloc(8*row_size);
+
+    for (int ir = 0; ir < nrows; ir += 8) {
+        memcpy(rows, (const char *) src + ir*row_size, 8*row_size);
+
+        switch (type) {
+            case GGML_TYPE_Q4_0:
+                {
+                    block_q4_0x8 * y = (block_q4_0x8 *) ((char *) dst + ir*row_size);
+                    for (int i = 0; i < nb; ++i) {
+                        for (int r = 0; r < 8; ++r) {
+                            const block_q4_0 * x = (const block_q4_0 *) (rows + r*row_size) + i;
+                            y[i].d[r] = x->d;
+                            for (int k = 0; k < 4; ++k) {
+                                memcpy(y[i].qs + 32*k + 4*r, x->qs + 4*k, 4);
+                            }
+                        }
+                    }
+                } break;
+            case GGML_TYPE_Q8_0:
+                {
+                    block_q8_0x8 * y = (block_q8_0x8 *) ((char *) dst + ir*row_size);
+                    for (int i = 0; i < nb; ++i) {
+                        for (int r = 0; r < 8; ++r) {
+                            const block_q8_0 * x = (const block_q8_0 *) (rows + r*row_size) + i;
+                            y[i].d[r] = x->d;
+                            for (int k = 0; k < 8; ++k) {
+                                memcpy(y[i].qs + 32*k + 4*r, x->qs + 4*k, 4);
+                            }
+                        }
+                    }
+                } break;
+            default:
+                GGML_ASSERT(false);
+        }
+    }
+
+    free(rows);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int ggml_cpu_has_avx(void) {
-#if defined(__AVX__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX;
+#elif defined(__AVX__)
     return 1;
 #else
     return 0;
@@ -18337,7 +21169,9 @@ int ggml_cpu_has_avx(void) {
 }
 
 int ggml_cpu_has_avx2(void) {
-#if defined(__AVX2__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX2;
+#elif defined(__AVX2__)
     return 1;
 #else
     return 0;
@@ -18345,7 +21179,9 @@ int ggml_cpu_has_avx2(void) {
 }
 
 int ggml_cpu_has_avx512(void) {
-#if defined(__AVX512F__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX512;
+#elif defined(__AVX512F__)
     return 1;
 #else
     return 0;
@@ -18361,7 +21197,9 @@ int ggml_cpu_has_avx512_vbmi(void) {
 }
 
 int ggml_cpu_has_avx512_vnni(void) {
-#if defined(__AVX512VNNI__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX512;
+#elif defined(__AVX512VNNI__)
     return 1;
 #else
     return 0;
@@ -18369,7 +21207,9 @@ int ggml_cpu_has_avx512_vnni(void) {
 }
 
 int ggml_cpu_has_fma(void) {
-#if defined(__FMA__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX2;
+#elif defined(__FMA__)
     return 1;
 #else
     return 0;
@@ -18393,7 +21233,9 @@ int ggml_cpu_has_arm_fma(void) {
 }
 
 int ggml_cpu_has_f16c(void) {
-#if defined(__F16C__)
+#if defined(GGML_CPU_DISPATCH)
+    return cpu_level >= GGML_CPU_AVX;
+#elif defined(__F16C__)
     return 1;
 #else
     return 0;
@@ -18461,3 +21303,5 @@ int ggml_cpu_has_vsx(void) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+
+#endif // GGML_CPU_VARIANT
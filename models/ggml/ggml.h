@@ -201,6 +201,7 @@
 #define GGML_MAX_NAME          48
 #define GGML_MAX_OP_PARAMS     32
 #define GGML_DEFAULT_N_THREADS 4
+#define GGML_DEFAULT_SPIN_US   200
 
 
 #define GGML_EXIT_SUCCESS 0
@@ -284,6 +285,9 @@ extern "C" {
         GGML_TYPE_I8,
         GGML_TYPE_I16,
         GGML_TYPE_I32,
+        // Q4_0 and Q8_0 with the blocks of each 8 rows interleaved, see ggml_repack
+        GGML_TYPE_Q4_0_8,
+        GGML_TYPE_Q8_0_8,
         GGML_TYPE_COUNT,
     };
 
@@ -333,9 +337,12 @@ extern "C" {
         GGML_OP_REPEAT_BACK,
         GGML_OP_REPEAT2,
         GGML_OP_SILU_BACK,
+        GGML_OP_SWIGLU,
         GGML_OP_NORM, // normalize
         GGML_OP_RMS_NORM,
         GGML_OP_RMS_NORM_BACK,
+        GGML_OP_NORM_AFFINE,
+        GGML_OP_BIAS_ACT,
 
         GGML_OP_MUL_MAT,
         GGML_OP_OUT_PROD,
@@ -350,11 +357,13 @@ extern "C" {
         GGML_OP_TRANSPOSE,
         GGML_OP_GET_ROWS,
         GGML_OP_GET_ROWS_BACK,
+        GGML_OP_SET_ROWS,
         GGML_OP_DIAG,
         GGML_OP_DIAG_MASK_INF,
         GGML_OP_DIAG_MASK_ZERO,
         GGML_OP_SOFT_MAX,
         GGML_OP_SOFT_MAX_BACK,
+        GGML_OP_SOFT_MAX_EXT,
         GGML_OP_ROPE,
         GGML_OP_ROPE_BACK,
         GGML_OP_ALIBI,
@@ -365,6 +374,7 @@ extern "C" {
         GGML_OP_POOL_2D,
 
         GGML_OP_FLASH_ATTN,
+        GGML_OP_FLASH_ATTN_EXT,
         GGML_OP_FLASH_FF,
         GGML_OP_FLASH_ATTN_BACK,
         GGML_OP_WIN_PART,
@@ -398,6 +408,13 @@ extern "C" {
         GGML_UNARY_OP_SILU,
     };
 
+    // activations of ggml_bias_act
+    enum ggml_act_op {
+        GGML_ACT_OP_GELU,     // tanh approximation, as ggml_gelu
+        GGML_ACT_OP_GELU_ERF, // 0.5*x*(1 + erf(x/sqrt(2)))
+        GGML_ACT_OP_SILU,
+    };
+
     enum ggml_object_type {
         GGML_OBJECT_TENSOR,
         GGML_OBJECT_GRAPH,
@@ -457,6 +474,8 @@ extern "C" {
 
     static const size_t GGML_TENSOR_SIZE = sizeof(struct ggml_tensor);
 
+    struct ggml_threadpool;
+
     // the compute plan that needs to be prepared for ggml_graph_compute()
     // since https://github.com/ggerganov/ggml/issues/287
     struct ggml_cplan {
@@ -468,9 +487,26 @@ extern "C" {
         // the `n_tasks` of nodes, 1:1 mapping to cgraph nodes
         int n_tasks[GGML_MAX_NODES];
 
+        // consecutive nodes that do not depend on each other are computed concurrently
+        // group `i` is the nodes [group_end[i - 1], group_end[i])
+        int n_groups;
+        int group_end[GGML_MAX_NODES];
+
+        // the part of the work buffer used by each node
+        size_t work_offs [GGML_MAX_NODES];
+        size_t work_sizes[GGML_MAX_NODES];
+
+        // nodes that use the result of the INIT phase of an earlier node in their part of the work buffer
+        // (e.g. matmuls that share src1 and its conversion to the vec_dot_type)
+        bool skip_init[GGML_MAX_NODES];
+
         // abort ggml_graph_compute when true
         bool (*abort_callback)(void * data);
         void * abort_callback_data;
+
+        // optional persistent worker threads, created with `ggml_threadpool_new()`
+        // when NULL, new threads are created and joined for every graph
+        struct ggml_threadpool * threadpool;
     };
 
     // next prime after GGML_MAX_NODES
@@ -555,6 +591,7 @@ extern "C" {
     GGML_API int     ggml_blck_size (enum ggml_type type);
     GGML_API size_t  ggml_type_size (enum ggml_type type); // size in bytes for all elements in a block
     GGML_API float   ggml_type_sizef(enum ggml_type type); // ggml_type_size()/ggml_blck_size() as float
+    GGML_API size_t  ggml_row_size  (enum ggml_type type, int64_t ne); // size in bytes for a row of ne elements
 
     GGML_API const char * ggml_type_name(enum ggml_type type);
     GGML_API const char * ggml_op_name  (enum ggml_op   op);
@@ -589,6 +626,13 @@ extern "C" {
     GGML_API size_t  ggml_get_mem_size       (const struct ggml_context * ctx);
     GGML_API size_t  ggml_get_max_tensor_size(const struct ggml_context * ctx);
 
+    // zeroed memory whose pages are only backed once they are written, for buffers that are sized
+    // for the worst case but filled over time such as the KV cache
+    GGML_API void *  ggml_lazy_alloc  (size_t size);
+    GGML_API void    ggml_lazy_free   (void * data, size_t size);
+    // gives the whole pages in [data, data + size) back to the system, they read as zeros afterwards
+    GGML_API void    ggml_lazy_discard(void * data, size_t size);
+
     GGML_API struct ggml_tensor * ggml_new_tensor(
             struct ggml_context * ctx,
             enum   ggml_type type,
@@ -875,6 +919,19 @@ extern "C" {
             struct ggml_tensor  * a,
             struct ggml_tensor  * b);
 
+    // silu(x[:n]) * x[n:] along rows, where ne0 of a is 2*n
+    GGML_API struct ggml_tensor * ggml_swiglu(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a);
+
+    // act(a + b) where b is a vector added to each row of a
+    // b can be NULL, the activation is computed in f32 without the f16 tables
+    GGML_API struct ggml_tensor * ggml_bias_act(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            enum ggml_act_op      op);
+
     // normalize along rows
     // TODO: eps is hardcoded to 1e-5 for now
     GGML_API struct ggml_tensor * ggml_norm(
@@ -903,6 +960,21 @@ extern "C" {
             struct ggml_tensor  * a,
             struct ggml_tensor  * b);
 
+    // ggml_norm(a)*w + b in a single pass over the rows of a
+    // w and b are vectors of ne0 elements, b can be NULL
+    GGML_API struct ggml_tensor * ggml_norm_affine(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * w,
+            struct ggml_tensor  * b);
+
+    // ggml_rms_norm(a, eps)*w in a single pass over the rows of a
+    GGML_API struct ggml_tensor * ggml_rms_norm_affine(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * w,
+            float                 eps);
+
     // A: n columns, m rows
     // B: n columns, p rows  (i.e. we transpose it internally)
     // result is m columns, p rows
@@ -1103,6 +1175,15 @@ extern "C" {
             struct ggml_tensor  * b,
             struct ggml_tensor  * c);
 
+    // a[:, c[i]] = b[:, i]
+    // b is F32 and is converted to the type of a, c is an I32 vector
+    // returns a view of a
+    GGML_API struct ggml_tensor * ggml_set_rows(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c);
+
     GGML_API struct ggml_tensor * ggml_diag(
         struct ggml_context     * ctx,
         struct ggml_tensor      * a);
@@ -1151,6 +1232,23 @@ extern "C" {
             struct ggml_tensor  * a,
             struct ggml_tensor  * b);
 
+    // soft_max(diag_mask_inf(a*scale + alibi, n_past)) in a single pass over a
+    // the alibi bias of ggml_alibi is added if max_bias > 0.0f, with a->ne[2] heads
+    GGML_API struct ggml_tensor * ggml_soft_max_ext(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            float                 scale,
+            int                   n_past,
+            float                 max_bias);
+
+    // in-place, returns view(a)
+    GGML_API struct ggml_tensor * ggml_soft_max_ext_inplace(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            float                 scale,
+            int                   n_past,
+            float                 max_bias);
+
     // rotary position embedding
     // if mode & 1 == 1, skip n_past elements
     // if mode & 2 == 1, GPT-NeoX style
@@ -1282,6 +1380,41 @@ extern "C" {
             struct ggml_tensor  * v,
             bool                  masked);
 
+    // causal attention that folds the scores of blocks of keys into the output with an online
+    // softmax, so that KQ is never materialized and k and v are read in place (e.g. from a KV cache)
+    // q:   [head_dim, N, n_head]
+    // k:   [head_dim, n_past + N, n_head_kv], n_head must be a multiple of n_head_kv
+    // v:   like k, or a transposed view of [n_past + N, head_dim, n_head_kv]
+    // res: [head_dim, n_head, N]
+    // the scores are multiplied by scale, and with max_bias > 0 get the bias of ggml_alibi
+    GGML_API struct ggml_tensor * ggml_flash_attn_ext(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * q,
+            struct ggml_tensor  * k,
+            struct ggml_tensor  * v,
+            float                 scale,
+            float                 max_bias);
+
+    // ggml_flash_attn_ext over a paged KV cache: key i is row rows[i] of k and v
+    // rows: I32 [n_past + N]
+    // k:    [head_dim, n_rows, n_head_kv] with n_rows covering all the rows in rows
+    // v:    like k
+    GGML_API struct ggml_tensor * ggml_flash_attn_ext_paged(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * q,
+            struct ggml_tensor  * k,
+            struct ggml_tensor  * v,
+            struct ggml_tensor  * rows,
+            float                 scale,
+            float                 max_bias);
+
+    // the attention weights of each key of a ggml_flash_attn_ext node, summed over the heads and
+    // the queries, are added to the element of scores at its row of k
+    // scores: F32 [n_rows]
+    GGML_API void ggml_flash_attn_ext_add_scores(
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * scores);
+
     GGML_API struct ggml_tensor * ggml_flash_attn_back(
            struct ggml_context * ctx,
            struct ggml_tensor  * q,
@@ -1436,6 +1569,19 @@ extern "C" {
     // same as ggml_graph_compute() but the work data is allocated as a part of the context
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_API void ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
+    GGML_API void ggml_graph_compute_with_ctx_threadpool(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool);
+
+    // persistent worker threads that are parked between graphs
+    // a thread pool can be used by only one ggml_graph_compute() call at a time
+    // `n_threads` includes the thread calling ggml_graph_compute() and is the maximum `cplan.n_threads`
+    GGML_API struct ggml_threadpool * ggml_threadpool_new      (int n_threads);
+    GGML_API void                     ggml_threadpool_free     (struct ggml_threadpool * threadpool);
+    GGML_API int                      ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool);
+
+    // while waiting for other threads to finish a node, idle threads busy-wait for up to `spin_us` microseconds
+    // and then sleep until they are woken up
+    // spin_us < 0 busy-waits without sleeping, spin_us == 0 sleeps right away (default: GGML_DEFAULT_SPIN_US)
+    GGML_API void                     ggml_threadpool_set_spin_us(struct ggml_threadpool * threadpool, int spin_us);
 
     GGML_API struct ggml_tensor * ggml_graph_get_tensor(struct ggml_cgraph * cgraph, const char * name);
 
@@ -1625,6 +1771,15 @@ extern "C" {
 
     GGML_API size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, int start, int n, int64_t * hist);
 
+    // the type of the weights of ggml_mul_mat after ggml_repack, or GGML_TYPE_COUNT if the type can't be repacked
+    GGML_API enum ggml_type ggml_repack_type(enum ggml_type type);
+    // number of consecutive rows whose blocks are interleaved by ggml_repack
+    GGML_API int            ggml_repack_nrows(enum ggml_type type);
+    // interleaves the blocks of each ggml_repack_nrows rows of a matrix of the given type
+    // the result can only be used as src0 of ggml_mul_mat, with type ggml_repack_type(type)
+    // src and dst can be the same
+    GGML_API void ggml_repack(enum ggml_type type, const void * src, void * dst, int nrows, int n_per_row);
+
     //
     // system info
     //
@@ -1660,13 +1815,20 @@ extern "C" {
     typedef void (*ggml_to_float_t)  (const void  * GGML_RESTRICT x, float * GGML_RESTRICT y, int k);
     typedef void (*ggml_from_float_t)(const float * GGML_RESTRICT x, void  * GGML_RESTRICT y, int k);
     typedef void (*ggml_vec_dot_t)   (const int n, float * GGML_RESTRICT s, const void * GGML_RESTRICT x, const void * GGML_RESTRICT y);
+    // dot products of x with the 4 rows of y that are by bytes apart, written to s[0..3]
+    typedef void (*ggml_vec_dot_x4_t)(const int n, float * GGML_RESTRICT s, const void * GGML_RESTRICT x, const void * GGML_RESTRICT y, size_t by);
+    // y += x*v for a row x of n elements
+    typedef void (*ggml_vec_mad_t)   (const int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT x, const float v);
 
     typedef struct {
         ggml_to_float_t   to_float;
         ggml_from_float_t from_float;
         ggml_from_float_t from_float_reference;
         ggml_vec_dot_t    vec_dot;
+        ggml_vec_dot_x4_t vec_dot_x4;
+        ggml_vec_mad_t    mad;
         enum ggml_type    vec_dot_type;
+        int               nrows; // for interleaved types, the rows whose dot products vec_dot writes to s[0..nrows-1]
     } ggml_type_traits_t;
 
     ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type i);
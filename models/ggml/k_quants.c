@@ -1180,8 +1180,97 @@ void dequantize_row_q8_K(const block_q8_K * restrict x, float * restrict y, int
     }
 }
 
-void quantize_row_q8_K(const float * restrict x, void * restrict y, int k) {
-    quantize_row_q8_K_reference(x, y, k);
+#if defined __AVX2__
+
+// horizontally add 8 int32_t
+static inline int hsum_i32_8_k(const __m256i a) {
+    const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extractf128_si256(a, 1));
+    const __m128i sum64  = _mm_add_epi32(sum128, _mm_unpackhi_epi64(sum128, sum128));
+    const __m128i sum32  = _mm_add_epi32(sum64, _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum32);
+}
+
+#endif
+
+void quantize_row_q8_K(const float * restrict x, void * restrict vy, int k) {
+#if defined __AVX2__
+    assert(k % QK_K == 0);
+    const int nb = k / QK_K;
+
+    block_q8_K * restrict y = vy;
+
+    const __m256  sign_bit = _mm256_set1_ps(-0.0f);
+    const __m256i max_q    = _mm256_set1_epi32(127);
+    const __m256i perm     = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (int i = 0; i < nb; i++) {
+
+        // max(x, amax) keeps amax when x is NaN, which the reference skips too
+        __m256 amaxv = _mm256_setzero_ps();
+        for (int j = 0; j < QK_K; j += 8) {
+            amaxv = _mm256_max_ps(_mm256_andnot_ps(sign_bit, _mm256_loadu_ps(x + j)), amaxv);
+        }
+        __m128 amax4 = _mm_max_ps(_mm256_extractf128_ps(amaxv, 1), _mm256_castps256_ps128(amaxv));
+        amax4 = _mm_max_ps(amax4, _mm_movehl_ps(amax4, amax4));
+        amax4 = _mm_max_ss(amax4, _mm_movehdup_ps(amax4));
+        const float amax = _mm_cvtss_f32(amax4);
+
+        if (!amax) {
+            y[i].d = 0;
+            memset(y[i].qs, 0, QK_K);
+            memset(y[i].bsums, 0, sizeof(y[i].bsums));
+            x += QK_K;
+            continue;
+        }
+
+        // the sign of the scale comes from the first value with the max absolute value
+        float max = amax;
+        const __m256 amax8 = _mm256_set1_ps(amax);
+        for (int j = 0; j < QK_K; j += 8) {
+            const int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign_bit, _mm256_loadu_ps(x + j)), amax8, _CMP_EQ_OQ));
+            if (mask) {
+                int l = 0;
+                while (!(mask & (1 << l))) {
+                    ++l;
+                }
+                max = x[j + l];
+                break;
+            }
+        }
+
+        const float iscale = -128.f/max;
+        const __m256 mul = _mm256_set1_ps(iscale);
+
+        for (int j = 0; j < QK_K; j += 32) {
+            // round to nearest even like nearest_int()
+            __m256i i0 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + j +  0), mul));
+            __m256i i1 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + j +  8), mul));
+            __m256i i2 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + j + 16), mul));
+            __m256i i3 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + j + 24), mul));
+
+            i0 = _mm256_min_epi32(i0, max_q);
+            i1 = _mm256_min_epi32(i1, max_q);
+            i2 = _mm256_min_epi32(i2, max_q);
+            i3 = _mm256_min_epi32(i3, max_q);
+
+            y[i].bsums[j/16 + 0] = hsum_i32_8_k(_mm256_add_epi32(i0, i1));
+            y[i].bsums[j/16 + 1] = hsum_i32_8_k(_mm256_add_epi32(i2, i3));
+
+            // the packs process 128-bit lanes independently, the permute restores the order
+            i0 = _mm256_packs_epi32(i0, i1);
+            i2 = _mm256_packs_epi32(i2, i3);
+            i0 = _mm256_packs_epi16(i0, i2);
+            i0 = _mm256_permutevar8x32_epi32(i0, perm);
+
+            _mm256_storeu_si256((__m256i *)(y[i].qs + j), i0);
+        }
+
+        y[i].d = 1/iscale;
+        x += QK_K;
+    }
+#else
+    quantize_row_q8_K_reference(x, vy, k);
+#endif
 }
 
 //===================================== Dot ptoducts =================================
@@ -1238,6 +1327,30 @@ static inline __m128i get_scale_shuffle(int i) {
 }
 #endif
 
+#if defined __AVX512BW__
+// lo and hi in the low and high halves of a 512-bit vector
+static inline __m512i concat_256_512(const __m256i lo, const __m256i hi) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+}
+
+// shuffles i and i + 1 of get_scale_shuffle_q3k / get_scale_shuffle_k4 in one vector
+static inline __m512i get_scale_shuffle_q3k_512(int i) {
+    return concat_256_512(get_scale_shuffle_q3k(i), get_scale_shuffle_q3k(i + 1));
+}
+static inline __m512i get_scale_shuffle_k4_512(int i) {
+    return concat_256_512(get_scale_shuffle_k4(i), get_scale_shuffle_k4(i + 1));
+}
+
+// multiply the int16_t products with their int16_t scales, add the results pairwise and accumulate them in sumi
+static inline __m512i mul_add_scales_512(const __m512i sumi, const __m512i scales, const __m512i p16) {
+#if defined __AVX512VNNI__
+    return _mm512_dpwssd_epi32(sumi, scales, p16);
+#else
+    return _mm512_add_epi32(sumi, _mm512_madd_epi16(scales, p16));
+#endif
+}
+#endif
+
 #if QK_K == 256
 void ggml_vec_dot_q2_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
 
@@ -1891,6 +2004,79 @@ void ggml_vec_dot_q3_K_q8_K(const int n, float * restrict s, const void * restri
 
     *s = sum;
 
+#elif defined __AVX512BW__
+
+    const __m512i m3 = _mm512_set1_epi8(3);
+    const __m512i m4 = _mm512_set1_epi8(4);
+    const __m128i m32 = _mm_set1_epi8(32);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    uint32_t aux[3];
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float d = y[i].d * ggml_fp16_to_fp32(x[i].d);
+
+        const uint8_t * restrict q3 = x[i].qs;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        // Set up scales
+        memcpy(aux, x[i].scales, 12);
+        __m128i scales128 = _mm_set_epi32(
+                ((aux[1] >> 4) & kmask2) | (((aux[2] >> 6) & kmask1) << 4),
+                ((aux[0] >> 4) & kmask2) | (((aux[2] >> 4) & kmask1) << 4),
+                (aux[1] & kmask2) | (((aux[2] >> 2) & kmask1) << 4),
+                (aux[0] & kmask2) | (((aux[2] >> 0) & kmask1) << 4));
+        scales128 = _mm_sub_epi8(scales128, m32);
+        const __m256i all_scales = _mm256_cvtepi8_epi16(scales128);
+        const __m512i scales[2] = {_mm512_broadcast_i32x4(_mm256_extracti128_si256(all_scales, 0)),
+                                   _mm512_broadcast_i32x4(_mm256_extracti128_si256(all_scales, 1))};
+
+        // high bit, the same 32 bytes in both halves
+        const __m256i hbits256 = _mm256_loadu_si256((const __m256i*)x[i].hmask);
+        const __m512i hbits = concat_256_512(hbits256, hbits256);
+
+        // the bits of hbits used by the low and high halves of the quants
+        __m512i hmask_01 = concat_256_512(_mm256_set1_epi8(1), _mm256_set1_epi8(2));
+        __m512i hmask_23 = concat_256_512(_mm256_set1_epi8(4), _mm256_set1_epi8(8));
+
+        // integer accumulator
+        __m512i sumi = _mm512_setzero_si512();
+
+        for (int j = 0; j < QK_K/128; ++j) {
+            // load low 2 bits
+            const __m256i q3bits = _mm256_loadu_si256((const __m256i*)q3); q3 += 32;
+
+            // prepare low and high bits, the high bit part is 4 if the high bit is not set
+            const __m512i q3l_01 = _mm512_and_si512(concat_256_512(q3bits, _mm256_srli_epi16(q3bits, 2)), m3);
+            const __m512i q3l_23 = _mm512_and_si512(concat_256_512(_mm256_srli_epi16(q3bits, 4), _mm256_srli_epi16(q3bits, 6)), m3);
+
+            const __m512i q3h_01 = _mm512_maskz_mov_epi8(_mm512_testn_epi8_mask(hbits, hmask_01), m4);
+            const __m512i q3h_23 = _mm512_maskz_mov_epi8(_mm512_testn_epi8_mask(hbits, hmask_23), m4);
+            hmask_01 = _mm512_slli_epi16(hmask_01, 4);
+            hmask_23 = _mm512_slli_epi16(hmask_23, 4);
+
+            // load Q8 quants
+            const __m512i q8_01 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+            const __m512i q8_23 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            const __m512i p16_01 = _mm512_sub_epi16(_mm512_maddubs_epi16(q3l_01, q8_01), _mm512_maddubs_epi16(q3h_01, q8_01));
+            const __m512i p16_23 = _mm512_sub_epi16(_mm512_maddubs_epi16(q3l_23, q8_23), _mm512_maddubs_epi16(q3h_23, q8_23));
+
+            // multiply with scales and accumulate
+            sumi = mul_add_scales_512(sumi, _mm512_shuffle_epi8(scales[j], get_scale_shuffle_q3k_512(0)), p16_01);
+            sumi = mul_add_scales_512(sumi, _mm512_shuffle_epi8(scales[j], get_scale_shuffle_q3k_512(2)), p16_23);
+
+        }
+
+        // multiply with block scale and accumulate
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(sumi), acc);
+
+    }
+
+    *s = _mm512_reduce_add_ps(acc);
+
 #elif defined __AVX2__
 
     const __m256i m3 = _mm256_set1_epi8(3);
@@ -3021,6 +3207,110 @@ void ggml_vec_dot_q4_K_q8_K(const int n, float * restrict s, const void * restri
 }
 #endif
 
+// Same as ggml_vec_dot_q4_K_q8_K for the 4 rows of y that are by bytes apart,
+// with each block of x decoded once
+void ggml_vec_dot_q4_K_q8_K_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by) {
+#if defined __AVX2__ && QK_K == 256
+    assert(n % QK_K == 0);
+
+    const block_q4_K * restrict x = vx;
+    const block_q8_K * restrict y[4];
+
+    const int nb = n / QK_K;
+
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    uint32_t utmp[4];
+
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+
+    __m256 acc[4];
+    __m128 acc_m[4];
+
+    for (int k = 0; k < 4; ++k) {
+        y[k] = (const block_q8_K *)((const char *)vy + k*by);
+        acc[k] = _mm256_setzero_ps();
+        acc_m[k] = _mm_setzero_ps();
+    }
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float dx = ggml_fp16_to_fp32(x[i].d);
+        const float dminx = ggml_fp16_to_fp32(x[i].dmin);
+
+        memcpy(utmp, x[i].scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+        const uint32_t uaux = utmp[1] & kmask1;
+        utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= kmask1;
+
+        const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+        for (int k = 0; k < 4; ++k) {
+            const float dmin = -y[k][i].d * dminx;
+            const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[k][i].bsums);
+            const __m128i q8s = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+            const __m128i prod = _mm_madd_epi16(_mm256_extracti128_si256(mins_and_scales, 1), q8s);
+            acc_m[k] = _mm_fmadd_ps(_mm_set1_ps(dmin), _mm_cvtepi32_ps(prod), acc_m[k]);
+        }
+
+        const __m128i sc128  = _mm256_extracti128_si256(mins_and_scales, 0);
+        const __m256i scales = MM256_SET_M128I(sc128, sc128);
+
+        const uint8_t * restrict q4 = x[i].qs;
+
+        __m256i sumi[4];
+        for (int k = 0; k < 4; ++k) {
+            sumi[k] = _mm256_setzero_si256();
+        }
+
+        for (int j = 0; j < QK_K/64; ++j) {
+
+            const __m256i scale_l = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+0));
+            const __m256i scale_h = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+1));
+
+            const __m256i q4bits = _mm256_loadu_si256((const __m256i*)q4); q4 += 32;
+            const __m256i q4l = _mm256_and_si256(q4bits, m4);
+            const __m256i q4h = _mm256_and_si256(_mm256_srli_epi16(q4bits, 4), m4);
+
+            for (int k = 0; k < 4; ++k) {
+                const int8_t * restrict q8 = y[k][i].qs + 64*j;
+
+                const __m256i q8l = _mm256_loadu_si256((const __m256i*)q8);
+                __m256i p16l = _mm256_maddubs_epi16(q4l, q8l);
+                p16l = _mm256_madd_epi16(scale_l, p16l);
+                sumi[k] = _mm256_add_epi32(sumi[k], p16l);
+
+                const __m256i q8h = _mm256_loadu_si256((const __m256i*)(q8 + 32));
+                __m256i p16h = _mm256_maddubs_epi16(q4h, q8h);
+                p16h = _mm256_madd_epi16(scale_h, p16h);
+                sumi[k] = _mm256_add_epi32(sumi[k], p16h);
+            }
+        }
+
+        for (int k = 0; k < 4; ++k) {
+            __m256 vd = _mm256_set1_ps(y[k][i].d * dx);
+            acc[k] = _mm256_fmadd_ps(vd, _mm256_cvtepi32_ps(sumi[k]), acc[k]);
+        }
+
+    }
+
+    for (int k = 0; k < 4; ++k) {
+        acc_m[k] = _mm_add_ps(acc_m[k], _mm_movehl_ps(acc_m[k], acc_m[k]));
+        acc_m[k] = _mm_add_ss(acc_m[k], _mm_movehdup_ps(acc_m[k]));
+
+        s[k] = hsum_float_8(acc[k]) + _mm_cvtss_f32(acc_m[k]);
+    }
+#else
+    for (int k = 0; k < 4; ++k) {
+        ggml_vec_dot_q4_K_q8_K(n, s + k, vx, (const char *)vy + k*by);
+    }
+#endif
+}
+
 #if QK_K == 256
 void ggml_vec_dot_q5_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
     assert(n % QK_K == 0);
@@ -3123,6 +3413,71 @@ void ggml_vec_dot_q5_K_q8_K(const int n, float * restrict s, const void * restri
 
     *s = sumf;
 
+#elif defined __AVX512BW__
+
+    const __m512i m4 = _mm512_set1_epi8(0xF);
+    const __m512i m16 = _mm512_set1_epi8(16);
+    const __m128i mzero = _mm_setzero_si128();
+
+    __m512 acc = _mm512_setzero_ps();
+
+    float summs = 0.f;
+
+    for (int i = 0; i < nb; ++i) {
+
+        const uint8_t * restrict q5 = x[i].qs;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        const float d = y[i].d * ggml_fp16_to_fp32(x[i].d);
+        const float dmin = -y[i].d * ggml_fp16_to_fp32(x[i].dmin);
+
+        memcpy(utmp, x[i].scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+        const uint32_t uaux = utmp[1] & kmask1;
+        utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= kmask1;
+
+        const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+        const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[i].bsums);
+        const __m128i q8s = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+        const __m128i prod = _mm_madd_epi16(_mm256_extracti128_si256(mins_and_scales, 1), q8s);
+        const __m128i hsum = _mm_hadd_epi32(_mm_hadd_epi32(prod, mzero), mzero);
+        summs += dmin * _mm_extract_epi32(hsum, 0);
+
+        const __m512i scales = _mm512_broadcast_i32x4(_mm256_extracti128_si256(mins_and_scales, 0));
+
+        // high bits, the same 32 bytes in both halves
+        const __m256i hbits256 = _mm256_loadu_si256((const __m256i*)x[i].qh);
+        const __m512i hbits = concat_256_512(hbits256, hbits256);
+
+        // the bits of hbits used by the low and high halves of the quants
+        __m512i hmask = concat_256_512(_mm256_set1_epi8(1), _mm256_set1_epi8(2));
+
+        __m512i sumi = _mm512_setzero_si512();
+
+        for (int j = 0; j < QK_K/64; ++j) {
+
+            // low nibbles in the low half, high nibbles in the high half, plus 16 where the high bit is set
+            const __m256i q5bits = _mm256_loadu_si256((const __m256i*)q5); q5 += 32;
+            __m512i q5x = _mm512_and_si512(concat_256_512(q5bits, _mm256_srli_epi16(q5bits, 4)), m4);
+            q5x = _mm512_mask_add_epi8(q5x, _mm512_test_epi8_mask(hbits, hmask), q5x, m16);
+            hmask = _mm512_slli_epi16(hmask, 2);
+
+            const __m512i q8x = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            const __m512i p16 = _mm512_maddubs_epi16(q5x, q8x);
+            sumi = mul_add_scales_512(sumi, _mm512_shuffle_epi8(scales, get_scale_shuffle_k4_512(2*j)), p16);
+
+        }
+
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(sumi), acc);
+
+    }
+
+    *s = _mm512_reduce_add_ps(acc) + summs;
+
 #elif defined __AVX2__
 
     const __m256i m4 = _mm256_set1_epi8(0xF);
@@ -3590,6 +3945,125 @@ void ggml_vec_dot_q5_K_q8_K(const int n, float * restrict s, const void * restri
 #endif
 
 
+// Same as ggml_vec_dot_q5_K_q8_K for the 4 rows of y that are by bytes apart,
+// with each block of x decoded once. This is the AVX2 kernel also in AVX-512
+// builds, where it beats 4 calls to the 512-bit one but may round differently.
+void ggml_vec_dot_q5_K_q8_K_x4(const int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by) {
+#if defined __AVX2__ && QK_K == 256
+    assert(n % QK_K == 0);
+
+    const block_q5_K * restrict x = vx;
+    const block_q8_K * restrict y[4];
+
+    const int nb = n / QK_K;
+
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    uint32_t utmp[4];
+
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+    const __m128i mzero = _mm_setzero_si128();
+    const __m256i mone  = _mm256_set1_epi8(1);
+
+    __m256 acc[4];
+    float summs[4];
+
+    for (int k = 0; k < 4; ++k) {
+        y[k] = (const block_q8_K *)((const char *)vy + k*by);
+        acc[k] = _mm256_setzero_ps();
+        summs[k] = 0.f;
+    }
+
+    for (int i = 0; i < nb; ++i) {
+
+        const uint8_t * restrict q5 = x[i].qs;
+
+        const float dx = ggml_fp16_to_fp32(x[i].d);
+        const float dminx = ggml_fp16_to_fp32(x[i].dmin);
+
+        memcpy(utmp, x[i].scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+        const uint32_t uaux = utmp[1] & kmask1;
+        utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= kmask1;
+
+        const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+        for (int k = 0; k < 4; ++k) {
+            const float dmin = -y[k][i].d * dminx;
+            const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[k][i].bsums);
+            const __m128i q8s = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+            const __m128i prod = _mm_madd_epi16(_mm256_extracti128_si256(mins_and_scales, 1), q8s);
+            const __m128i hsum = _mm_hadd_epi32(_mm_hadd_epi32(prod, mzero), mzero);
+            summs[k] += dmin * _mm_extract_epi32(hsum, 0);
+        }
+
+        const __m128i sc128  = _mm256_extracti128_si256(mins_and_scales, 0);
+        const __m256i scales = MM256_SET_M128I(sc128, sc128);
+
+        const __m256i hbits = _mm256_loadu_si256((const __m256i*)x[i].qh);
+        __m256i hmask = mone;
+
+        __m256i sumi[4];
+        for (int k = 0; k < 4; ++k) {
+            sumi[k] = _mm256_setzero_si256();
+        }
+
+        int bit = 0;
+
+        for (int j = 0; j < QK_K/64; ++j) {
+
+            const __m256i scale_0 = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+0));
+            const __m256i scale_1 = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+1));
+
+            const __m256i q5bits = _mm256_loadu_si256((const __m256i*)q5); q5 += 32;
+
+            const __m256i q5l_0 = _mm256_and_si256(q5bits, m4);
+            const __m256i q5h_0 = _mm256_slli_epi16(_mm256_srli_epi16(_mm256_and_si256(hbits, hmask), bit++), 4);
+            const __m256i q5_0  = _mm256_add_epi8(q5l_0, q5h_0);
+            hmask = _mm256_slli_epi16(hmask, 1);
+
+            const __m256i q5l_1 = _mm256_and_si256(_mm256_srli_epi16(q5bits, 4), m4);
+            const __m256i q5h_1 = _mm256_slli_epi16(_mm256_srli_epi16(_mm256_and_si256(hbits, hmask), bit++), 4);
+            const __m256i q5_1  = _mm256_add_epi8(q5l_1, q5h_1);
+            hmask = _mm256_slli_epi16(hmask, 1);
+
+            for (int k = 0; k < 4; ++k) {
+                const int8_t * restrict q8 = y[k][i].qs + 64*j;
+
+                const __m256i q8_0 = _mm256_loadu_si256((const __m256i*)q8);
+                const __m256i q8_1 = _mm256_loadu_si256((const __m256i*)(q8 + 32));
+
+                __m256i p16_0 = _mm256_maddubs_epi16(q5_0, q8_0);
+                __m256i p16_1 = _mm256_maddubs_epi16(q5_1, q8_1);
+
+                p16_0 = _mm256_madd_epi16(scale_0, p16_0);
+                p16_1 = _mm256_madd_epi16(scale_1, p16_1);
+
+                sumi[k] = _mm256_add_epi32(sumi[k], _mm256_add_epi32(p16_0, p16_1));
+            }
+        }
+
+        for (int k = 0; k < 4; ++k) {
+            __m256 vd = _mm256_set1_ps(y[k][i].d * dx);
+            acc[k] = _mm256_fmadd_ps(vd, _mm256_cvtepi32_ps(sumi[k]), acc[k]);
+        }
+
+    }
+
+    for (int k = 0; k < 4; ++k) {
+        s[k] = hsum_float_8(acc[k]) + summs[k];
+    }
+#else
+    for (int k = 0; k < 4; ++k) {
+        ggml_vec_dot_q5_K_q8_K(n, s + k, vx, (const char *)vy + k*by);
+    }
+#endif
+}
+
 #if QK_K == 256
 void ggml_vec_dot_q6_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
     assert(n % QK_K == 0);
@@ -3736,6 +4210,61 @@ void ggml_vec_dot_q6_K_q8_K(const int n, float * restrict s, const void * restri
     }
     *s = sum;
 
+#elif defined __AVX512BW__
+
+    const __m512i m4 = _mm512_set1_epi8(0xF);
+    const __m512i m2 = _mm512_set1_epi8(3);
+    const __m512i m32s = _mm512_set1_epi8(32);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float d = y[i].d * ggml_fp16_to_fp32(x[i].d);
+
+        const uint8_t * restrict q4 = x[i].ql;
+        const uint8_t * restrict qh = x[i].qh;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        const __m128i scales = _mm_loadu_si128((const __m128i*)x[i].scales);
+
+        __m512i sumi = _mm512_setzero_si512();
+
+        int is = 0;
+
+        for (int j = 0; j < QK_K/128; ++j) {
+
+            const __m128i scale_0 = _mm_shuffle_epi8(scales, get_scale_shuffle(is + 0));
+            const __m128i scale_1 = _mm_shuffle_epi8(scales, get_scale_shuffle(is + 1));
+            const __m128i scale_2 = _mm_shuffle_epi8(scales, get_scale_shuffle(is + 2));
+            const __m128i scale_3 = _mm_shuffle_epi8(scales, get_scale_shuffle(is + 3));
+            is += 4;
+
+            const __m512i q4bits  = _mm512_loadu_si512((const __m512i*)q4); q4 += 64;
+            const __m256i q4bitsH = _mm256_loadu_si256((const __m256i*)qh); qh += 32;
+
+            const __m512i q4h_01 = _mm512_slli_epi16(_mm512_and_si512(concat_256_512(q4bitsH, _mm256_srli_epi16(q4bitsH, 2)), m2), 4);
+            const __m512i q4h_23 = _mm512_slli_epi16(_mm512_and_si512(concat_256_512(_mm256_srli_epi16(q4bitsH, 4), _mm256_srli_epi16(q4bitsH, 6)), m2), 4);
+
+            const __m512i q4_01 = _mm512_or_si512(_mm512_and_si512(q4bits, m4), q4h_01);
+            const __m512i q4_23 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(q4bits, 4), m4), q4h_23);
+
+            const __m512i q8_01 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+            const __m512i q8_23 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            const __m512i p16_01 = _mm512_sub_epi16(_mm512_maddubs_epi16(q4_01, q8_01), _mm512_maddubs_epi16(m32s, q8_01));
+            const __m512i p16_23 = _mm512_sub_epi16(_mm512_maddubs_epi16(q4_23, q8_23), _mm512_maddubs_epi16(m32s, q8_23));
+
+            sumi = mul_add_scales_512(sumi, _mm512_cvtepi8_epi16(MM256_SET_M128I(scale_1, scale_0)), p16_01);
+            sumi = mul_add_scales_512(sumi, _mm512_cvtepi8_epi16(MM256_SET_M128I(scale_3, scale_2)), p16_23);
+
+        }
+
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(sumi), acc);
+    }
+
+    *s = _mm512_reduce_add_ps(acc);
+
 #elif defined __AVX2__
 
     const __m256i m4 = _mm256_set1_epi8(0xF);
@@ -23,6 +23,46 @@
 #endif
 #endif
 
+// GGML_CPU_VARIANT builds (see ggml.c) compile this file again for one instruction set
+// and give its functions the variant as suffix
+#ifdef GGML_CPU_VARIANT
+#ifndef GGML_CPU_FN
+#define GGML_CPU_CONCAT(name, variant) name ## _ ## variant
+#define GGML_CPU_NAME(name, variant) GGML_CPU_CONCAT(name, variant)
+#define GGML_CPU_FN(name) GGML_CPU_NAME(name, GGML_CPU_VARIANT)
+#endif
+#define quantize_row_q2_K_reference GGML_CPU_FN(quantize_row_q2_K_reference)
+#define quantize_row_q3_K_reference GGML_CPU_FN(quantize_row_q3_K_reference)
+#define quantize_row_q4_K_reference GGML_CPU_FN(quantize_row_q4_K_reference)
+#define quantize_row_q5_K_reference GGML_CPU_FN(quantize_row_q5_K_reference)
+#define quantize_row_q6_K_reference GGML_CPU_FN(quantize_row_q6_K_reference)
+#define quantize_row_q8_K_reference GGML_CPU_FN(quantize_row_q8_K_reference)
+#define quantize_row_q2_K           GGML_CPU_FN(quantize_row_q2_K)
+#define quantize_row_q3_K           GGML_CPU_FN(quantize_row_q3_K)
+#define quantize_row_q4_K           GGML_CPU_FN(quantize_row_q4_K)
+#define quantize_row_q5_K           GGML_CPU_FN(quantize_row_q5_K)
+#define quantize_row_q6_K           GGML_CPU_FN(quantize_row_q6_K)
+#define quantize_row_q8_K           GGML_CPU_FN(quantize_row_q8_K)
+#define dequantize_row_q2_K         GGML_CPU_FN(dequantize_row_q2_K)
+#define dequantize_row_q3_K         GGML_CPU_FN(dequantize_row_q3_K)
+#define dequantize_row_q4_K         GGML_CPU_FN(dequantize_row_q4_K)
+#define dequantize_row_q5_K         GGML_CPU_FN(dequantize_row_q5_K)
+#define dequantize_row_q6_K         GGML_CPU_FN(dequantize_row_q6_K)
+#define dequantize_row_q8_K         GGML_CPU_FN(dequantize_row_q8_K)
+#define ggml_vec_dot_q2_K_q8_K      GGML_CPU_FN(ggml_vec_dot_q2_K_q8_K)
+#define ggml_vec_dot_q3_K_q8_K      GGML_CPU_FN(ggml_vec_dot_q3_K_q8_K)
+#define ggml_vec_dot_q4_K_q8_K      GGML_CPU_FN(ggml_vec_dot_q4_K_q8_K)
+#define ggml_vec_dot_q5_K_q8_K      GGML_CPU_FN(ggml_vec_dot_q5_K_q8_K)
+#define ggml_vec_dot_q6_K_q8_K      GGML_CPU_FN(ggml_vec_dot_q6_K_q8_K)
+#define ggml_vec_dot_q4_K_q8_K_x4   GGML_CPU_FN(ggml_vec_dot_q4_K_q8_K_x4)
+#define ggml_vec_dot_q5_K_q8_K_x4   GGML_CPU_FN(ggml_vec_dot_q5_K_q8_K_x4)
+#define ggml_quantize_q2_K          GGML_CPU_FN(ggml_quantize_q2_K)
+#define ggml_quantize_q3_K          GGML_CPU_FN(ggml_quantize_q3_K)
+#define ggml_quantize_q4_K          GGML_CPU_FN(ggml_quantize_q4_K)
+#define ggml_quantize_q5_K          GGML_CPU_FN(ggml_quantize_q5_K)
+#define ggml_quantize_q6_K          GGML_CPU_FN(ggml_quantize_q6_K)
+#endif
+
 //
 // Super-block quantization structures
 //
@@ -156,6 +196,9 @@ void ggml_vec_dot_q4_K_q8_K(int n, float * restrict s, const void * restrict vx,
 void ggml_vec_dot_q5_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 void ggml_vec_dot_q6_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 
+void ggml_vec_dot_q4_K_q8_K_x4(int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by);
+void ggml_vec_dot_q5_K_q8_K_x4(int n, float * restrict s, const void * restrict vx, const void * restrict vy, size_t by);
+
 // Quantization with histogram collection
 size_t ggml_quantize_q2_K(const float * src, void * dst, int n, int k, int64_t * hist);
 size_t ggml_quantize_q3_K(const float * src, void * dst, int n, int k, int64_t * hist);
@@ -548,6 +548,9 @@ struct falcon_context {
   // input embedding (1-dimensional array: [n_embd])
   std::vector<float> embedding;
 
+  // worker threads for `struct ggml_graph_plan.threadpool` (not owned)
+  ggml_threadpool* threadpool = NULL;
+
   // memory buffers used to evaluate the model
   // TODO: move in llama_state
   llama_ctx_buffer buf_compute;
@@ -2123,6 +2126,7 @@ static bool falcon_eval_internal(falcon_context& lctx,
       struct ggml_tensor* KQ = ggml_mul_mat(ctx0, K, Q);
       ggml_set_name(KQ, "KQ");
 
+#ifdef GGML_USE_METAL
       // KQ_scaled = KQ / sqrt(n_embd/n_head)
       struct ggml_tensor* KQ_scaled = ggml_scale_inplace(
           ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(head_dim))));
@@ -2135,6 +2139,11 @@ static bool falcon_eval_internal(falcon_context& lctx,
 
       // KQ = soft_max(KQ_masked)
       struct ggml_tensor* KQ_soft_max = ggml_soft_max_inplace(ctx0, KQ_masked);
+#else
+      // KQ = soft_max(mask_past(KQ / sqrt(n_embd/n_head)))
+      struct ggml_tensor* KQ_soft_max = ggml_soft_max_ext_inplace(
+          ctx0, KQ, 1.0f / sqrtf(float(head_dim)), n_past, 0.0f);
+#endif
       ggml_set_name(KQ_soft_max, "KQ_soft_max");
 
 // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0,
@@ -2294,10 +2303,12 @@ static bool falcon_eval_internal(falcon_context& lctx,
       ggml_metal_get_tensor(lctx.ctx_metal, kv_self.v);
     }
 
-    ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+    ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads,
+                                           lctx.threadpool);
   }
 #else
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads,
+                                         lctx.threadpool);
 #endif
   model.lm_head->backend = lm_head_backend;
   if (cgraph_fname) {
@@ -4337,6 +4348,11 @@ bool falcon_save_session_file(struct falcon_context* ctx,
   return true;
 }
 
+void falcon_set_threadpool(struct falcon_context* ctx,
+                           struct ggml_threadpool* threadpool) {
+  ctx->threadpool = threadpool;
+}
+
 int falcon_eval(struct falcon_context* ctx, const falcon_token* tokens,
                 int n_tokens, int n_past, int n_threads, int debug_timings) {
   //  fprintf(stderr, "falcon_eval: n_tokens=%d, n_past=%d, n_threads=%d\n",
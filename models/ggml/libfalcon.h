@@ -180,6 +180,12 @@ LLAMA_API bool falcon_save_session_file(struct falcon_context *ctx,
                                         const falcon_token *tokens,
                                         size_t n_token_count);
 
+// Use persistent worker threads for falcon_eval() instead of creating threads
+// for every call. The thread pool is not owned by the context and must have at
+// least n_threads threads.
+LLAMA_API void falcon_set_threadpool(struct falcon_context *ctx,
+                                     struct ggml_threadpool *threadpool);
+
 // Run the llama inference to obtain the logits and probabilities for the next
 // token. tokens + n_tokens is the provided batch of new tokens to process
 // n_past is the number of tokens to use from previous eval calls
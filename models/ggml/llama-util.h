@@ -16,6 +16,8 @@
 #include <vector>
 #include <stdexcept>
 
+#include "ggml.h"
+
 #ifdef __has_include
     #if __has_include(<unistd.h>)
         #include <unistd.h>
@@ -491,6 +493,32 @@ struct llama_buffer {
     llama_buffer& operator=(llama_buffer&&) = delete;
 };
 
+// memory that is only backed by physical pages once it is written, see
+// ggml_lazy_alloc
+struct llama_lazy_buffer {
+    uint8_t * addr = NULL;
+    size_t size = 0;
+
+    llama_lazy_buffer() = default;
+
+    void resize(size_t len) {
+        ggml_lazy_free(addr, size);
+        addr = (uint8_t *) ggml_lazy_alloc(len);
+        size = addr ? len : 0;
+    }
+
+    ~llama_lazy_buffer() {
+        ggml_lazy_free(addr, size);
+        addr = NULL;
+    }
+
+    // disable copy and move
+    llama_lazy_buffer(const llama_lazy_buffer&) = delete;
+    llama_lazy_buffer(llama_lazy_buffer&&) = delete;
+    llama_lazy_buffer& operator=(const llama_lazy_buffer&) = delete;
+    llama_lazy_buffer& operator=(llama_lazy_buffer&&) = delete;
+};
+
 #ifdef GGML_USE_CUBLAS
 #include "ggml-cuda.h"
 struct llama_ctx_buffer {
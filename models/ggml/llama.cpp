@@ -92,8 +92,10 @@ void llama_nop(struct ggml_tensor *tensor) {  // don't offload by default
 //
 
 static void ggml_graph_compute_helper(std::vector<uint8_t> &buf,
-                                      ggml_cgraph *graph, int n_threads) {
+                                      ggml_cgraph *graph, int n_threads,
+                                      ggml_threadpool *threadpool = nullptr) {
   struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+  plan.threadpool = threadpool;
 
   if (plan.work_size > 0) {
     buf.resize(plan.work_size);
@@ -225,15 +227,30 @@ struct llama_layer {
   struct ggml_tensor *w1;
   struct ggml_tensor *w2;
   struct ggml_tensor *w3;
+
+  // the rows of wq, wk, wv and of w1, w3 in single tensors, when fused
+  // the separate tensors are views of them
+  struct ggml_tensor *wqkv = NULL;
+  struct ggml_tensor *w13 = NULL;
 };
 
 struct llama_kv_cache {
   struct ggml_tensor *k = NULL;
   struct ggml_tensor *v = NULL;
 
+  // whether V is stored transposed instead of by rows like K, see
+  // kv_cache_init
+  bool v_trans = true;
+
   struct ggml_context *ctx = NULL;
 
+  // the GPU backends pin or map the memory of the cache, on the CPU it is only
+  // backed as tokens are stored
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_METAL)
   llama_ctx_buffer buf;
+#else
+  llama_lazy_buffer buf;
+#endif
 
   int n;  // number of tokens currently in the cache
 
@@ -284,9 +301,17 @@ struct llama_model {
   // model memory mapped file
   std::unique_ptr<llama_mmap> mapping;
 
+  // the data of the fused weights when the model is memory mapped
+  llama_buffer fused_buf;
+
+  // the data of the repacked weights when the model is memory mapped
+  llama_buffer repacked_buf;
+
   // objects representing data potentially being locked in memory
   llama_mlock mlock_buf;
   llama_mlock mlock_mmap;
+  llama_mlock mlock_fused;
+  llama_mlock mlock_repacked;
 
   // for quantize-stats only
   std::vector<std::pair<std::string, struct ggml_tensor *>> tensors_by_name;
@@ -370,6 +395,9 @@ struct llama_context {
   // reusable buffer for `struct ggml_graph_plan.work_data`
   std::vector<uint8_t> work_buffer;
 
+  // worker threads for `struct ggml_graph_plan.threadpool` (not owned)
+  ggml_threadpool *threadpool = NULL;
+
   // memory buffers used to evaluate the model
   // TODO: move in llama_state
   llama_ctx_buffer buf_compute;
@@ -699,6 +727,13 @@ struct llama_model_loader {
   struct ggml_context *ggml_ctx = NULL;
   std::unique_ptr<llama_mmap> mapping;
 
+  // tensors created by get_fused_tensor()
+  struct llama_fused_tensor {
+    struct ggml_tensor *tensor;
+    std::vector<struct ggml_tensor *> parts;
+  };
+  std::vector<llama_fused_tensor> fused_tensors;
+
   llama_model_loader(const std::string &fname_base, bool use_mmap) {
     file_loader = std::unique_ptr<llama_file_loader>(
         new llama_file_loader(fname_base.c_str(), tensors_map));
@@ -761,6 +796,152 @@ struct llama_model_loader {
     return tensor;
   }
 
+  // Creates a tensor with the rows of the named tensors one after another and
+  // makes the named tensors views of it. Returns NULL if the tensors can't be
+  // fused.
+  struct ggml_tensor *get_fused_tensor(
+      const std::vector<std::string> &names,
+      const std::vector<std::vector<uint32_t>> &nes,
+      std::vector<struct ggml_tensor *> &parts) {
+    std::vector<llama_load_tensor *> lts;
+    uint32_t n_rows = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+      auto it = tensors_map.name_to_idx.find(names[i]);
+      if (it == tensors_map.name_to_idx.end()) {
+        return NULL;
+      }
+      llama_load_tensor &lt = tensors_map.tensors.at(it->second);
+      if (lt.ne != nes[i] || (!lts.empty() && lt.type != lts[0]->type)) {
+        return NULL;
+      }
+      lts.push_back(&lt);
+      n_rows += lt.ne.at(1);
+    }
+
+    const llama_load_tensor &first = *lts.at(0);
+    struct ggml_tensor *fused =
+        ggml_new_tensor_2d(ggml_ctx, first.type, first.ne.at(0), n_rows);
+    fused->backend = GGML_BACKEND_CPU;
+
+    size_t offset = 0;
+    parts.clear();
+    for (llama_load_tensor *lt : lts) {
+      LLAMA_ASSERT(lt->ggml_tensor == NULL);
+      struct ggml_tensor *part = ggml_view_2d(
+          ggml_ctx, fused, lt->ne.at(0), lt->ne.at(1), fused->nb[1], offset);
+      ggml_set_name(part, lt->name.c_str());
+      part->backend = GGML_BACKEND_CPU;
+      lt->ggml_tensor = part;
+      num_ggml_tensors_created++;
+      parts.push_back(part);
+      offset += ggml_nbytes(part);
+    }
+
+    fused_tensors.push_back({fused, parts});
+    return fused;
+  }
+
+  // Copies the parts of the fused tensors from the memory mapped file to `buf`
+  // and points them to the copy. Without mmap, the parts are loaded in place.
+  void load_fused_data(llama_buffer &buf, llama_mlock *lmlock) {
+    if (!use_mmap || fused_tensors.empty()) {
+      return;
+    }
+
+    size_t size = 0;
+    for (const llama_fused_tensor &ft : fused_tensors) {
+      size += ggml_nbytes(ft.tensor);
+    }
+    buf.resize(size);
+    if (lmlock) {
+      lmlock->init(buf.addr);
+      lmlock->grow_to(buf.size);
+    }
+
+    uint8_t *data = buf.addr;
+    for (const llama_fused_tensor &ft : fused_tensors) {
+      ft.tensor->data = data;
+      for (struct ggml_tensor *part : ft.parts) {
+        memcpy(data, part->data, ggml_nbytes(part));
+        part->data = data;
+        data += ggml_nbytes(part);
+      }
+    }
+  }
+
+  // Interleaves the rows of the given weights, see ggml_repack, and changes
+  // their types and the types of their views (the other tensors of each
+  // entry). Weights in the memory mapped file are repacked into `buf`, the
+  // others in place.
+  void repack_data(
+      const std::vector<std::vector<struct ggml_tensor *>> &weights,
+      llama_buffer &buf, llama_mlock *lmlock) {
+    std::vector<const std::vector<struct ggml_tensor *> *> repacked;
+    size_t size = 0;
+    for (const std::vector<struct ggml_tensor *> &tensors : weights) {
+      if (!can_repack(tensors)) {
+        continue;
+      }
+      repacked.push_back(&tensors);
+      if (is_mapped(tensors[0])) {
+        size += ggml_nbytes(tensors[0]);
+      }
+    }
+    if (repacked.empty()) {
+      return;
+    }
+
+    buf.resize(size);
+    if (lmlock && size > 0) {
+      lmlock->init(buf.addr);
+      lmlock->grow_to(buf.size);
+    }
+
+    uint8_t *data = buf.addr;
+    for (const std::vector<struct ggml_tensor *> *tensors : repacked) {
+      struct ggml_tensor *weight = tensors->at(0);
+      uint8_t *src = (uint8_t *)weight->data;
+      uint8_t *dst = src;
+      if (is_mapped(weight)) {
+        dst = data;
+        data += ggml_nbytes(weight);
+      }
+      ggml_repack(weight->type, src, dst, weight->ne[1], weight->ne[0]);
+
+      const ggml_type type = ggml_repack_type(weight->type);
+      for (struct ggml_tensor *tensor : *tensors) {
+        tensor->data = dst + ((uint8_t *)tensor->data - src);
+        tensor->type = type;
+      }
+    }
+  }
+
+  static bool can_repack(const std::vector<struct ggml_tensor *> &tensors) {
+    const struct ggml_tensor *weight = tensors.at(0);
+    if (weight->backend != GGML_BACKEND_CPU ||
+        ggml_repack_type(weight->type) == GGML_TYPE_COUNT ||
+        !ggml_is_contiguous(weight) || weight->ne[2] != 1) {
+      return false;
+    }
+    // the views must start and end at a group of rows
+    const int nrows = ggml_repack_nrows(weight->type);
+    for (const struct ggml_tensor *tensor : tensors) {
+      if (tensor->ne[1] % nrows != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool is_mapped(const struct ggml_tensor *tensor) const {
+    if (!mapping) {
+      return false;
+    }
+    const uint8_t *addr = (const uint8_t *)mapping->addr;
+    const uint8_t *data = (const uint8_t *)tensor->data;
+    return data >= addr && data < addr + mapping->size;
+  }
+
   void done_getting_tensors() const {
     if (num_ggml_tensors_created != tensors_map.tensors.size()) {
       throw std::runtime_error(
@@ -867,6 +1048,27 @@ struct llama_model_loader {
 // kv cache
 //
 
+// a quantized cache is only read by ggml_flash_attn_ext, which needs the
+// attention on the CPU and the heads to be whole pairs of quantized blocks
+static bool llama_kv_can_quantize(const struct llama_hparams &hparams,
+                                  ggml_type wtype, int n_gpu_layers) {
+  if (hparams.n_embd_head() % (2 * ggml_blck_size(wtype)) != 0) {
+    return false;
+  }
+  (void)n_gpu_layers;
+#if defined(GGML_USE_METAL)
+  return false;
+#elif defined(GGML_USE_CUBLAS)
+  return n_gpu_layers <= (int)hparams.n_layer + 1;
+#else
+  return true;
+#endif
+}
+
+// Values are stored by rows like the keys when the attention is computed by
+// ggml_flash_attn_ext, so that the tokens in use take up a prefix of each
+// layer. The separate attention ops of the GPU backends read F32 and F16 values
+// transposed.
 static bool kv_cache_init(const struct llama_hparams &hparams,
                           struct llama_kv_cache &cache, ggml_type wtype,
                           int n_ctx, int n_gpu_layers) {
@@ -876,8 +1078,18 @@ static bool kv_cache_init(const struct llama_hparams &hparams,
   const int64_t n_mem = n_layer * n_ctx;
   const int64_t n_elements = n_embd * n_mem;
 
-  cache.buf.resize(2u * n_elements * ggml_type_size(wtype) + 2u * MB);
+  cache.buf.resize(2u * n_mem * ggml_row_size(wtype, n_embd) + 2u * MB);
   cache.n = 0;
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_METAL)
+  cache.v_trans = !ggml_is_quantized(wtype);
+#else
+  cache.v_trans = false;
+#endif
+
+  if (!cache.buf.addr) {
+    fprintf(stderr, "%s: failed to allocate memory for kv cache\n", __func__);
+    return false;
+  }
 
   struct ggml_init_params params;
   params.mem_size = cache.buf.size;
@@ -909,6 +1121,47 @@ static bool kv_cache_init(const struct llama_hparams &hparams,
   return true;
 }
 
+// gives back the memory of the tokens in the cache
+static void kv_cache_clear(struct llama_kv_cache &cache) {
+#if !defined(GGML_USE_CUBLAS) && !defined(GGML_USE_METAL)
+  ggml_lazy_discard(cache.k->data, ggml_nbytes(cache.k));
+  ggml_lazy_discard(cache.v->data, ggml_nbytes(cache.v));
+#endif
+  cache.n = 0;
+}
+
+#if !defined(GGML_USE_CUBLAS) && !defined(GGML_USE_METAL)
+// copies the keys and values of the first n tokens of the cache to or from
+// data, token by token and a K row then a V row per layer, so that the copy of
+// a prefix is a prefix of the bytes
+static void kv_cache_copy_tokens(const struct llama_hparams &hparams,
+                                 const struct llama_kv_cache &cache, int n,
+                                 char *data, bool save) {
+  const int n_layer = hparams.n_layer;
+  const int n_ctx = hparams.n_ctx;
+  const size_t row_size = ggml_row_size(cache.k->type, hparams.n_embd_gqa());
+  for (int i = 0; i < n; ++i) {
+    for (int il = 0; il < n_layer; ++il) {
+      for (const ggml_tensor *kv : {cache.k, cache.v}) {
+        char *row = (char *)kv->data + (il * n_ctx + i) * row_size;
+        if (save) {
+          memcpy(data, row, row_size);
+        } else {
+          memcpy(row, data, row_size);
+        }
+        data += row_size;
+      }
+    }
+  }
+}
+
+static size_t kv_cache_token_size(const struct llama_hparams &hparams,
+                                  const struct llama_kv_cache &cache) {
+  return 2u * hparams.n_layer *
+         ggml_row_size(cache.k->type, hparams.n_embd_gqa());
+}
+#endif
+
 struct llama_context_params llama_context_default_params() {
   struct llama_context_params result = {
       /*.seed                        =*/LLAMA_DEFAULT_SEED,
@@ -921,6 +1174,7 @@ struct llama_context_params llama_context_default_params() {
       /*.tensor_split                =*/nullptr,
       /*.rope_freq_base              =*/10000.0f,
       /*.rope_freq_scale             =*/1.0f,
+      /*.kv_type                     =*/GGML_TYPE_COUNT,
       /*.progress_callback           =*/nullptr,
       /*.progress_callback_user_data =*/nullptr,
       /*.low_vram                    =*/false,
@@ -931,6 +1185,8 @@ struct llama_context_params llama_context_default_params() {
       /*.use_mmap                    =*/true,
       /*.use_mlock                   =*/false,
       /*.embedding                   =*/false,
+      /*.fuse_weights                =*/false,
+      /*.repack_weights              =*/false,
   };
 
   return result;
@@ -1068,7 +1324,8 @@ static void llama_model_load_internal(
     int n_batch, int n_gqa, float rms_norm_eps, int n_gpu_layers, int main_gpu,
     const float *tensor_split, const bool mul_mat_q, float rope_freq_base,
     float rope_freq_scale, bool low_vram, ggml_type memory_type, bool use_mmap,
-    bool use_mlock, bool vocab_only, llama_progress_callback progress_callback,
+    bool use_mlock, bool vocab_only, bool fuse_weights, bool repack_weights,
+    llama_progress_callback progress_callback,
     void *progress_callback_user_data) {
   model.t_start_us = ggml_time_us();
 
@@ -1162,6 +1419,21 @@ static void llama_model_load_internal(
   size_t mmapped_size;
   ml->calc_sizes(&ctx_size, &mmapped_size);
 
+#ifdef GGML_USE_METAL
+  // the fused weights are not mapped to Metal buffers
+  fuse_weights = false;
+#endif
+#if defined(GGML_USE_METAL) || defined(GGML_USE_CUBLAS) || \
+    defined(GGML_USE_CLBLAST)
+  // the GPU backends don't know the interleaved types
+  repack_weights = false;
+#endif
+  if (fuse_weights) {
+    // wqkv and w13 of each layer
+    ctx_size += 2 * ml->file_loader->hparams.n_layer *
+                (sizeof(struct ggml_tensor) + GGML_OBJECT_SIZE);
+  }
+
   // create the ggml context
   {
     model.buf.resize(ctx_size);
@@ -1262,24 +1534,53 @@ static void llama_model_load_internal(
       layer.attention_norm = ml->get_tensor(layers_i + ".attention_norm.weight",
                                             {n_embd}, backend);
 
-      layer.wq = ml->get_tensor(layers_i + ".attention.wq.weight",
-                                {n_embd, n_embd}, backend_split);
-      layer.wk = ml->get_tensor(layers_i + ".attention.wk.weight",
-                                {n_embd, n_embd_gqa}, backend_split);
-      layer.wv = ml->get_tensor(layers_i + ".attention.wv.weight",
-                                {n_embd, n_embd_gqa}, backend_split);
+      const bool fuse_layer =
+          fuse_weights && backend_split == GGML_BACKEND_CPU;
+      std::vector<struct ggml_tensor *> parts;
+
+      if (fuse_layer) {
+        layer.wqkv = ml->get_fused_tensor(
+            {layers_i + ".attention.wq.weight",
+             layers_i + ".attention.wk.weight",
+             layers_i + ".attention.wv.weight"},
+            {{n_embd, n_embd}, {n_embd, n_embd_gqa}, {n_embd, n_embd_gqa}},
+            parts);
+      }
+      if (layer.wqkv) {
+        layer.wq = parts[0];
+        layer.wk = parts[1];
+        layer.wv = parts[2];
+      } else {
+        layer.wq = ml->get_tensor(layers_i + ".attention.wq.weight",
+                                  {n_embd, n_embd}, backend_split);
+        layer.wk = ml->get_tensor(layers_i + ".attention.wk.weight",
+                                  {n_embd, n_embd_gqa}, backend_split);
+        layer.wv = ml->get_tensor(layers_i + ".attention.wv.weight",
+                                  {n_embd, n_embd_gqa}, backend_split);
+      }
       layer.wo = ml->get_tensor(layers_i + ".attention.wo.weight",
                                 {n_embd, n_embd}, backend_split);
 
       layer.ffn_norm =
           ml->get_tensor(layers_i + ".ffn_norm.weight", {n_embd}, backend);
 
-      layer.w1 = ml->get_tensor(layers_i + ".feed_forward.w1.weight",
-                                {n_embd, n_ff}, backend_split);
+      if (fuse_layer) {
+        layer.w13 = ml->get_fused_tensor(
+            {layers_i + ".feed_forward.w1.weight",
+             layers_i + ".feed_forward.w3.weight"},
+            {{n_embd, n_ff}, {n_embd, n_ff}}, parts);
+      }
+      if (layer.w13) {
+        layer.w1 = parts[0];
+        layer.w3 = parts[1];
+      } else {
+        layer.w1 = ml->get_tensor(layers_i + ".feed_forward.w1.weight",
+                                  {n_embd, n_ff}, backend_split);
+        layer.w3 = ml->get_tensor(layers_i + ".feed_forward.w3.weight",
+                                  {n_embd, n_ff}, backend_split);
+      }
       layer.w2 = ml->get_tensor(layers_i + ".feed_forward.w2.weight",
                                 {n_ff, n_embd}, backend_split);
-      layer.w3 = ml->get_tensor(layers_i + ".feed_forward.w3.weight",
-                                {n_embd, n_ff}, backend_split);
 
       if (backend == GGML_BACKEND_GPU) {
         vram_weights += ggml_nbytes(layer.attention_norm) +
@@ -1377,6 +1678,32 @@ static void llama_model_load_internal(
 
   ml->load_all_data(progress_callback, progress_callback_user_data,
                     use_mlock ? &model.mlock_mmap : NULL);
+  ml->load_fused_data(model.fused_buf, use_mlock ? &model.mlock_fused : NULL);
+
+  if (repack_weights) {
+    // each weight is followed by its views
+    std::vector<std::vector<struct ggml_tensor *>> weights;
+    for (const llama_layer &layer : model.layers) {
+      if (layer.wqkv) {
+        weights.push_back({layer.wqkv, layer.wq, layer.wk, layer.wv});
+      } else {
+        weights.push_back({layer.wq});
+        weights.push_back({layer.wk});
+        weights.push_back({layer.wv});
+      }
+      weights.push_back({layer.wo});
+      if (layer.w13) {
+        weights.push_back({layer.w13, layer.w1, layer.w3});
+      } else {
+        weights.push_back({layer.w1});
+        weights.push_back({layer.w3});
+      }
+      weights.push_back({layer.w2});
+    }
+    weights.push_back({model.output});
+    ml->repack_data(weights, model.repacked_buf,
+                    use_mlock ? &model.mlock_repacked : NULL);
+  }
 
   if (progress_callback) {
     progress_callback(1.0f, progress_callback_user_data);
@@ -1394,14 +1721,15 @@ static bool llama_model_load(
     int n_batch, int n_gqa, float rms_norm_eps, int n_gpu_layers, int main_gpu,
     const float *tensor_split, const bool mul_mat_q, float rope_freq_base,
     float rope_freq_scale, bool low_vram, ggml_type memory_type, bool use_mmap,
-    bool use_mlock, bool vocab_only, llama_progress_callback progress_callback,
+    bool use_mlock, bool vocab_only, bool fuse_weights, bool repack_weights,
+    llama_progress_callback progress_callback,
     void *progress_callback_user_data) {
   try {
     llama_model_load_internal(
         fname, model, vocab, n_ctx, n_batch, n_gqa, rms_norm_eps, n_gpu_layers,
         main_gpu, tensor_split, mul_mat_q, rope_freq_base, rope_freq_scale,
-        low_vram, memory_type, use_mmap, use_mlock, vocab_only,
-        progress_callback, progress_callback_user_data);
+        low_vram, memory_type, use_mmap, use_mlock, vocab_only, fuse_weights,
+        repack_weights, progress_callback, progress_callback_user_data);
     return true;
   } catch (const std::exception &err) {
     fprintf(stderr, "error loading model: %s\n", err.what());
@@ -1516,14 +1844,36 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
   }
 #endif  // GGML_USE_CUBLAS
 
+  // the attention is computed by ggml_flash_attn_ext on the CPU, the GPU
+  // backends run the separate ops
+#ifdef GGML_USE_METAL
+  const bool flash_attn = false;
+#else
+  const bool flash_attn =
+      offload_func_kq == llama_nop && offload_func_v == llama_nop;
+#endif
+
+  // V is stored by rows or transposed, see kv_cache_init
+  const bool v_trans = kv_self.v_trans;
+
+  // rms_norm followed by the norm weight is computed by ggml_rms_norm_affine
+  // when the norm stays on the CPU
+#ifdef GGML_USE_METAL
+  const bool fused_norm = false;
+#else
+  const bool fused_norm = true;
+#endif
+
+  const float kq_scale = 1.0f / sqrtf(float(n_embd) / n_head);
+
   struct ggml_tensor *KQ_scale = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, 1);
 #ifdef LLAMA_USE_ALLOCATOR
   ggml_allocr_alloc(lctx.alloc, KQ_scale);
   if (!ggml_allocr_is_measure(lctx.alloc)) {
-    ggml_set_f32(KQ_scale, 1.0f / sqrtf(float(n_embd) / n_head));
+    ggml_set_f32(KQ_scale, kq_scale);
   }
 #else
-  ggml_set_f32(KQ_scale, 1.0f / sqrtf(float(n_embd) / n_head));
+  ggml_set_f32(KQ_scale, kq_scale);
 #endif
   ggml_set_name(KQ_scale, "1/sqrt(n_embd_head)");
 
@@ -1542,8 +1892,14 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
 
     lctx.use_buf(ctx0, 0);
 
+    const bool fused_norm_il = fused_norm && offload_func == llama_nop;
+
     // norm
-    {
+    if (fused_norm_il) {
+      cur = ggml_rms_norm_affine(ctx0, inpL, model.layers[il].attention_norm,
+                                 rms_norm_eps);
+      ggml_set_name(cur, "attention_norm_0");
+    } else {
       cur = ggml_rms_norm(ctx0, inpL, rms_norm_eps);
       offload_func(cur);
       ggml_set_name(cur, "rms_norm_0");
@@ -1556,52 +1912,75 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
 
     // self-attention
     {
-      // compute Q and K and RoPE them
-      struct ggml_tensor *tmpk = ggml_mul_mat(ctx0, model.layers[il].wk, cur);
-      offload_func_kq(tmpk);
-      ggml_set_name(tmpk, "tmpk");
+      struct ggml_tensor *tmpq;
+      struct ggml_tensor *tmpk;
+      struct ggml_tensor *tmpv;
+
+      if (model.layers[il].wqkv) {
+        // the rows of Q, K and V of each token are next to each other
+        struct ggml_tensor *qkv =
+            ggml_mul_mat(ctx0, model.layers[il].wqkv, cur);
+        ggml_set_name(qkv, "qkv");
+
+        tmpq = ggml_view_3d(ctx0, qkv, n_embd_head, n_head, N,
+                            n_embd_head * sizeof(float), qkv->nb[1], 0);
+        tmpk = ggml_view_3d(ctx0, qkv, n_embd_head, n_head_kv, N,
+                            n_embd_head * sizeof(float), qkv->nb[1],
+                            n_embd * sizeof(float));
+        tmpv = ggml_view_2d(ctx0, qkv, n_embd_gqa, N, qkv->nb[1],
+                            (n_embd + n_embd_gqa) * sizeof(float));
+      } else {
+        tmpk = ggml_mul_mat(ctx0, model.layers[il].wk, cur);
+        offload_func_kq(tmpk);
+        tmpk = ggml_reshape_3d(ctx0, tmpk, n_embd_head, n_head_kv, N);
+
+        tmpq = ggml_mul_mat(ctx0, model.layers[il].wq, cur);
+        offload_func_kq(tmpq);
+        tmpq = ggml_reshape_3d(ctx0, tmpq, n_embd_head, n_head, N);
 
-      struct ggml_tensor *tmpq = ggml_mul_mat(ctx0, model.layers[il].wq, cur);
-      offload_func_kq(tmpq);
+        tmpv = ggml_mul_mat(ctx0, model.layers[il].wv, cur);
+        offload_func_v(tmpv);
+        tmpv = ggml_reshape_2d(ctx0, tmpv, n_embd_gqa, N);
+      }
+      ggml_set_name(tmpk, "tmpk");
       ggml_set_name(tmpq, "tmpq");
+      ggml_set_name(tmpv, "tmpv");
 
+      // compute Q and K and RoPE them
       struct ggml_tensor *Kcur = ggml_rope_custom_inplace(
-          ctx0, ggml_reshape_3d(ctx0, tmpk, n_embd_head, n_head_kv, N), n_past,
-          n_embd_head, 0, 0, freq_base, freq_scale);
+          ctx0, tmpk, n_past, n_embd_head, 0, 0, freq_base, freq_scale);
       offload_func_kq(Kcur);
       ggml_set_name(Kcur, "Kcur");
 
       struct ggml_tensor *Qcur = ggml_rope_custom_inplace(
-          ctx0, ggml_reshape_3d(ctx0, tmpq, n_embd_head, n_head, N), n_past,
-          n_embd_head, 0, 0, freq_base, freq_scale);
+          ctx0, tmpq, n_past, n_embd_head, 0, 0, freq_base, freq_scale);
       offload_func_kq(Qcur);
       ggml_set_name(Qcur, "Qcur");
 
       // store key and value to memory
       {
-        // compute the transposed [N, n_embd] V matrix
-
-        struct ggml_tensor *tmpv = ggml_mul_mat(ctx0, model.layers[il].wv, cur);
-        offload_func_v(tmpv);
-        ggml_set_name(tmpv, "tmpv");
-
-        struct ggml_tensor *Vcur =
-            ggml_transpose(ctx0, ggml_reshape_2d(ctx0, tmpv, n_embd_gqa, N));
+        // compute the transposed [N, n_embd] V matrix if the cache stores V
+        // transposed
+        struct ggml_tensor *Vcur = v_trans ? ggml_transpose(ctx0, tmpv) : tmpv;
         offload_func_v(Vcur);
         ggml_set_name(Vcur, "Vcur");
 
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, kv_self.k, N * n_embd_gqa,
-                         (ggml_element_size(kv_self.k) * n_embd_gqa) *
-                             (il * n_ctx + n_past));
+        struct ggml_tensor *k = ggml_view_1d(
+            ctx0, kv_self.k, N * n_embd_gqa,
+            ggml_row_size(kv_self.k->type, n_embd_gqa) * (il * n_ctx + n_past));
         offload_func_kq(k);
         ggml_set_name(k, "k");
 
-        struct ggml_tensor *v = ggml_view_2d(
-            ctx0, kv_self.v, N, n_embd_gqa,
-            (n_ctx)*ggml_element_size(kv_self.v),
-            (il * n_ctx) * ggml_element_size(kv_self.v) * n_embd_gqa +
-                n_past * ggml_element_size(kv_self.v));
+        struct ggml_tensor *v =
+            v_trans
+                ? ggml_view_2d(
+                      ctx0, kv_self.v, N, n_embd_gqa,
+                      (n_ctx)*ggml_element_size(kv_self.v),
+                      (il * n_ctx) * ggml_element_size(kv_self.v) * n_embd_gqa +
+                          n_past * ggml_element_size(kv_self.v))
+                : ggml_view_1d(ctx0, kv_self.v, N * n_embd_gqa,
+                               ggml_row_size(kv_self.v->type, n_embd_gqa) *
+                                   (il * n_ctx + n_past));
         offload_func_v(v);
         ggml_set_name(v, "v");
 
@@ -1618,70 +1997,97 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
           ctx0,
           ggml_reshape_3d(
               ctx0,
-              ggml_view_1d(
-                  ctx0, kv_self.k, (n_past + N) * n_embd_gqa,
-                  il * n_ctx * ggml_element_size(kv_self.k) * n_embd_gqa),
+              ggml_view_1d(ctx0, kv_self.k, (n_past + N) * n_embd_gqa,
+                           il * n_ctx *
+                               ggml_row_size(kv_self.k->type, n_embd_gqa)),
               n_embd_head, n_head_kv, n_past + N),
           0, 2, 1, 3);
       offload_func_kq(K);
       ggml_set_name(K, "K");
 
-      // K * Q
-      struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
-      offload_func_kq(KQ);
-      ggml_set_name(KQ, "KQ");
-
-      // KQ_scaled = KQ / sqrt(n_embd_head)
-      // KQ_scaled shape [n_past + N, N, n_head, 1]
-      struct ggml_tensor *KQ_scaled = ggml_scale_inplace(ctx0, KQ, KQ_scale);
-      offload_func_kq(KQ_scaled);
-      ggml_set_name(KQ_scaled, "KQ_scaled");
-
-      // KQ_masked = mask_past(KQ_scaled)
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf_inplace(ctx0, KQ_scaled, n_past);
-      offload_func_kq(KQ_masked);
-      ggml_set_name(KQ_masked, "KQ_masked");
-
-      // KQ = soft_max(KQ_masked)
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max_inplace(ctx0, KQ_masked);
-      offload_func_v(KQ_soft_max);
-      ggml_set_name(KQ_soft_max, "KQ_soft_max");
-
       // split cached V into n_head heads
       struct ggml_tensor *V =
-          ggml_view_3d(ctx0, kv_self.v, n_past + N, n_embd_head, n_head_kv,
-                       n_ctx * ggml_element_size(kv_self.v),
-                       n_ctx * ggml_element_size(kv_self.v) * n_embd_head,
-                       n_ctx * ggml_element_size(kv_self.v) * n_embd_gqa * il);
+          v_trans
+              ? ggml_view_3d(
+                    ctx0, kv_self.v, n_past + N, n_embd_head, n_head_kv,
+                    n_ctx * ggml_element_size(kv_self.v),
+                    n_ctx * ggml_element_size(kv_self.v) * n_embd_head,
+                    n_ctx * ggml_element_size(kv_self.v) * n_embd_gqa * il)
+              : ggml_permute(
+                    ctx0,
+                    ggml_reshape_3d(
+                        ctx0,
+                        ggml_view_1d(
+                            ctx0, kv_self.v, (n_past + N) * n_embd_gqa,
+                            il * n_ctx *
+                                ggml_row_size(kv_self.v->type, n_embd_gqa)),
+                        n_embd_head, n_head_kv, n_past + N),
+                    0, 2, 1, 3);
       offload_func_v(V);
       ggml_set_name(V, "V");
 
+      if (flash_attn) {
+        // KQV shape [n_embd_head, n_head, N]
+        struct ggml_tensor *KQV = ggml_flash_attn_ext(
+            ctx0, Q, K, v_trans ? ggml_transpose(ctx0, V) : V, kq_scale, 0.0f);
+        ggml_set_name(KQV, "KQV");
+
+        cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
+        ggml_set_name(cur, "KQV_merged_contiguous");
+      } else {
+        LLAMA_ASSERT(v_trans);
+
+        // K * Q
+        struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
+        offload_func_kq(KQ);
+        ggml_set_name(KQ, "KQ");
+
+        // KQ_scaled = KQ / sqrt(n_embd_head)
+        // KQ_scaled shape [n_past + N, N, n_head, 1]
+        struct ggml_tensor *KQ_scaled =
+            ggml_scale_inplace(ctx0, KQ, KQ_scale);
+        offload_func_kq(KQ_scaled);
+        ggml_set_name(KQ_scaled, "KQ_scaled");
+
+        // KQ_masked = mask_past(KQ_scaled)
+        struct ggml_tensor *KQ_masked =
+            ggml_diag_mask_inf_inplace(ctx0, KQ_scaled, n_past);
+        offload_func_kq(KQ_masked);
+        ggml_set_name(KQ_masked, "KQ_masked");
+
+        // KQ = soft_max(KQ_masked)
+        struct ggml_tensor *KQ_soft_max =
+            ggml_soft_max_inplace(ctx0, KQ_masked);
+        offload_func_v(KQ_soft_max);
+        ggml_set_name(KQ_soft_max, "KQ_soft_max");
+
 #if 1
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
-      offload_func_v(KQV);
-      ggml_set_name(KQV, "KQV");
+        struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+        offload_func_v(KQV);
+        ggml_set_name(KQV, "KQV");
 #else
-      // make V contiguous in memory to speed up the matmul, however we waste
-      // time on the copy on M1 this is faster for the perplexity computation,
-      // but ~5% slower for the single-token generation is there a better way?
-      struct ggml_tensor *V_cont =
-          ggml_cpy(ctx0, V,
-                   ggml_new_tensor_3d(ctx0, kv_self.v->type, n_past + N,
-                                      n_embd_head, n_head));
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_cont, KQ_soft_max);
+        // make V contiguous in memory to speed up the matmul, however we
+        // waste time on the copy on M1 this is faster for the perplexity
+        // computation, but ~5% slower for the single-token generation is there
+        // a better way?
+        struct ggml_tensor *V_cont =
+            ggml_cpy(ctx0, V,
+                     ggml_new_tensor_3d(ctx0, kv_self.v->type, n_past + N,
+                                        n_embd_head, n_head));
+        struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_cont, KQ_soft_max);
 #endif
 
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-      offload_func_v(KQV_merged);
-      ggml_set_name(KQV_merged, "KQV_merged");
+        // KQV_merged = KQV.permute(0, 2, 1, 3)
+        struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+        offload_func_v(KQV_merged);
+        ggml_set_name(KQV_merged, "KQV_merged");
 
-      // cur = KQV_merged.contiguous().view(n_embd, N)
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
-      offload_func_v(cur);
-      ggml_set_name(cur, "KQV_merged_contiguous");
+        // cur = KQV_merged.contiguous().view(n_embd, N)
+        cur = ggml_cpy(ctx0, KQV_merged,
+                       ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+        offload_func_v(cur);
+        ggml_set_name(cur, "KQV_merged_contiguous");
+      }
 
       // projection (no bias)
       cur = ggml_mul_mat(ctx0, model.layers[il].wo, cur);
@@ -1698,7 +2104,11 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
     // feed-forward network
     {
       // norm
-      {
+      if (fused_norm_il) {
+        cur = ggml_rms_norm_affine(ctx0, inpFF, model.layers[il].ffn_norm,
+                                   rms_norm_eps);
+        ggml_set_name(cur, "ffn_norm");
+      } else {
         cur = ggml_rms_norm(ctx0, inpFF, rms_norm_eps);
         offload_func(cur);
         ggml_set_name(cur, "rms_norm_1");
@@ -1709,22 +2119,31 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
         ggml_set_name(cur, "ffn_norm");
       }
 
-      struct ggml_tensor *tmp = ggml_mul_mat(ctx0, model.layers[il].w3, cur);
-      offload_func(tmp);
-      ggml_set_name(tmp, "result_w3");
+      if (model.layers[il].w13) {
+        cur = ggml_mul_mat(ctx0, model.layers[il].w13, cur);
+        ggml_set_name(cur, "result_w13");
 
-      cur = ggml_mul_mat(ctx0, model.layers[il].w1, cur);
-      offload_func(cur);
-      ggml_set_name(cur, "result_w1");
+        // SILU activation of the w1 half times the w3 half
+        cur = ggml_swiglu(ctx0, cur);
+        ggml_set_name(cur, "silu_x_result_w3");
+      } else {
+        struct ggml_tensor *tmp = ggml_mul_mat(ctx0, model.layers[il].w3, cur);
+        offload_func(tmp);
+        ggml_set_name(tmp, "result_w3");
 
-      // SILU activation
-      cur = ggml_silu(ctx0, cur);
-      offload_func(cur);
-      ggml_set_name(cur, "silu");
+        cur = ggml_mul_mat(ctx0, model.layers[il].w1, cur);
+        offload_func(cur);
+        ggml_set_name(cur, "result_w1");
 
-      cur = ggml_mul(ctx0, cur, tmp);
-      offload_func(cur);
-      ggml_set_name(cur, "silu_x_result_w3");
+        // SILU activation
+        cur = ggml_silu(ctx0, cur);
+        offload_func(cur);
+        ggml_set_name(cur, "silu");
+
+        cur = ggml_mul(ctx0, cur, tmp);
+        offload_func(cur);
+        ggml_set_name(cur, "silu_x_result_w3");
+      }
 
       cur = ggml_mul_mat(ctx0, model.layers[il].w2, cur);
       offload_func(cur);
@@ -1742,7 +2161,10 @@ static struct ggml_cgraph *llama_build_graph(llama_context &lctx,
   lctx.use_buf(ctx0, 0);
 
   // norm
-  {
+  if (fused_norm && offload_func_nr == llama_nop) {
+    cur = ggml_rms_norm_affine(ctx0, inpL, model.norm, rms_norm_eps);
+    ggml_set_name(cur, "result_norm");
+  } else {
     cur = ggml_rms_norm(ctx0, inpL, rms_norm_eps);
     offload_func_nr(cur);
     ggml_set_name(cur, "rms_norm_2");
@@ -1874,10 +2296,12 @@ static bool llama_eval_internal(llama_context &lctx, const llama_token *tokens,
       ggml_metal_get_tensor(lctx.ctx_metal, kv_self.v);
     }
 
-    ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads);
+    ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads,
+                              lctx.threadpool);
   }
 #else
-  ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads);
+  ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads,
+                            lctx.threadpool);
 #endif
 
 #if GGML_USE_MPI
@@ -3371,7 +3795,8 @@ struct llama_model *llama_load_model_from_file(
           params.main_gpu, params.tensor_split, params.mul_mat_q,
           params.rope_freq_base, params.rope_freq_scale, params.low_vram,
           memory_type, params.use_mmap, params.use_mlock, params.vocab_only,
-          params.progress_callback, params.progress_callback_user_data)) {
+          params.fuse_weights, params.repack_weights, params.progress_callback,
+          params.progress_callback_user_data)) {
     delete model;
     fprintf(stderr, "%s: failed to load model\n", __func__);
     return nullptr;
@@ -3410,6 +3835,16 @@ struct llama_context *llama_new_context_with_model(
   ctx->logits_all = params.logits_all;
 
   ggml_type memory_type = params.f16_kv ? GGML_TYPE_F16 : GGML_TYPE_F32;
+  if (params.kv_type != GGML_TYPE_COUNT) {
+    memory_type = params.kv_type;
+  }
+  if (ggml_is_quantized(memory_type) &&
+      !llama_kv_can_quantize(ctx->model.hparams, memory_type,
+                             params.n_gpu_layers)) {
+    fprintf(stderr, "%s: KV cache type %s is not supported, using f16\n",
+            __func__, ggml_type_name(memory_type));
+    memory_type = GGML_TYPE_F16;
+  }
 
   // reserve memory for context buffers
   if (!params.vocab_only) {
@@ -3749,6 +4184,14 @@ int llama_apply_lora_from_file_internal(const struct llama_model &model,
         lora_tensors.find(base_name + ".loraB") != lora_tensors.end()) {
       ggml_tensor *dest_t = model_tensors[base_name];
 
+      if (dest_t->type == GGML_TYPE_Q4_0_8 ||
+          dest_t->type == GGML_TYPE_Q8_0_8) {
+        throw std::runtime_error(
+            format("%s: error: LoRAs can't be applied to repacked weights, "
+                   "load the model with repack_weights disabled",
+                   __func__));
+      }
+
       offload_func_t offload_func = llama_nop;
       offload_func_t offload_func_force_inplace = llama_nop;
 
@@ -4011,7 +4454,16 @@ void llama_copy_state_data_internal(struct llama_context *ctx,
     data_ctx->write(&kv_size, sizeof(kv_size));
     data_ctx->write(&kv_ntok, sizeof(kv_ntok));
 
-    if (kv_size) {
+    if (kv_size && !kv_self.v_trans) {
+      // caches that store V by rows stay on the CPU, see kv_cache_init
+      const size_t row_size = ggml_row_size(kv_self.k->type, n_embd);
+      for (const ggml_tensor *kv : {kv_self.k, kv_self.v}) {
+        for (int il = 0; il < n_layer; ++il) {
+          data_ctx->write((const uint8_t *)kv->data + il * n_ctx * row_size,
+                          kv_ntok * row_size);
+        }
+      }
+    } else if (kv_size) {
       const size_t elt_size = ggml_element_size(kv_self.k);
 
       ggml_context *cpy_ctx = ggml_init({4096, NULL, /* no_alloc */ true});
@@ -4128,7 +4580,18 @@ size_t llama_set_state_data(struct llama_context *ctx, uint8_t *src) {
     memcpy(&kv_ntok, inp, sizeof(kv_ntok));
     inp += sizeof(kv_ntok);
 
-    if (kv_size) {
+    if (kv_size && !kv_self.v_trans) {
+      LLAMA_ASSERT(kv_self.buf.size == kv_size);
+
+      const size_t row_size = ggml_row_size(kv_self.k->type, n_embd);
+      for (ggml_tensor *kv : {kv_self.k, kv_self.v}) {
+        for (int il = 0; il < n_layer; ++il) {
+          memcpy((uint8_t *)kv->data + il * n_ctx * row_size, inp,
+                 kv_ntok * row_size);
+          inp += kv_ntok * row_size;
+        }
+      }
+    } else if (kv_size) {
       LLAMA_ASSERT(kv_self.buf.size == kv_size);
 
       const size_t elt_size = ggml_element_size(kv_self.k);
@@ -4272,6 +4735,11 @@ bool llama_save_session_file(struct llama_context *ctx,
   return true;
 }
 
+void llama_set_threadpool(struct llama_context *ctx,
+                          struct ggml_threadpool *threadpool) {
+  ctx->threadpool = threadpool;
+}
+
 int llama_eval(struct llama_context *ctx, const llama_token *tokens,
                int n_tokens, int n_past, int n_threads) {
   if (!llama_eval_internal(*ctx, tokens, nullptr, n_tokens, n_past, n_threads,
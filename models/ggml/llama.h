@@ -101,6 +101,10 @@ extern "C" {
         float    rope_freq_base;  // RoPE base frequency
         float    rope_freq_scale; // RoPE frequency scaling factor
 
+        // type of the KV cache, GGML_TYPE_COUNT to use f16_kv. quantized types are read by
+        // ggml_flash_attn_ext and fall back to F16 when the attention runs on the GPU
+        enum ggml_type kv_type;
+
         // called with a progress value between 0 and 1, pass NULL to disable
         llama_progress_callback progress_callback;
         // context pointer passed to the progress callback
@@ -115,6 +119,8 @@ extern "C" {
         bool use_mmap;   // use mmap if possible
         bool use_mlock;  // force system to keep model in RAM
         bool embedding;  // embedding mode only
+        bool fuse_weights; // concatenate the q/k/v and gate/up weights of each layer on the CPU
+        bool repack_weights; // interleave the rows of quantized weights on the CPU, see ggml_repack
     };
     // model file types
     enum llama_ftype {
@@ -282,6 +288,10 @@ extern "C" {
     LLAMA_API bool llama_load_session_file(struct llama_context * ctx, const char * path_session, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out);
     LLAMA_API bool llama_save_session_file(struct llama_context * ctx, const char * path_session, const llama_token * tokens, size_t n_token_count);
 
+    // Use persistent worker threads for llama_eval() instead of creating threads for every call
+    // The thread pool is not owned by the context and must have at least n_threads threads
+    LLAMA_API void llama_set_threadpool(struct llama_context * ctx, struct ggml_threadpool * threadpool);
+
     // Run the llama inference to obtain the logits and probabilities for the next token.
     // tokens + n_tokens is the provided batch of new tokens to process
     // n_past is the number of tokens to use from previous eval calls
@@ -17,13 +17,25 @@ extern "C" {
 #endif
 
 LLM* ctransformers_llm_create(const char* model_path, const char* model_type,
-                              const int context_length, const int gpu_layers) {
+                              const int context_length, const int gpu_layers,
+                              const char* kv_cache_type,
+                              const bool fuse_weights,
+                              const bool repack_weights) {
   std::string type = model_type;
   // Remove non-alphanumeric characters from model type.
   type.erase(std::remove_if(type.begin(), type.end(),
                             [](const char c) { return !std::isalnum(c); }),
              type.end());
 
+  ggml_type kv_type = GGML_TYPE_COUNT;
+  if (kv_cache_type != nullptr && kv_cache_type[0] != '\0') {
+    kv_type = ct_kv_type(kv_cache_type);
+    if (kv_type == GGML_TYPE_COUNT) {
+      fprintf(stderr, "KV cache type '%s' is not supported.\n", kv_cache_type);
+      return nullptr;
+    }
+  }
+
   LLM* llm = nullptr;
   if (type == "dollyv2") {
     llm = new dollyv2_llm;
@@ -49,7 +61,8 @@ LLM* ctransformers_llm_create(const char* model_path, const char* model_type,
     fprintf(stderr, "Model type '%s' is not supported.\n", model_type);
     return nullptr;
   }
-  if (!llm->Init(model_path, context_length, gpu_layers)) {
+  if (!llm->Init(model_path, context_length, gpu_layers, kv_type,
+                 fuse_weights, repack_weights)) {
     delete llm;
     return nullptr;
   }
@@ -58,6 +71,27 @@ LLM* ctransformers_llm_create(const char* model_path, const char* model_type,
 
 void ctransformers_llm_delete(LLM* llm) { delete llm; }
 
+// Enables the prompt cache for `llm` and raises the budgets of the cache, which
+// is shared by all models, to at least the given ones in MB. Snapshots that do
+// not fit in memory are written to `dir` if it is not empty, see
+// PromptCache::Configure(). Returns false if the model does not support it.
+bool ctransformers_llm_prompt_cache(LLM* llm, const int memory_size,
+                                    const char* dir, const int disk_size) {
+  if (!llm->EnablePromptCache()) {
+    return false;
+  }
+  PromptCache::Get().Configure((size_t)memory_size << 20,
+                               dir != nullptr ? dir : "",
+                               (size_t)disk_size << 20);
+  return true;
+}
+
+// Keeps at most `budget` tokens in the KV cache of `llm`. Returns false if the
+// model does not support it.
+bool ctransformers_llm_kv_cache_budget(LLM* llm, const int budget) {
+  return llm->SetKVBudget(budget);
+}
+
 int ctransformers_llm_tokenize(LLM* llm, const char* text, int* output) {
   const std::vector<gpt_vocab::id> tokens = llm->Tokenize(text);
   std::copy(tokens.begin(), tokens.end(), output);
@@ -68,6 +102,68 @@ const char* ctransformers_llm_detokenize(LLM* llm, const int token) {
   return llm->Detokenize(token).c_str();
 }
 
+// Tokenizes `n_texts` texts and writes the tokens of text `i` to
+// `output[offsets[i]:offsets[i + 1]]`. `offsets` must have room for
+// `n_texts + 1` values. Returns the total number of tokens. If it is greater
+// than `output_size`, only `offsets` is written.
+int ctransformers_llm_batch_tokenize(LLM* llm, const char** texts,
+                                     const int n_texts, int* output,
+                                     const int output_size, int* offsets,
+                                     const int threads) {
+  const std::vector<std::string> inputs(texts, texts + n_texts);
+  const std::vector<std::vector<gpt_vocab::id>> tokens =
+      llm->BatchTokenize(inputs, threads);
+
+  offsets[0] = 0;
+  for (int i = 0; i < n_texts; i++) {
+    offsets[i + 1] = offsets[i] + tokens[i].size();
+  }
+  const int n_tokens = offsets[n_texts];
+  if (n_tokens > output_size) {
+    return n_tokens;
+  }
+  ct_parallel_for(n_texts, threads, [&](const int i) {
+    std::copy(tokens[i].begin(), tokens[i].end(), output + offsets[i]);
+  });
+  return n_tokens;
+}
+
+// Detokenizes `n_seqs` token sequences where sequence `i` is
+// `tokens[offsets[i]:offsets[i + 1]]` and writes the text of sequence `i` to
+// `output[output_offsets[i]:output_offsets[i + 1]]`. `output_offsets` must have
+// room for `n_seqs + 1` values. Returns the total number of bytes. If it is
+// greater than `output_size`, only `output_offsets` is written.
+int ctransformers_llm_batch_detokenize(LLM* llm, const int* tokens,
+                                       const int* offsets, const int n_seqs,
+                                       char* output, const int output_size,
+                                       int* output_offsets, const int threads) {
+  std::vector<int> sizes(n_seqs);
+  ct_parallel_for(n_seqs, threads, [&](const int i) {
+    int size = 0;
+    for (int j = offsets[i]; j < offsets[i + 1]; j++) {
+      size += llm->Detokenize(tokens[j]).size();
+    }
+    sizes[i] = size;
+  });
+
+  output_offsets[0] = 0;
+  for (int i = 0; i < n_seqs; i++) {
+    output_offsets[i + 1] = output_offsets[i] + sizes[i];
+  }
+  const int n_bytes = output_offsets[n_seqs];
+  if (n_bytes > output_size) {
+    return n_bytes;
+  }
+  ct_parallel_for(n_seqs, threads, [&](const int i) {
+    char* out = output + output_offsets[i];
+    for (int j = offsets[i]; j < offsets[i + 1]; j++) {
+      const std::string& text = llm->Detokenize(tokens[j]);
+      out = std::copy(text.begin(), text.end(), out);
+    }
+  });
+  return n_bytes;
+}
+
 bool ctransformers_llm_is_eos_token(LLM* llm, const int token) {
   return llm->IsEosToken(token);
 }
@@ -80,9 +176,9 @@ int ctransformers_llm_context_length(LLM* llm) { return llm->ContextLength(); }
 
 bool ctransformers_llm_batch_eval(LLM* llm, const int* tokens,
                                   const int n_tokens, const int batch_size,
-                                  const int threads) {
+                                  const int threads, const int spin_us) {
   return llm->BatchEval(std::vector<gpt_vocab::id>(tokens, tokens + n_tokens),
-                        batch_size, threads);
+                        batch_size, threads, spin_us);
 }
 
 float* ctransformers_llm_logits_data(LLM* llm) { return llm->Logits().data(); }
@@ -2,6 +2,7 @@
 #define CTRANSFORMERS_MODELS_LLM_H_
 
 #include "common.h"
+#include "prompt_cache.h"
 
 // https://github.com/marella/train/blob/3c4ba1f59bf20e31f7ee5ea9a8f38e49440a93f7/train/state.py#L135-L175
 class RingBuffer {
@@ -53,24 +54,60 @@ class RingBuffer {
 
 class LLM {
  public:
-  virtual ~LLM(){};
+  virtual ~LLM() {
+    if (threadpool_ != nullptr) {
+      ggml_threadpool_free(threadpool_);
+    }
+  }
 
   bool Init(const std::string &filename, const int context_length,
-            const int gpu_layers) {
+            const int gpu_layers, const ggml_type kv_type,
+            const bool fuse_weights, const bool repack_weights) {
     if (initialized_) {
       return false;
     }
-    if (!Load(filename, context_length, gpu_layers)) {
+    fuse_weights_ = fuse_weights;
+    repack_weights_ = repack_weights;
+    if (!Load(filename, context_length, gpu_layers, kv_type)) {
       return false;
     }
     previous_tokens_.Init(ContextLength());
+    prompt_cache_key_ = filename + ":" + std::to_string(kv_type);
     return initialized_ = true;
   }
 
+  // Uses the process-wide PromptCache for the prompts given to BatchEval.
+  // Returns false if the model does not support it.
+  bool EnablePromptCache() {
+    prompt_cache_ = KVTokenSize() > 0;
+    return prompt_cache_;
+  }
+
+  // Keeps at most `budget` tokens in the KV cache by evicting the ones that
+  // got the least attention, see KVCache::Evict(). Returns false if the model
+  // does not support it.
+  bool SetKVBudget(const int budget) {
+    if (!TrackKVScores()) {
+      return false;
+    }
+    kv_budget_ = budget;
+    return true;
+  }
+
   virtual std::vector<gpt_vocab::id> Tokenize(const std::string &text) const {
     return gpt_tokenize(vocab_, text);
   }
 
+  // Tokenizes multiple texts in parallel. Tokenizers are read-only after
+  // loading, so texts can be tokenized concurrently.
+  std::vector<std::vector<gpt_vocab::id>> BatchTokenize(
+      const std::vector<std::string> &texts, const int threads) const {
+    std::vector<std::vector<gpt_vocab::id>> tokens(texts.size());
+    ct_parallel_for(texts.size(), threads,
+                    [&](const int i) { tokens[i] = Tokenize(texts[i]); });
+    return tokens;
+  }
+
   virtual const std::string &Detokenize(const gpt_vocab::id id) const {
     const auto it = vocab_.id_to_token.find(id);
     if (it == vocab_.id_to_token.end()) {
@@ -80,10 +117,20 @@ class LLM {
   }
 
   bool BatchEval(const std::vector<gpt_vocab::id> &tokens, int batch_size,
-                 const int threads) {
+                 const int threads, const int spin_us) {
+    spin_us_ = spin_us;
     batch_size = std::min(ContextLength(), batch_size);
     const int size = tokens.size();
-    for (int start = 0; start < size; start += batch_size) {
+    // A new prompt starts from the longest prefix of it in the prompt cache.
+    // The prompts that do not fit in the KV cache are not cached.
+    const bool cache_prompt = prompt_cache_ && previous_tokens_.Size() == 0 &&
+                              size <= ContextLength() &&
+                              (kv_budget_ == 0 || size <= kv_budget_);
+    int start = 0;
+    if (cache_prompt) {
+      start = RestorePrompt(tokens);
+    }
+    for (; start < size; start += batch_size) {
       const int end = std::min(start + batch_size, (int)tokens.size());
       const std::vector<gpt_vocab::id> batch(tokens.begin() + start,
                                              tokens.begin() + end);
@@ -91,6 +138,11 @@ class LLM {
         return false;
       }
     }
+    if (cache_prompt) {
+      PromptCache::Get().Insert(
+          prompt_cache_key_, tokens, KVTokenSize(),
+          [&](char *data) { SaveKV(tokens.size(), data); });
+    }
     return true;
   }
 
@@ -150,6 +202,7 @@ class LLM {
   void Reset() {
     logits_.clear();
     previous_tokens_.Clear();
+    ClearCache();
   }
 
  protected:
@@ -160,23 +213,82 @@ class LLM {
   std::vector<float> logits_;
   std::vector<float> embeddings_;
   RingBuffer previous_tokens_;
+  // The maximum number of tokens in the KV cache, 0 for no limit.
+  int kv_budget_ = 0;
+  // Whether Load may keep fused or repacked copies of the weights, see
+  // llama.cc.
+  bool fuse_weights_ = false;
+  bool repack_weights_ = false;
 
+  // `kv_type` is the type of the KV cache, GGML_TYPE_COUNT for the default
+  // type of the model.
   virtual bool Load(const std::string &filename, const int context_length,
-                    const int gpu_layers) = 0;
+                    const int gpu_layers, const ggml_type kv_type) = 0;
 
   virtual bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads,
                     const int n_past) = 0;
 
+  // Gives back the memory of the tokens in the KV cache on reset.
+  virtual void ClearCache() {}
+
+  // Starts tracking the attention of the tokens in the KV cache for evicting
+  // them. Returns false if the model does not support it.
+  virtual bool TrackKVScores() { return false; }
+
+  // Returns the size of the keys and values of a token in the KV cache, or 0
+  // if the model does not support copying them for the prompt cache.
+  virtual size_t KVTokenSize() const { return 0; }
+
+  // Copies the keys and values of the first `n_tokens` tokens in the KV cache
+  // to `data`, token by token.
+  virtual void SaveKV(const int /*n_tokens*/, char * /*data*/) const {}
+
+  // Replaces the KV cache with the `n_tokens` tokens in `data`, see SaveKV().
+  virtual bool LoadKV(const int /*n_tokens*/, const char * /*data*/) {
+    return false;
+  }
+
+  // Returns worker threads that are reused across evals instead of being
+  // created for every graph. Recreated when more threads are needed.
+  ggml_threadpool *ThreadPool(const int threads) {
+    if (threadpool_ != nullptr &&
+        ggml_threadpool_n_threads(threadpool_) < threads) {
+      ggml_threadpool_free(threadpool_);
+      threadpool_ = nullptr;
+    }
+    if (threadpool_ == nullptr) {
+      threadpool_ = ggml_threadpool_new(threads);
+    }
+    ggml_threadpool_set_spin_us(threadpool_, spin_us_);
+    return threadpool_;
+  }
+
  private:
   bool initialized_ = false;
+  ggml_threadpool *threadpool_ = nullptr;
+  int spin_us_ = GGML_DEFAULT_SPIN_US;
+  bool prompt_cache_ = false;
+  // The prompts of models loaded from the same file with the same KV cache
+  // type share the prompt cache.
+  std::string prompt_cache_key_;
 
-  bool EvalInternal(const std::vector<gpt_vocab::id> &tokens, int threads) {
-    if (threads < 0) {
-      // https://github.com/ggerganov/llama.cpp/blob/cc45a7feb8412e84ff292207621412fffc0d3d51/examples/common.cpp#L67-L68
-      const int n = std::thread::hardware_concurrency();
-      threads = n > 0 ? (n <= 4 ? n : n / 2) : 4;
+  // Restores the KV cache of the longest prefix of `tokens` in the prompt
+  // cache, leaving at least the last token to be evaluated for the logits.
+  // Returns the number of tokens restored.
+  int RestorePrompt(const std::vector<gpt_vocab::id> &tokens) {
+    const int n = PromptCache::Get().Lookup(
+        prompt_cache_key_, tokens, tokens.size() - 1,
+        [&](const char *data, const int n_tokens) {
+          return LoadKV(n_tokens, data);
+        });
+    for (int i = 0; i < n; i++) {
+      previous_tokens_.Add(tokens[i]);
     }
-    threads = std::max(threads, 1);
+    return n;
+  }
+
+  bool EvalInternal(const std::vector<gpt_vocab::id> &tokens, int threads) {
+    threads = ct_get_threads(threads);
     const int n_past =
         std::min(ContextLength() - (int)tokens.size(), previous_tokens_.Size());
     if (!Eval(tokens, threads, n_past)) {
@@ -189,8 +301,43 @@ class LLM {
   }
 };
 
+// An LLM whose model keeps its KV cache in `model_.kv`, which its eval function
+// reads through the block table `seq_`.
+template <typename Model>
+class KVCacheLLM : public LLM {
+ protected:
+  // Makes room in the KV cache for `n` tokens after the first `n_past` tokens.
+  // With a budget, tokens are evicted first so that the new ones fit in it.
+  bool ReserveKV(const int n_past, const int n) {
+    if (kv_budget_ > 0 && !model_.kv.Evict(seq_, n_past, kv_budget_ - n)) {
+      return false;
+    }
+    return model_.kv.Reserve(seq_, n_past, n);
+  }
+
+  void ClearCache() override { model_.kv.Release(seq_); }
+
+  bool TrackKVScores() override {
+    model_.kv.TrackScores();
+    return true;
+  }
+
+  size_t KVTokenSize() const override { return model_.kv.TokenSize(); }
+
+  void SaveKV(const int n_tokens, char *data) const override {
+    model_.kv.Save(seq_, n_tokens, data);
+  }
+
+  bool LoadKV(const int n_tokens, const char *data) override {
+    return model_.kv.Load(seq_, n_tokens, data);
+  }
+
+  Model model_;
+  KVCache::Sequence seq_;
+};
+
 #define REGISTER_LLM(_name)                                                \
-  class _name##_llm : public LLM {                                         \
+  class _name##_llm : public KVCacheLLM<_name##_model> {                   \
    public:                                                                 \
     virtual ~_name##_llm() {                                               \
       if (model_.ctx != nullptr) {                                         \
@@ -200,10 +347,13 @@ class LLM {
                                                                            \
    protected:                                                              \
     bool Load(const std::string &filename, const int context_length,       \
-              const int gpu_layers) override {                             \
+              const int gpu_layers, const ggml_type kv_type) override {    \
       if (context_length > 0) {                                            \
         model_.hparams.n_ctx = context_length;                             \
       }                                                                    \
+      if (kv_type != GGML_TYPE_COUNT) {                                    \
+        model_.memory_type = kv_type;                                      \
+      }                                                                    \
       if (!_name##_model_load(filename, model_, vocab_)) {                 \
         return false;                                                      \
       }                                                                    \
@@ -213,12 +363,10 @@ class LLM {
                                                                            \
     bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads, \
               const int n_past) override {                                 \
-      return _name##_eval(model_, threads, n_past, tokens, logits_,        \
-                          mem_per_token_);                                 \
+      return ReserveKV(n_past, tokens.size()) &&                           \
+             _name##_eval(model_, seq_, threads, n_past, tokens, logits_,  \
+                          mem_per_token_, ThreadPool(threads));            \
     }                                                                      \
-                                                                           \
-   private:                                                                \
-    _name##_model model_;                                                  \
   }
 
 #endif
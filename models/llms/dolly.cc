@@ -53,8 +53,8 @@ struct dollyv2_model {
   std::vector<dollyv2_layer> layers;
 
   // key + value memory
-  struct ggml_tensor *memory_k;
-  struct ggml_tensor *memory_v;
+  ggml_type memory_type = GGML_TYPE_F16;
+  KVCache kv;
 
   //
   struct ggml_context *ctx;
@@ -141,7 +141,6 @@ bool dollyv2_model_load(const std::string &fname, dollyv2_model &model,
 
     const int n_embd = hparams.n_embd;
     const int n_layer = hparams.n_layer;
-    const int n_ctx = hparams.n_ctx;
     const int n_vocab = hparams.n_vocab;
 
     ctx_size += n_embd * ggml_type_sizef(GGML_TYPE_F32);  // ln_f_g
@@ -178,11 +177,6 @@ bool dollyv2_model_load(const std::string &fname, dollyv2_model &model,
     ctx_size +=
         n_layer * (n_embd * ggml_type_sizef(GGML_TYPE_F32));  // c_mlp_proj_b
 
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_k
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_v
-
     ctx_size += (6 + 16 * n_layer) * 512;  // object overhead
   }
 
@@ -293,14 +287,16 @@ bool dollyv2_model_load(const std::string &fname, dollyv2_model &model,
     const int n_layer = hparams.n_layer;
     const int n_ctx = hparams.n_ctx;
 
-    const int64_t n_mem = n_layer * n_ctx;
-    const int64_t n_elements = n_embd * n_mem;
+    if (!ct_kv_type_check(model.memory_type, n_embd / hparams.n_head)) {
+      return false;
+    }
 
-    model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
-    model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
+    if (!model.kv.Init(ctx, model.memory_type, n_layer, n_embd, n_ctx)) {
+      return false;
+    }
 
     const size_t memory_size =
-        ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
+        ggml_nbytes(model.kv.memory_k) + ggml_nbytes(model.kv.memory_v);
   }
 
   // load weights
@@ -385,24 +381,18 @@ bool dollyv2_model_load(const std::string &fname, dollyv2_model &model,
 // feed-forward network
 ggml_tensor *gpt_neox_ff(const dollyv2_layer &layer, ggml_context *ctx0,
                          ggml_tensor *inp) {
-  ggml_tensor *cur = ggml_norm(ctx0, inp);
-
-  cur =
-      ggml_add(ctx0, ggml_mul(ctx0, ggml_repeat(ctx0, layer.ln_2_g, cur), cur),
-               ggml_repeat(ctx0, layer.ln_2_b, cur));
+  ggml_tensor *cur = ggml_norm_affine(ctx0, inp, layer.ln_2_g, layer.ln_2_b);
 
   cur = ggml_mul_mat(ctx0, layer.c_mlp_fc_w, cur);
 
-  cur = ggml_add(ctx0, ggml_repeat(ctx0, layer.c_mlp_fc_b, cur), cur);
-
   // GELU activation
-  cur = ggml_gelu(ctx0, cur);
+  cur = ggml_bias_act(ctx0, cur, layer.c_mlp_fc_b, GGML_ACT_OP_GELU);
 
   // projection
   // cur = proj_w*cur + proj_b
   cur = ggml_mul_mat(ctx0, layer.c_mlp_proj_w, cur);
 
-  cur = ggml_add(ctx0, ggml_repeat(ctx0, layer.c_mlp_proj_b, cur), cur);
+  cur = ggml_add(ctx0, cur, layer.c_mlp_proj_b);
   return cur;
 }
 
@@ -414,16 +404,17 @@ ggml_tensor *gpt_neox_ff(const dollyv2_layer &layer, ggml_context *ctx0,
 //   - embd_inp:  the embeddings of the tokens in the context
 //   - embd_w:    the predicted logits for the next token
 //
-bool dollyv2_eval(const dollyv2_model &model, const int n_threads,
-                  const int n_past, const std::vector<gpt_vocab::id> &embd_inp,
-                  std::vector<float> &embd_w, size_t &mem_per_token) {
+bool dollyv2_eval(const dollyv2_model &model, const KVCache::Sequence &kv_seq,
+                  const int n_threads, const int n_past,
+                  const std::vector<gpt_vocab::id> &embd_inp,
+                  std::vector<float> &embd_w, size_t &mem_per_token,
+                  ggml_threadpool *threadpool) {
   const int N = embd_inp.size();
 
   const auto &hparams = model.hparams;
 
   const int n_embd = hparams.n_embd;
   const int n_layer = hparams.n_layer;
-  const int n_ctx = hparams.n_ctx;
   const int n_head = hparams.n_head;
   const int n_vocab = hparams.n_vocab;
   const int n_rot = hparams.n_rot;
@@ -462,27 +453,23 @@ bool dollyv2_eval(const dollyv2_model &model, const int n_threads,
   // wte
   struct ggml_tensor *inpL = ggml_get_rows(ctx0, model.wte, embd);
 
+  struct ggml_tensor *kv_rows = model.kv.Rows(ctx0, kv_seq);
+
   for (int il = 0; il < n_layer; ++il) {
     struct ggml_tensor *cur;
 
     // self-attention
     {
       {
-        cur = ggml_norm(ctx0, inpL);
-
-        cur = ggml_add(
-            ctx0,
-            ggml_mul(ctx0, ggml_repeat(ctx0, model.layers[il].ln_1_g, cur),
-                     cur),
-            ggml_repeat(ctx0, model.layers[il].ln_1_b, cur));
+        cur = ggml_norm_affine(ctx0, inpL, model.layers[il].ln_1_g,
+                               model.layers[il].ln_1_b);
       }
 
       // compute QKV
       {
         cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_attn_w, cur);
 
-        cur = ggml_add(
-            ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_attn_b, cur), cur);
+        cur = ggml_add(ctx0, cur, model.layers[il].c_attn_attn_b);
       }
 
       struct ggml_tensor *Qcur =
@@ -504,75 +491,28 @@ bool dollyv2_eval(const dollyv2_model &model, const int n_threads,
 
       // store key and value to memory
       {
-        Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_embd, N));
-
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, model.memory_k, N * n_embd,
-                         (ggml_element_size(model.memory_k) * n_embd) *
-                             (il * n_ctx + n_past));
-        struct ggml_tensor *v = ggml_view_2d(
-            ctx0, model.memory_v, N, n_embd,
-            (n_ctx)*ggml_element_size(model.memory_v),
-            (il * n_ctx) * ggml_element_size(model.memory_v) * n_embd +
-                n_past * ggml_element_size(model.memory_v));
-
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+        Vcur = ggml_reshape_2d(ctx0, Vcur, n_embd, N);
+
+        model.kv.Store(ctx0, &gf, kv_rows, Kcur, Vcur, il);
       }
 
       // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0, 2, 1,
       // 3)
       struct ggml_tensor *Q = ggml_permute(ctx0, Qcur, 0, 2, 1, 3);
 
-      // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
-      struct ggml_tensor *K = ggml_permute(
-          ctx0,
-          ggml_reshape_3d(
-              ctx0,
-              ggml_view_1d(
-                  ctx0, model.memory_k, (n_past + N) * n_embd,
-                  il * n_ctx * ggml_element_size(model.memory_k) * n_embd),
-              n_embd / n_head, n_head, n_past + N),
-          0, 2, 1, 3);
-
-      // K * Q
-      struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
-
-      // KQ_scaled = KQ / sqrt(n_embd/n_head)
-      struct ggml_tensor *KQ_scaled = ggml_scale_inplace(
-          ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(n_embd) / n_head)));
-
-      // KQ_masked = mask_past(KQ_scaled)
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf_inplace(ctx0, KQ_scaled, n_past);
-
-      // KQ = soft_max(KQ_masked)
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max_inplace(ctx0, KQ_masked);
-
-      // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0,
-      // 3).contiguous()
-      struct ggml_tensor *V = ggml_view_3d(
-          ctx0, model.memory_v, n_past + N, n_embd / n_head, n_head,
-          n_ctx * ggml_element_size(model.memory_v),
-          n_ctx * ggml_element_size(model.memory_v) * n_embd / n_head,
-          il * n_ctx * ggml_element_size(model.memory_v) * n_embd);
-
-      // KQV = transpose(V) * KQ_soft_max
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
-
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-
-      // cur = KQV_merged.contiguous().view(n_embd, N)
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+      // KQV = soft_max(mask_past(K * Q / sqrt(n_embd/n_head))) * V
+      struct ggml_tensor *KQV =
+          model.kv.Attention(ctx0, Q, kv_rows, n_head, il,
+                             1.0f / sqrt(float(n_embd) / n_head), 0.0f);
+
+      // cur = KQV.view(n_embd, N)
+      cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
 
       // projection
       {
         cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_proj_w, cur);
 
-        cur = ggml_add(
-            ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_proj_b, cur), cur);
+        cur = ggml_add(ctx0, cur, model.layers[il].c_attn_proj_b);
       }
     }
 
@@ -600,12 +540,8 @@ bool dollyv2_eval(const dollyv2_model &model, const int n_threads,
 
   // norm
   {
-    inpL = ggml_norm(ctx0, inpL);
-
-    // inpL = ln_f_g*inpL + ln_f_b
-    inpL = ggml_add(ctx0,
-                    ggml_mul(ctx0, ggml_repeat(ctx0, model.ln_f_g, inpL), inpL),
-                    ggml_repeat(ctx0, model.ln_f_b, inpL));
+    // inpL = ln_f_g*norm(inpL) + ln_f_b
+    inpL = ggml_norm_affine(ctx0, inpL, model.ln_f_g, model.ln_f_b);
   }
 
   // lm_head
@@ -622,7 +558,7 @@ bool dollyv2_eval(const dollyv2_model &model, const int n_threads,
 
   // run the computation
   ggml_build_forward_expand(&gf, inpL);
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads, threadpool);
 
   // if (n_past%100 == 0) {
   //    ggml_graph_print   (&gf);
@@ -84,13 +84,22 @@ class falcon_llm : public LLM {
 
  protected:
   bool Load(const std::string &filename, const int context_length,
-            const int gpu_layers) override {
+            const int gpu_layers, const ggml_type kv_type) override {
     falcon_context_params params = falcon_context_default_params();
     params.embedding = true;
     if (context_length > 0) {
       params.n_ctx = context_length;
     }
     params.n_gpu_layers = gpu_layers;
+    // The falcon graph reads V through ggml_cpy and ggml_mul_mat, which do not
+    // support quantized types.
+    if (kv_type == GGML_TYPE_F32) {
+      params.f16_kv = false;
+    } else if (kv_type != GGML_TYPE_COUNT && kv_type != GGML_TYPE_F16) {
+      fprintf(stderr,
+              "KV cache type '%s' is not supported by falcon, using f16.\n",
+              ggml_type_name(kv_type));
+    }
 
     ctx_ = falcon_init_from_file(filename.c_str(), params);
     if (ctx_ == nullptr) {
@@ -102,6 +111,7 @@ class falcon_llm : public LLM {
 
   bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads,
             const int n_past) override {
+    falcon_set_threadpool(ctx_, ThreadPool(threads));
     const int status = falcon_eval(ctx_, tokens.data(), tokens.size(), n_past,
                                    threads, /*debug_timings=*/0);
     return status == 0;
@@ -49,8 +49,8 @@ struct gpt2_model {
   std::vector<gpt2_layer> layers;
 
   // key + value memory
-  struct ggml_tensor *memory_k;
-  struct ggml_tensor *memory_v;
+  ggml_type memory_type = GGML_TYPE_F32;
+  KVCache kv;
 
   //
   struct ggml_context *ctx;
@@ -174,11 +174,6 @@ bool gpt2_model_load(const std::string &fname, gpt2_model &model,
     ctx_size +=
         n_layer * (n_embd * ggml_type_sizef(GGML_TYPE_F32));  // c_mlp_proj_b
 
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_k
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_v
-
     ctx_size += (6 + 12 * n_layer) * 512;  // object overhead
   }
 
@@ -281,14 +276,16 @@ bool gpt2_model_load(const std::string &fname, gpt2_model &model,
     const int n_layer = hparams.n_layer;
     const int n_ctx = hparams.n_ctx;
 
-    const int n_mem = n_layer * n_ctx;
-    const int n_elements = n_embd * n_mem;
+    if (!ct_kv_type_check(model.memory_type, n_embd / hparams.n_head)) {
+      return false;
+    }
 
-    model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
-    model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
+    if (!model.kv.Init(ctx, model.memory_type, n_layer, n_embd, n_ctx)) {
+      return false;
+    }
 
     const size_t memory_size =
-        ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
+        ggml_nbytes(model.kv.memory_k) + ggml_nbytes(model.kv.memory_v);
   }
 
   // load weights
@@ -388,16 +385,17 @@ bool gpt2_model_load(const std::string &fname, gpt2_model &model,
 //   - embd_inp:  the embeddings of the tokens in the context
 //   - embd_w:    the predicted logits for the next token
 //
-bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
+bool gpt2_eval(const gpt2_model &model, const KVCache::Sequence &kv_seq,
+               const int n_threads, const int n_past,
                const std::vector<gpt_vocab::id> &embd_inp,
-               std::vector<float> &embd_w, size_t &mem_per_token) {
+               std::vector<float> &embd_w, size_t &mem_per_token,
+               ggml_threadpool *threadpool) {
   const int N = embd_inp.size();
 
   const auto &hparams = model.hparams;
 
   const int n_embd = hparams.n_embd;
   const int n_layer = hparams.n_layer;
-  const int n_ctx = hparams.n_ctx;
   const int n_head = hparams.n_head;
   const int n_vocab = hparams.n_vocab;
 
@@ -442,20 +440,17 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
       ggml_add(ctx0, ggml_get_rows(ctx0, model.wte, embd),
                ggml_get_rows(ctx0, model.wpe, position));
 
+  struct ggml_tensor *kv_rows = model.kv.Rows(ctx0, kv_seq);
+
   for (int il = 0; il < n_layer; ++il) {
     struct ggml_tensor *cur;
 
     // norm
     {
+      // cur = ln_1_g*norm(inpL) + ln_1_b
       // [ 768, N]
-      cur = ggml_norm(ctx0, inpL);
-
-      // cur = ln_1_g*cur + ln_1_b
-      // [ 768, N]
-      cur = ggml_add(
-          ctx0,
-          ggml_mul(ctx0, ggml_repeat(ctx0, model.layers[il].ln_1_g, cur), cur),
-          ggml_repeat(ctx0, model.layers[il].ln_1_b, cur));
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].ln_1_g,
+                             model.layers[il].ln_1_b);
     }
 
     // attn
@@ -469,8 +464,7 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
     {
       cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_attn_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_attn_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_attn_attn_b);
     }
 
     // self-attention
@@ -484,17 +478,7 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
 
       // store key and value to memory
       if (N >= 1) {
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, model.memory_k, N * n_embd,
-                         (ggml_element_size(model.memory_k) * n_embd) *
-                             (il * n_ctx + n_past));
-        struct ggml_tensor *v =
-            ggml_view_1d(ctx0, model.memory_v, N * n_embd,
-                         (ggml_element_size(model.memory_v) * n_embd) *
-                             (il * n_ctx + n_past));
-
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+        model.kv.Store(ctx0, &gf, kv_rows, Kcur, Vcur, il);
       }
 
       // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0, 2, 1,
@@ -506,79 +490,15 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
                                                    n_embd / n_head, n_head, N)),
                        0, 2, 1, 3);
 
-      // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
-      // [64, n_past + N, 12]
-      struct ggml_tensor *K = ggml_permute(
-          ctx0,
-          ggml_reshape_3d(
-              ctx0,
-              ggml_view_1d(
-                  ctx0, model.memory_k, (n_past + N) * n_embd,
-                  il * n_ctx * ggml_element_size(model.memory_k) * n_embd),
-              n_embd / n_head, n_head, n_past + N),
-          0, 2, 1, 3);
-
-      // GG: flash attention
-      // struct ggml_tensor * V =
-      //    ggml_cpy(ctx0,
-      //            ggml_permute(ctx0,
-      //                ggml_reshape_3d(ctx0,
-      //                    ggml_view_1d(ctx0, model.memory_v, (n_past +
-      //                    N)*n_embd,
-      //                    il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
-      //                    n_embd/n_head, n_head, n_past + N),
-      //                1, 2, 0, 3),
-      //            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_past + N,
-      //            n_embd/n_head, n_head));
-
-      // struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, V, true);
-
-      // K * Q
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
-
-      // KQ_scaled = KQ / sqrt(n_embd/n_head)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_scaled = ggml_scale_inplace(
-          ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(n_embd) / n_head)));
-
-      // KQ_masked = mask_past(KQ_scaled)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf_inplace(ctx0, KQ_scaled, n_past);
-
-      // KQ = soft_max(KQ_masked)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max_inplace(ctx0, KQ_masked);
-
-      // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0,
-      // 3).contiguous() [n_past + N, 64, 12]
-      struct ggml_tensor *V_trans = ggml_cpy(
-          ctx0,
-          ggml_permute(
-              ctx0,
-              ggml_reshape_3d(
-                  ctx0,
-                  ggml_view_1d(
-                      ctx0, model.memory_v, (n_past + N) * n_embd,
-                      il * n_ctx * ggml_element_size(model.memory_v) * n_embd),
-                  n_embd / n_head, n_head, n_past + N),
-              1, 2, 0, 3),
-          ggml_new_tensor_3d(ctx0, model.memory_v->type, n_past + N,
-                             n_embd / n_head, n_head));
-
-      // KQV = transpose(V) * KQ_soft_max
-      // [64, N, 12]
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
-
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
+      // KQV = soft_max(mask_past(K * Q / sqrt(n_embd/n_head))) * V
       // [64, 12, N]
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+      struct ggml_tensor *KQV =
+          model.kv.Attention(ctx0, Q, kv_rows, n_head, il,
+                             1.0f / sqrt(float(n_embd) / n_head), 0.0f);
 
-      // cur = KQV_merged.contiguous().view(n_embd, N)
+      // cur = KQV.view(n_embd, N)
       // [768, N]
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+      cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
     }
 
     // projection
@@ -592,8 +512,7 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
     {
       cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_proj_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_proj_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_attn_proj_b);
     }
 
     // add the input
@@ -605,15 +524,10 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
     {
       // norm
       {
-        cur = ggml_norm(ctx0, inpFF);
-
-        // cur = ln_2_g*cur + ln_2_b
+        // cur = ln_2_g*norm(inpFF) + ln_2_b
         // [ 768, N]
-        cur = ggml_add(
-            ctx0,
-            ggml_mul(ctx0, ggml_repeat(ctx0, model.layers[il].ln_2_g, cur),
-                     cur),
-            ggml_repeat(ctx0, model.layers[il].ln_2_b, cur));
+        cur = ggml_norm_affine(ctx0, inpFF, model.layers[il].ln_2_g,
+                               model.layers[il].ln_2_b);
       }
 
       // fully connected
@@ -626,12 +540,10 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
       // [3072, N]
       cur = ggml_mul_mat(ctx0, model.layers[il].c_mlp_fc_w, cur);
 
-      cur = ggml_add(ctx0, ggml_repeat(ctx0, model.layers[il].c_mlp_fc_b, cur),
-                     cur);
-
       // GELU activation
       // [3072, N]
-      cur = ggml_gelu(ctx0, cur);
+      cur = ggml_bias_act(ctx0, cur, model.layers[il].c_mlp_fc_b,
+                          GGML_ACT_OP_GELU);
 
       // projection
       // [ 768, 3072] - model.layers[il].c_mlp_proj_w
@@ -643,8 +555,7 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
       // [768, N]
       cur = ggml_mul_mat(ctx0, model.layers[il].c_mlp_proj_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_mlp_proj_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_mlp_proj_b);
     }
 
     // input for next layer
@@ -653,14 +564,9 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
 
   // norm
   {
+    // inpL = ln_f_g*norm(inpL) + ln_f_b
     // [ 768, N]
-    inpL = ggml_norm(ctx0, inpL);
-
-    // inpL = ln_f_g*inpL + ln_f_b
-    // [ 768, N]
-    inpL = ggml_add(ctx0,
-                    ggml_mul(ctx0, ggml_repeat(ctx0, model.ln_f_g, inpL), inpL),
-                    ggml_repeat(ctx0, model.ln_f_b, inpL));
+    inpL = ggml_norm_affine(ctx0, inpL, model.ln_f_g, model.ln_f_b);
   }
 
   // inpL = WTE * inpL
@@ -673,7 +579,7 @@ bool gpt2_eval(const gpt2_model &model, const int n_threads, const int n_past,
 
   // run the computation
   ggml_build_forward_expand(&gf, inpL);
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads, threadpool);
 
   // if (n_past%100 == 0) {
   //    ggml_graph_print   (&gf);
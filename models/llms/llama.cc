@@ -83,13 +83,18 @@ class llama_llm : public LLM {
 
  protected:
   bool Load(const std::string &filename, const int context_length,
-            const int gpu_layers) override {
+            const int gpu_layers, const ggml_type kv_type) override {
     llama_context_params params = llama_context_default_params();
     params.embedding = true;
+    // The fused and repacked copies are kept next to the mapped weights,
+    // which then take up more memory.
+    params.fuse_weights = fuse_weights_;
+    params.repack_weights = repack_weights_;
     if (context_length > 0) {
       params.n_ctx = context_length;
     }
     params.n_gpu_layers = gpu_layers;
+    params.kv_type = kv_type;
     std::regex pattern_70b(R"((\b|_)70b(\b|_))", std::regex_constants::icase);
     if (std::regex_search(filename, pattern_70b)) {
       params.n_gqa = 8;
@@ -107,11 +112,33 @@ class llama_llm : public LLM {
 
   bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads,
             const int n_past) override {
+    llama_set_threadpool(ctx_, ThreadPool(threads));
     const int status =
         llama_eval(ctx_, tokens.data(), tokens.size(), n_past, threads);
     return status == 0;
   }
 
+  void ClearCache() override { kv_cache_clear(ctx_->kv_self); }
+
+#if !defined(GGML_USE_CUBLAS) && !defined(GGML_USE_METAL)
+  size_t KVTokenSize() const override {
+    return kv_cache_token_size(ctx_->model.hparams, ctx_->kv_self);
+  }
+
+  void SaveKV(const int n_tokens, char *data) const override {
+    kv_cache_copy_tokens(ctx_->model.hparams, ctx_->kv_self, n_tokens, data,
+                         /*save=*/true);
+  }
+
+  bool LoadKV(const int n_tokens, const char *data) override {
+    kv_cache_clear(ctx_->kv_self);
+    kv_cache_copy_tokens(ctx_->model.hparams, ctx_->kv_self, n_tokens,
+                         const_cast<char *>(data), /*save=*/false);
+    ctx_->kv_self.n = n_tokens;
+    return true;
+  }
+#endif
+
  private:
   llama_context *ctx_ = nullptr;
 };
@@ -40,8 +40,8 @@ struct mpt_model {
   std::vector<mpt_layer> layers;
 
   // key + value memory
-  struct ggml_tensor *memory_k;
-  struct ggml_tensor *memory_v;
+  ggml_type memory_type = GGML_TYPE_F16;
+  KVCache kv;
 
   struct ggml_context *ctx;
   std::map<std::string, struct ggml_tensor *> tensors;
@@ -152,11 +152,6 @@ bool mpt_model_load(const std::string &fname, mpt_model &model,
     ctx_size += n_layer * (n_embd * n_embd * 4 *
                            ggml_type_sizef(wtype));  // mlp_mlp_down_weight
 
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F16);  // memory_k
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F16);  // memory_v
-
     ctx_size += (1 + 6 * n_layer) * 512;  // object overhead
   }
 
@@ -228,14 +223,16 @@ bool mpt_model_load(const std::string &fname, mpt_model &model,
     const size_t n_embd = hparams.d_model;
     const size_t n_layer = hparams.n_layers;
 
-    const int64_t n_mem = n_layer * n_ctx;
-    const int64_t n_elements = n_embd * n_mem;
+    if (!ct_kv_type_check(model.memory_type, n_embd / hparams.n_heads)) {
+      return false;
+    }
 
-    model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
-    model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
+    if (!model.kv.Init(ctx, model.memory_type, n_layer, n_embd, n_ctx)) {
+      return false;
+    }
 
     const size_t memory_size =
-        ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
+        ggml_nbytes(model.kv.memory_k) + ggml_nbytes(model.kv.memory_v);
   }
 
   // load weights
@@ -327,9 +324,11 @@ bool mpt_model_load(const std::string &fname, mpt_model &model,
 //   - embd_inp:  the embeddings of the tokens in the context
 //   - embd_w:    the predicted logits for the next token
 //
-bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
+bool mpt_eval(const mpt_model &model, const KVCache::Sequence &kv_seq,
+              const int n_threads, const int n_past,
               const std::vector<gpt_vocab::id> &embd_inp,
-              std::vector<float> &embd_w, size_t &mem_per_token) {
+              std::vector<float> &embd_w, size_t &mem_per_token,
+              ggml_threadpool *threadpool) {
   const bool logits_all = false;
   const int N = embd_inp.size();
 
@@ -339,7 +338,6 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
   const int n_layer = hparams.n_layers;
   const int n_head = hparams.n_heads;
   const int n_vocab = hparams.n_vocab;
-  const int n_ctx = hparams.n_ctx;
 
   static size_t buf_size = 256u * 1024 * 1024;
   static void *buf = malloc(buf_size);
@@ -382,6 +380,8 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
   struct ggml_tensor *inpL = ggml_get_rows(ctx0, model.wte_weight, embd);
 
+  struct ggml_tensor *kv_rows = model.kv.Rows(ctx0, kv_seq);
+
   for (int il = 0; il < n_layer; ++il) {
     struct ggml_tensor *cur;
 
@@ -393,10 +393,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
     // a = self.ln_1(x)
     {
-      cur = ggml_norm(ctx0, inpL);
-
-      cur = ggml_mul(
-          ctx0, ggml_repeat(ctx0, model.layers[il].norm_1_weight, cur), cur);
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].norm_1_weight, NULL);
     }
 
     // self-attention
@@ -421,17 +418,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
       // store key and value to memory
       {
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, model.memory_k, N * n_embd,
-                         (ggml_element_size(model.memory_k) * n_embd) *
-                             (il * n_ctx + n_past));
-        struct ggml_tensor *v =
-            ggml_view_1d(ctx0, model.memory_v, N * n_embd,
-                         (ggml_element_size(model.memory_v) * n_embd) *
-                             (il * n_ctx + n_past));
-
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+        model.kv.Store(ctx0, &gf, kv_rows, Kcur, Vcur, il);
       }
 
       // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0,
@@ -443,59 +430,14 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
                                                    n_embd / n_head, n_head, N)),
                        0, 2, 1, 3);
 
-      // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1,
-      // 3) [64, n_past + N, 12]
-      struct ggml_tensor *K = ggml_permute(
-          ctx0,
-          ggml_reshape_3d(
-              ctx0,
-              ggml_view_1d(
-                  ctx0, model.memory_k, (n_past + N) * n_embd,
-                  il * n_ctx * ggml_element_size(model.memory_k) * n_embd),
-              n_embd / n_head, n_head, n_past + N),
-          0, 2, 1, 3);
-      // K * Q
-      struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
-
-      // KQ_scaled = KQ / sqrt(n_embd/n_head)
-      struct ggml_tensor *KQ_scaled = ggml_scale(
-          ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(n_embd) / n_head)));
-
-      struct ggml_tensor *KQ_scaled_alibi = ggml_alibi(
-          ctx0, KQ_scaled, n_past, n_head, model.hparams.alibi_bias_max);
-
-      // KQ_masked = mask_past(KQ_scaled)
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf(ctx0, KQ_scaled_alibi, n_past);
-
-      // KQ = soft_max(KQ_masked)
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max(ctx0, KQ_masked);
-
-      // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1,
-      // 2, 0, 3).contiguous() [n_past + N, 64, 12]
-      struct ggml_tensor *V_trans = ggml_cpy(
-          ctx0,
-          ggml_permute(
-              ctx0,
-              ggml_reshape_3d(
-                  ctx0,
-                  ggml_view_1d(
-                      ctx0, model.memory_v, (n_past + N) * n_embd,
-                      il * n_ctx * ggml_element_size(model.memory_v) * n_embd),
-                  n_embd / n_head, n_head, n_past + N),
-              1, 2, 0, 3),
-          ggml_new_tensor_3d(ctx0, model.memory_v->type, n_past + N,
-                             n_embd / n_head, n_head));
-
-      // KQV = transpose(V) * KQ_soft_max
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
-
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-
-      // cur = KQV_merged.contiguous().view(n_embd, N)
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+      // KQV = soft_max(mask_past(alibi(K * Q / sqrt(n_embd/n_head)))) * V
+      struct ggml_tensor *KQV =
+          model.kv.Attention(ctx0, Q, kv_rows, n_head, il,
+                             1.0f / sqrt(float(n_embd) / n_head),
+                             model.hparams.alibi_bias_max);
+
+      // cur = KQV.view(n_embd, N)
+      cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
 
       // projection
       {
@@ -513,10 +455,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
     // m = self.ln_2(x)
     {
-      cur = ggml_norm(ctx0, inpL);
-
-      cur = ggml_mul(
-          ctx0, ggml_repeat(ctx0, model.layers[il].norm_2_weight, cur), cur);
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].norm_2_weight, NULL);
     }
 
     // n = self.mlp(m)
@@ -524,7 +463,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
       cur = ggml_mul_mat(ctx0, model.layers[il].ffn_up_proj, cur);
 
       // GELU activation
-      cur = ggml_gelu(ctx0, cur);
+      cur = ggml_bias_act(ctx0, cur, NULL, GGML_ACT_OP_GELU);
 
       // projection
       // cur = proj_w*cur + proj_b
@@ -543,9 +482,8 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
   // norm
   {
-    inpL = ggml_norm(ctx0, inpL);
-    // inpL = ln_f_g*inpL
-    inpL = ggml_mul(ctx0, ggml_repeat(ctx0, model.norm_f_weight, inpL), inpL);
+    // inpL = ln_f_g*norm(inpL)
+    inpL = ggml_norm_affine(ctx0, inpL, model.norm_f_weight, NULL);
   }
 
   ggml_set_scratch(ctx0, {
@@ -562,7 +500,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
 
   // run the computation
   ggml_build_forward_expand(&gf, inpL);
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads, threadpool);
 
   // std::cout << "Qcur" << std::endl;
   // print_tensor(Qcur);
@@ -594,7 +532,7 @@ bool mpt_eval(const mpt_model &model, const int n_threads, const int n_past,
   return true;
 }
 
-class mpt_llm : public LLM {
+class mpt_llm : public KVCacheLLM<mpt_model> {
  public:
   virtual ~mpt_llm() {
     ct_free(model_.tensors);
@@ -605,10 +543,13 @@ class mpt_llm : public LLM {
 
  protected:
   bool Load(const std::string &filename, const int context_length,
-            const int gpu_layers) override {
+            const int gpu_layers, const ggml_type kv_type) override {
     if (context_length > 0) {
       model_.hparams.n_ctx = context_length;
     }
+    if (kv_type != GGML_TYPE_COUNT) {
+      model_.memory_type = kv_type;
+    }
     if (!mpt_model_load(filename, model_, vocab_, gpu_layers)) {
       return false;
     }
@@ -618,9 +559,8 @@ class mpt_llm : public LLM {
 
   bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads,
             const int n_past) override {
-    return mpt_eval(model_, threads, n_past, tokens, logits_, mem_per_token_);
+    return ReserveKV(n_past, tokens.size()) &&
+           mpt_eval(model_, seq_, threads, n_past, tokens, logits_,
+                    mem_per_token_, ThreadPool(threads));
   }
-
- private:
-  mpt_model model_;
 };
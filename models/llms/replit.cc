@@ -47,8 +47,8 @@ struct replit_model {
   std::vector<replit_layer> layers;
 
   // key + value memory
-  struct ggml_tensor *memory_k;
-  struct ggml_tensor *memory_v;
+  ggml_type memory_type = GGML_TYPE_F16;
+  KVCache kv;
 
   struct ggml_context *ctx;
   std::map<std::string, struct ggml_tensor *> tensors;
@@ -213,7 +213,6 @@ bool replit_model_load(const std::string &fname, replit_model &model,
 
     const int n_embd = hparams.d_model;
     const int n_layer = hparams.n_layers;
-    const int n_ctx = hparams.max_seq_len;
     const int n_vocab = hparams.n_vocab;
 
     ctx_size += n_embd * n_vocab * ggml_type_sizef(wtype);  // wte_weight
@@ -232,11 +231,6 @@ bool replit_model_load(const std::string &fname, replit_model &model,
     ctx_size += n_layer * (n_embd * n_embd * 4 *
                            ggml_type_sizef(wtype));  // mlp_mlp_down_weight
 
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F16);  // memory_k
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F16);  // memory_v
-
     ctx_size += (1 + 6 * n_layer) * 512;  // object overhead
   }
 
@@ -308,14 +302,16 @@ bool replit_model_load(const std::string &fname, replit_model &model,
     const int n_layer = hparams.n_layers;
     const int n_ctx = hparams.max_seq_len;
 
-    const int64_t n_mem = n_layer * n_ctx;
-    const int64_t n_elements = n_embd * n_mem;
+    if (!ct_kv_type_check(model.memory_type, n_embd / hparams.n_heads)) {
+      return false;
+    }
 
-    model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
-    model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, n_elements);
+    if (!model.kv.Init(ctx, model.memory_type, n_layer, n_embd, n_ctx)) {
+      return false;
+    }
 
     const size_t memory_size =
-        ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
+        ggml_nbytes(model.kv.memory_k) + ggml_nbytes(model.kv.memory_v);
   }
 
   // load weights
@@ -400,9 +396,11 @@ bool replit_model_load(const std::string &fname, replit_model &model,
 //   - embd_inp:  the embeddings of the tokens in the context
 //   - embd_w:    the predicted logits for the next token
 //
-bool replit_eval(const replit_model &model, const int n_threads,
-                 const int n_past, const std::vector<gpt_vocab::id> &embd_inp,
-                 std::vector<float> &embd_w, size_t &mem_per_token) {
+bool replit_eval(const replit_model &model, const KVCache::Sequence &kv_seq,
+                 const int n_threads, const int n_past,
+                 const std::vector<gpt_vocab::id> &embd_inp,
+                 std::vector<float> &embd_w, size_t &mem_per_token,
+                 ggml_threadpool *threadpool) {
   const bool logits_all = false;
   const int N = embd_inp.size();
 
@@ -412,7 +410,6 @@ bool replit_eval(const replit_model &model, const int n_threads,
   const int n_layer = hparams.n_layers;
   const int n_head = hparams.n_heads;
   const int n_vocab = hparams.n_vocab;
-  const int n_ctx = hparams.max_seq_len;
 
   static size_t buf_size = 256u * 1024 * 1024;
   static void *buf = malloc(buf_size);
@@ -447,15 +444,14 @@ bool replit_eval(const replit_model &model, const int n_threads,
 
   struct ggml_tensor *inpL = ggml_get_rows(ctx0, model.wte_weight, embd);
 
+  struct ggml_tensor *kv_rows = model.kv.Rows(ctx0, kv_seq);
+
   for (int il = 0; il < n_layer; ++il) {
     struct ggml_tensor *cur;
 
     // a = self.ln_1(x)
     {
-      cur = ggml_norm(ctx0, inpL);
-
-      cur = ggml_mul(
-          ctx0, ggml_repeat(ctx0, model.layers[il].norm_1_weight, cur), cur);
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].norm_1_weight, NULL);
     }
 
     // self-attention
@@ -475,17 +471,7 @@ bool replit_eval(const replit_model &model, const int n_threads,
 
       // store key and value to memory
       {
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, model.memory_k, N * n_embd,
-                         (ggml_element_size(model.memory_k) * n_embd) *
-                             (il * n_ctx + n_past));
-        struct ggml_tensor *v =
-            ggml_view_1d(ctx0, model.memory_v, N * n_embd,
-                         (ggml_element_size(model.memory_v) * n_embd) *
-                             (il * n_ctx + n_past));
-
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+        model.kv.Store(ctx0, &gf, kv_rows, Kcur, Vcur, il);
       }
 
       // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0,
@@ -497,59 +483,13 @@ bool replit_eval(const replit_model &model, const int n_threads,
                                                    n_embd / n_head, n_head, N)),
                        0, 2, 1, 3);
 
-      // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1,
-      // 3) [64, n_past + N, 12]
-      struct ggml_tensor *K = ggml_permute(
-          ctx0,
-          ggml_reshape_3d(
-              ctx0,
-              ggml_view_1d(
-                  ctx0, model.memory_k, (n_past + N) * n_embd,
-                  il * n_ctx * ggml_element_size(model.memory_k) * n_embd),
-              n_embd / n_head, n_head, n_past + N),
-          0, 2, 1, 3);
-      // K * Q
-      struct ggml_tensor *KQ = ggml_mul_mat(ctx0, K, Q);
-
-      // KQ_scaled = KQ / sqrt(n_embd/n_head)
-      struct ggml_tensor *KQ_scaled = ggml_scale(
-          ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(n_embd) / n_head)));
-
-      struct ggml_tensor *KQ_scaled_alibi =
-          ggml_alibi(ctx0, KQ_scaled, n_past, n_head, 8.0f);
-
-      // KQ_masked = mask_past(KQ_scaled)
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf(ctx0, KQ_scaled_alibi, n_past);
-
-      // KQ = soft_max(KQ_masked)
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max(ctx0, KQ_masked);
-
-      // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1,
-      // 2, 0, 3).contiguous() [n_past + N, 64, 12]
-      struct ggml_tensor *V_trans = ggml_cpy(
-          ctx0,
-          ggml_permute(
-              ctx0,
-              ggml_reshape_3d(
-                  ctx0,
-                  ggml_view_1d(
-                      ctx0, model.memory_v, (n_past + N) * n_embd,
-                      il * n_ctx * ggml_element_size(model.memory_v) * n_embd),
-                  n_embd / n_head, n_head, n_past + N),
-              1, 2, 0, 3),
-          ggml_new_tensor_3d(ctx0, model.memory_v->type, n_past + N,
-                             n_embd / n_head, n_head));
-
-      // KQV = transpose(V) * KQ_soft_max
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
-
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-
-      // cur = KQV_merged.contiguous().view(n_embd, N)
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+      // KQV = soft_max(mask_past(alibi(K * Q / sqrt(n_embd/n_head)))) * V
+      struct ggml_tensor *KQV =
+          model.kv.Attention(ctx0, Q, kv_rows, n_head, il,
+                             1.0f / sqrt(float(n_embd) / n_head), 8.0f);
+
+      // cur = KQV.view(n_embd, N)
+      cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
 
       // projection
       {
@@ -561,10 +501,7 @@ bool replit_eval(const replit_model &model, const int n_threads,
 
     // m = self.ln_2(x)
     {
-      cur = ggml_norm(ctx0, inpL);
-
-      cur = ggml_mul(
-          ctx0, ggml_repeat(ctx0, model.layers[il].norm_2_weight, cur), cur);
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].norm_2_weight, NULL);
     }
 
     // n = self.mlp(m)
@@ -572,7 +509,7 @@ bool replit_eval(const replit_model &model, const int n_threads,
       cur = ggml_mul_mat(ctx0, model.layers[il].ffn_up_proj, cur);
 
       // GELU activation
-      cur = ggml_gelu(ctx0, cur);
+      cur = ggml_bias_act(ctx0, cur, NULL, GGML_ACT_OP_GELU);
 
       // projection
       // cur = proj_w*cur + proj_b
@@ -585,9 +522,8 @@ bool replit_eval(const replit_model &model, const int n_threads,
 
   // norm
   {
-    inpL = ggml_norm(ctx0, inpL);
-    // inpL = ln_f_g*inpL
-    inpL = ggml_mul(ctx0, ggml_repeat(ctx0, model.norm_f_weight, inpL), inpL);
+    // inpL = ln_f_g*norm(inpL)
+    inpL = ggml_norm_affine(ctx0, inpL, model.norm_f_weight, NULL);
   }
 
   // output embedding weight tied to input embedding
@@ -595,7 +531,7 @@ bool replit_eval(const replit_model &model, const int n_threads,
 
   // run the computation
   ggml_build_forward_expand(&gf, inpL);
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads, threadpool);
 
   if (logits_all) {
     // return result for all tokens
@@ -619,7 +555,7 @@ bool replit_eval(const replit_model &model, const int n_threads,
   return true;
 }
 
-class replit_llm : public LLM {
+class replit_llm : public KVCacheLLM<replit_model> {
  public:
   virtual ~replit_llm() {
     if (model_.ctx != nullptr) {
@@ -636,37 +572,42 @@ class replit_llm : public LLM {
   }
 
   const std::string &Detokenize(const gpt_vocab::id id) const override {
-    const auto it = vocab_.id_to_token.find(id);
-    if (it == vocab_.id_to_token.end()) {
+    const auto it = id_to_text_.find(id);
+    if (it == id_to_text_.end()) {
       return kEmptyString;
     }
-
-    detokenized_text_ = replace_all(vocab_.id_to_token.at(id), ws_symbol, " ");
-    return detokenized_text_;
+    return it->second;
   }
 
  protected:
   replit_tokenizer replit_tokenizer_;
   bool Load(const std::string &filename, const int context_length,
-            const int gpu_layers) override {
+            const int gpu_layers, const ggml_type kv_type) override {
     if (context_length > 0) {
       model_.hparams.n_ctx = context_length;
     }
+    if (kv_type != GGML_TYPE_COUNT) {
+      model_.memory_type = kv_type;
+    }
     if (!replit_model_load(filename, model_, replit_tokenizer_)) {
       return false;
     }
     n_ctx_ = model_.hparams.n_ctx;
     vocab_ = replit_tokenizer_.raw_vocab;
+    // Detokenize tokens upfront so that it is safe to call from many threads.
+    for (const auto &kv : vocab_.id_to_token) {
+      id_to_text_[kv.first] = replace_all(kv.second, ws_symbol, " ");
+    }
     return true;
   }
 
   bool Eval(const std::vector<gpt_vocab::id> &tokens, const int threads,
             const int n_past) override {
-    return replit_eval(model_, threads, n_past, tokens, logits_,
-                       mem_per_token_);
+    return ReserveKV(n_past, tokens.size()) &&
+           replit_eval(model_, seq_, threads, n_past, tokens, logits_,
+                       mem_per_token_, ThreadPool(threads));
   }
 
  private:
-  replit_model model_;
-  mutable std::string detokenized_text_;
+  std::map<gpt_vocab::id, std::string> id_to_text_;
 };
@@ -11,6 +11,7 @@ struct starcoder_hparams {
   int32_t n_head = 16;
   int32_t n_layer = 24;
   int32_t ftype = 1;
+  int32_t n_head_kv = 1;  // detected from the c_attn weights
 };
 
 struct starcoder_layer {
@@ -50,14 +51,95 @@ struct starcoder_model {
   std::vector<starcoder_layer> layers;
 
   // key + value memory
-  struct ggml_tensor *memory_k;
-  struct ggml_tensor *memory_v;
+  ggml_type memory_type = GGML_TYPE_F32;
+  KVCache kv;
 
   //
   struct ggml_context *ctx;
   std::map<std::string, struct ggml_tensor *> tensors;
 };
 
+bool starcoder_ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Returns whether the `n_kv_heads` key heads and the `n_kv_heads` value heads
+// of `kv` are copies of the first key head and the first value head.
+bool starcoder_kv_heads_repeated(const char *kv, const int n_kv_heads,
+                                 const size_t head_size) {
+  for (int i = 0; i < 2 * n_kv_heads; i++) {
+    const char *first = kv + (i / n_kv_heads) * n_kv_heads * head_size;
+    if (memcmp(first, kv + i * head_size, head_size) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// StarCoder and SantaCoder use multi-query attention where all query heads
+// share a single key head and value head. Some conversions store the c_attn
+// weights with that single head, others repeat it for every query head.
+// Returns the number of key/value heads in the model file and whether they are
+// copies of one head, going by the first layer. Leaves the file position as it
+// was.
+int starcoder_kv_heads(std::ifstream &fin, const starcoder_hparams &hparams,
+                       bool &repeated) {
+  const int n_embd = hparams.n_embd;
+  const int head_dim = n_embd / hparams.n_head;
+
+  int n_kv_heads = hparams.n_head;
+  repeated = false;
+
+  const std::streampos start = fin.tellg();
+  while (true) {
+    int32_t n_dims;
+    int32_t length;
+    int32_t ttype;
+
+    fin.read(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
+    fin.read(reinterpret_cast<char *>(&length), sizeof(length));
+    fin.read(reinterpret_cast<char *>(&ttype), sizeof(ttype));
+
+    if (fin.eof() || n_dims < 1 || n_dims > 2 || ttype < 0 ||
+        ttype >= GGML_TYPE_COUNT || ggml_blck_size(ggml_type(ttype)) == 0) {
+      break;
+    }
+
+    int32_t ne[2] = {1, 1};
+    for (int i = 0; i < n_dims; ++i) {
+      fin.read(reinterpret_cast<char *>(&ne[i]), sizeof(ne[i]));
+    }
+
+    std::string name(length, 0);
+    fin.read(&name[0], length);
+
+    const size_t row_size = ggml_row_size(ggml_type(ttype), ne[0]);
+    if (!starcoder_ends_with(name, "/attn/c_attn/w")) {
+      fin.seekg(row_size * ne[1], std::ios::cur);
+      continue;
+    }
+
+    const int n = (ne[1] - n_embd) / (2 * head_dim);
+    if (n >= 1 && hparams.n_head % n == 0 &&
+        ne[1] == n_embd + 2 * n * head_dim) {
+      n_kv_heads = n;
+    }
+    if (n_kv_heads > 1) {
+      std::vector<char> kv(2 * n_kv_heads * head_dim * row_size);
+      fin.seekg(n_embd * row_size, std::ios::cur);
+      fin.read(kv.data(), kv.size());
+      repeated = fin && starcoder_kv_heads_repeated(kv.data(), n_kv_heads,
+                                                    head_dim * row_size);
+    }
+    break;
+  }
+  fin.clear();
+  fin.seekg(start);
+
+  return n_kv_heads;
+}
+
 // load the model's weights from a file
 bool starcoder_model_load(const std::string &fname, starcoder_model &model,
                           gpt_vocab &vocab) {
@@ -138,6 +220,13 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
     }
   }
 
+  // a key/value head that the model file repeats for every query head is
+  // loaded once
+  bool kv_repeated = false;
+  const int n_kv_heads_file =
+      starcoder_kv_heads(fin, model.hparams, kv_repeated);
+  model.hparams.n_head_kv = kv_repeated ? 1 : n_kv_heads_file;
+
   // for the big tensors, we have the option to store the data in 16-bit floats
   // or quantized in order to save memory and also to speed up the computation
   ggml_type wtype = ggml_ftype_to_ggml_type((ggml_ftype)(model.hparams.ftype));
@@ -160,7 +249,7 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
     const int n_vocab = hparams.n_vocab;
 
     const int head_dim = n_embd / hparams.n_head;
-    const int kv_heads = hparams.n_head;  // 1 if MQA else hparams.n_head
+    const int kv_heads = hparams.n_head_kv;
     const int kv_dim = kv_heads * head_dim;
 
     ctx_size += n_embd * ggml_type_sizef(GGML_TYPE_F32);  // ln_f_g
@@ -196,11 +285,6 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
     ctx_size +=
         n_layer * (n_embd * ggml_type_sizef(GGML_TYPE_F32));  // c_mlp_proj_b
 
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_k
-    ctx_size +=
-        n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32);  // memory_v
-
     ctx_size += (6 + 12 * n_layer) * 512;  // object overhead
   }
 
@@ -229,7 +313,7 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
     const int n_vocab = hparams.n_vocab;
 
     const int head_dim = n_embd / hparams.n_head;
-    const int kv_heads = hparams.n_head;  // 1 if MQA else hparams.n_head
+    const int kv_heads = hparams.n_head_kv;
     const int kv_dim = kv_heads * head_dim;
 
     model.layers.resize(n_layer);
@@ -310,18 +394,26 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
     const int n_layer = hparams.n_layer;
     const int n_ctx = hparams.n_ctx;
 
-    const int n_mem = n_layer * n_ctx;
-    const int n_elements = n_embd * n_mem;
+    const int head_dim = n_embd / hparams.n_head;
+    const int kv_dim = hparams.n_head_kv * head_dim;
 
-    model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
-    model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
+    if (!ct_kv_type_check(model.memory_type, head_dim)) {
+      return false;
+    }
+
+    if (!model.kv.Init(ctx, model.memory_type, n_layer, kv_dim, n_ctx)) {
+      return false;
+    }
 
     const size_t memory_size =
-        ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
+        ggml_nbytes(model.kv.memory_k) + ggml_nbytes(model.kv.memory_v);
   }
 
   // load weights
   {
+    const int n_embd = model.hparams.n_embd;
+    const int head_dim = n_embd / model.hparams.n_head;
+
     size_t total_size = 0;
 
     bool has_lm_head = false;
@@ -356,6 +448,37 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
       }
 
       auto tensor = model.tensors[name.data()];
+
+      // keep the first key head and value head of c_attn
+      std::vector<char> data;
+      const int rows = n_dims == 1 ? ne[0] : ne[1];
+      if (kv_repeated && rows == n_embd + 2 * n_kv_heads_file * head_dim &&
+          (starcoder_ends_with(name, "/attn/c_attn/w") ||
+           starcoder_ends_with(name, "/attn/c_attn/b"))) {
+        const ggml_type type = ggml_type(ttype);
+        const size_t row_size = n_dims == 1 ? ggml_type_size(type)
+                                            : ggml_row_size(type, ne[0]);
+        const size_t head_size = head_dim * row_size;
+        std::vector<char> file_data(rows * row_size);
+        fin.read(file_data.data(), file_data.size());
+
+        const char *q = file_data.data();
+        const char *kv = q + n_embd * row_size;
+        if (!starcoder_kv_heads_repeated(kv, n_kv_heads_file, head_size)) {
+          fprintf(stderr,
+                  "%s: tensor '%s' has different key/value heads in model "
+                  "file\n",
+                  __func__, name.data());
+          return false;
+        }
+        data.insert(data.end(), q, kv + head_size);
+        data.insert(data.end(), kv + n_kv_heads_file * head_size,
+                    kv + (n_kv_heads_file + 1) * head_size);
+
+        ne[n_dims - 1] = n_embd + 2 * head_dim;
+        nelements = ne[0] * ne[1];
+      }
+
       if (tensor->ne[0] != ne[0] || tensor->ne[1] != ne[1]) {
         fprintf(stderr,
                 "%s: tensor '%s' has wrong shape in model file: got [%d, %d], "
@@ -390,7 +513,11 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
         return false;
       }
 
-      fin.read(reinterpret_cast<char *>(tensor->data), ggml_nbytes(tensor));
+      if (data.empty()) {
+        fin.read(reinterpret_cast<char *>(tensor->data), ggml_nbytes(tensor));
+      } else {
+        memcpy(tensor->data, data.data(), data.size());
+      }
 
       // GPT-2 models share the WTE tensor as the LM head
       if (name == "model/wte" && has_lm_head == false) {
@@ -418,20 +545,24 @@ bool starcoder_model_load(const std::string &fname, starcoder_model &model,
 //   - embd_inp:  the embeddings of the tokens in the context
 //   - embd_w:    the predicted logits for the next token
 //
-bool starcoder_eval(const starcoder_model &model, const int n_threads,
+bool starcoder_eval(const starcoder_model &model,
+                    const KVCache::Sequence &kv_seq, const int n_threads,
                     const int n_past,
                     const std::vector<gpt_vocab::id> &embd_inp,
-                    std::vector<float> &embd_w, size_t &mem_per_token) {
+                    std::vector<float> &embd_w, size_t &mem_per_token,
+                    ggml_threadpool *threadpool) {
   const int N = embd_inp.size();
 
   const auto &hparams = model.hparams;
 
   const int n_embd = hparams.n_embd;
   const int n_layer = hparams.n_layer;
-  const int n_ctx = hparams.n_ctx;
   const int n_head = hparams.n_head;
+  const int n_head_kv = hparams.n_head_kv;
   const int n_vocab = hparams.n_vocab;
 
+  const int kv_dim = n_head_kv * (n_embd / n_head);
+
   static size_t buf_size = 256u * 1024 * 1024;
   static void *buf = malloc(buf_size);
 
@@ -481,6 +612,8 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
       ggml_add(ctx0, ggml_get_rows(ctx0, model.wte, embd),
                ggml_get_rows(ctx0, model.wpe, position));
 
+  struct ggml_tensor *kv_rows = model.kv.Rows(ctx0, kv_seq);
+
   for (int il = 0; il < n_layer; ++il) {
     struct ggml_tensor *cur;
 
@@ -492,15 +625,10 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
 
     // norm
     {
+      // cur = ln_1_g*norm(inpL) + ln_1_b
       // [ 768, N]
-      cur = ggml_norm(ctx0, inpL);
-
-      // cur = ln_1_g*cur + ln_1_b
-      // [ 768, N]
-      cur = ggml_add(
-          ctx0,
-          ggml_mul(ctx0, ggml_repeat(ctx0, model.layers[il].ln_1_g, cur), cur),
-          ggml_repeat(ctx0, model.layers[il].ln_1_b, cur));
+      cur = ggml_norm_affine(ctx0, inpL, model.layers[il].ln_1_g,
+                             model.layers[il].ln_1_b);
     }
 
     // attn
@@ -514,32 +642,22 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
     {
       cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_attn_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_attn_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_attn_attn_b);
     }
 
     // self-attention
     {
       struct ggml_tensor *Qcur = ggml_view_2d(ctx0, cur, n_embd, N, cur->nb[1],
                                               0 * sizeof(float) * n_embd);
-      struct ggml_tensor *Kcur = ggml_view_2d(ctx0, cur, n_embd, N, cur->nb[1],
-                                              1 * sizeof(float) * n_embd);
-      struct ggml_tensor *Vcur = ggml_view_2d(ctx0, cur, n_embd, N, cur->nb[1],
-                                              2 * sizeof(float) * n_embd);
+      struct ggml_tensor *Kcur = ggml_view_2d(ctx0, cur, kv_dim, N, cur->nb[1],
+                                              sizeof(float) * n_embd);
+      struct ggml_tensor *Vcur =
+          ggml_view_2d(ctx0, cur, kv_dim, N, cur->nb[1],
+                       sizeof(float) * (n_embd + kv_dim));
 
       // store key and value to memory
       if (N >= 1) {
-        struct ggml_tensor *k =
-            ggml_view_1d(ctx0, model.memory_k, N * n_embd,
-                         (ggml_element_size(model.memory_k) * n_embd) *
-                             (il * n_ctx + n_past));
-        struct ggml_tensor *v =
-            ggml_view_1d(ctx0, model.memory_v, N * n_embd,
-                         (ggml_element_size(model.memory_v) * n_embd) *
-                             (il * n_ctx + n_past));
-
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+        model.kv.Store(ctx0, &gf, kv_rows, Kcur, Vcur, il);
       }
 
       // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0, 2, 1,
@@ -551,80 +669,16 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
                                                    n_embd / n_head, n_head, N)),
                        0, 2, 1, 3);
 
-      // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
-      // [64, n_past + N, 12]
-      struct ggml_tensor *K = ggml_permute(
-          ctx0,
-          ggml_reshape_3d(
-              ctx0,
-              ggml_view_1d(
-                  ctx0, model.memory_k, (n_past + N) * n_embd,
-                  il * n_ctx * ggml_element_size(model.memory_k) * n_embd),
-              n_embd / n_head, n_head, n_past + N),
-          0, 2, 1, 3);  // TODO: need to be tiled
-
-      // GG: flash attention
-      // struct ggml_tensor * V =
-      //    ggml_cpy(ctx0,
-      //            ggml_permute(ctx0,
-      //                ggml_reshape_3d(ctx0,
-      //                    ggml_view_1d(ctx0, model.memory_v, (n_past +
-      //                    N)*n_embd,
-      //                    il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
-      //                    n_embd/n_head, n_head, n_past + N),
-      //                1, 2, 0, 3),
-      //            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_past + N,
-      //            n_embd/n_head, n_head));
-
-      // struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, V, true);
-
-      // K * Q
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ =
-          ggml_mul_mat(ctx0, K, Q);  // TODO: check if it broadcasts
-
-      // KQ_scaled = KQ / sqrt(n_embd/n_head)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_scaled = ggml_scale_inplace(
-          ctx0, KQ, ggml_new_f32(ctx0, 1.0f / sqrt(float(n_embd) / n_head)));
-
-      // KQ_masked = mask_past(KQ_scaled)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_masked =
-          ggml_diag_mask_inf_inplace(ctx0, KQ_scaled, n_past);
-
-      // KQ = soft_max(KQ_masked)
-      // [n_past + N, N, 12]
-      struct ggml_tensor *KQ_soft_max = ggml_soft_max_inplace(ctx0, KQ_masked);
-
-      // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0,
-      // 3).contiguous() [n_past + N, 64, 12]
-      struct ggml_tensor *V_trans = ggml_cpy(
-          ctx0,
-          ggml_permute(
-              ctx0,
-              ggml_reshape_3d(
-                  ctx0,
-                  ggml_view_1d(
-                      ctx0, model.memory_v, (n_past + N) * n_embd,
-                      il * n_ctx * ggml_element_size(model.memory_v) * n_embd),
-                  n_embd / n_head, n_head, n_past + N),
-              1, 2, 0, 3),
-          ggml_new_tensor_3d(ctx0, model.memory_v->type, n_past + N,
-                             n_embd / n_head, n_head));
-
-      // KQV = transpose(V) * KQ_soft_max
-      // [64, N, 12]
-      struct ggml_tensor *KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
-
-      // KQV_merged = KQV.permute(0, 2, 1, 3)
-      // [64, 12, N]
-      struct ggml_tensor *KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-
-      // cur = KQV_merged.contiguous().view(n_embd, N)
+      // KQV = soft_max(mask_past(K * Q / sqrt(n_embd/n_head))) * V
+      // [64, 12, N], the key/value heads are shared by n_head / n_head_kv
+      // query heads each
+      struct ggml_tensor *KQV =
+          model.kv.Attention(ctx0, Q, kv_rows, n_head_kv, il,
+                             1.0f / sqrt(float(n_embd) / n_head), 0.0f);
+
+      // cur = KQV.view(n_embd, N)
       // [768, N]
-      cur = ggml_cpy(ctx0, KQV_merged,
-                     ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+      cur = ggml_reshape_2d(ctx0, KQV, n_embd, N);
     }
 
     // projection
@@ -638,8 +692,7 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
     {
       cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_proj_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_attn_proj_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_attn_proj_b);
     }
 
     // add the input
@@ -657,15 +710,10 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
     {
       // norm
       {
-        cur = ggml_norm(ctx0, inpFF);
-
-        // cur = ln_2_g*cur + ln_2_b
+        // cur = ln_2_g*norm(inpFF) + ln_2_b
         // [ 768, N]
-        cur = ggml_add(
-            ctx0,
-            ggml_mul(ctx0, ggml_repeat(ctx0, model.layers[il].ln_2_g, cur),
-                     cur),
-            ggml_repeat(ctx0, model.layers[il].ln_2_b, cur));
+        cur = ggml_norm_affine(ctx0, inpFF, model.layers[il].ln_2_g,
+                               model.layers[il].ln_2_b);
       }
 
       // fully connected
@@ -678,12 +726,10 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
       // [3072, N]
       cur = ggml_mul_mat(ctx0, model.layers[il].c_mlp_fc_w, cur);
 
-      cur = ggml_add(ctx0, ggml_repeat(ctx0, model.layers[il].c_mlp_fc_b, cur),
-                     cur);
-
       // GELU activation
       // [3072, N]
-      cur = ggml_gelu(ctx0, cur);
+      cur = ggml_bias_act(ctx0, cur, model.layers[il].c_mlp_fc_b,
+                          GGML_ACT_OP_GELU);
 
       // projection
       // [ 768, 3072] - model.layers[il].c_mlp_proj_w
@@ -695,8 +741,7 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
       // [768, N]
       cur = ggml_mul_mat(ctx0, model.layers[il].c_mlp_proj_w, cur);
 
-      cur = ggml_add(
-          ctx0, ggml_repeat(ctx0, model.layers[il].c_mlp_proj_b, cur), cur);
+      cur = ggml_add(ctx0, cur, model.layers[il].c_mlp_proj_b);
     }
 
     // input for next layer
@@ -711,14 +756,9 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
 
   // norm
   {
+    // inpL = ln_f_g*norm(inpL) + ln_f_b
     // [ 768, N]
-    inpL = ggml_norm(ctx0, inpL);
-
-    // inpL = ln_f_g*inpL + ln_f_b
-    // [ 768, N]
-    inpL = ggml_add(ctx0,
-                    ggml_mul(ctx0, ggml_repeat(ctx0, model.ln_f_g, inpL), inpL),
-                    ggml_repeat(ctx0, model.ln_f_b, inpL));
+    inpL = ggml_norm_affine(ctx0, inpL, model.ln_f_g, model.ln_f_b);
   }
 
   ggml_set_scratch(ctx0, {
@@ -737,7 +777,7 @@ bool starcoder_eval(const starcoder_model &model, const int n_threads,
 
   // run the computation
   ggml_build_forward_expand(&gf, inpL);
-  ggml_graph_compute_with_ctx(ctx0, &gf, n_threads);
+  ggml_graph_compute_with_ctx_threadpool(ctx0, &gf, n_threads, threadpool);
 
   // if (n_past%100 == 0) {
   //    ggml_graph_print   (&gf);
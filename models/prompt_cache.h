@@ -0,0 +1,405 @@
+#ifndef CTRANSFORMERS_MODELS_PROMPT_CACHE_H_
+#define CTRANSFORMERS_MODELS_PROMPT_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "common.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <process.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// A process-wide cache of the KV cache of evaluated prompts, so that a prompt
+// that starts with the tokens of an earlier prompt, such as a system prompt or
+// few-shot examples, only evaluates the tokens after them. This also works
+// across models that are loaded from the same file.
+//
+// The prompts of a model are kept in a radix tree of their tokens. As the keys
+// and values of a token only depend on the tokens before it, the snapshot of a
+// prompt also holds the snapshots of all of its prefixes, so a prompt that is a
+// prefix of another one is not kept. A snapshot is stored token by token so
+// that the snapshot of a prefix is a prefix of the bytes.
+//
+// When the snapshots take more than the memory budget, the least recently used
+// ones are written to files in a directory, which are mapped back into memory
+// when they are used, and are dropped when the files take more than the disk
+// budget.
+class PromptCache {
+ public:
+  static PromptCache &Get() {
+    static PromptCache cache;
+    return cache;
+  }
+
+  ~PromptCache() {
+    for (auto &it : roots_) {
+      Clear(it.second.get());
+    }
+  }
+
+  // Raises the budgets in bytes. `dir` is where snapshots that do not fit in
+  // memory are written, none are written if it is empty. As the cache is
+  // shared by all models, the budgets only grow and the first non-empty `dir`
+  // is kept, so that configuring one model does not evict the snapshots of
+  // another.
+  void Configure(const size_t memory_size, const std::string &dir,
+                 const size_t disk_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memory_size_ = std::max(memory_size_, memory_size);
+    if (dir.empty()) {
+      return;
+    }
+    if (dir_.empty()) {
+      dir_ = dir;
+    } else if (dir != dir_) {
+      fprintf(stderr,
+              "The prompt cache already uses the directory '%s', ignoring "
+              "'%s'.\n",
+              dir_.c_str(), dir.c_str());
+    }
+    disk_size_ = std::max(disk_size_, disk_size);
+  }
+
+  // Finds the longest prefix of `tokens` of at most `max_tokens` tokens that
+  // is in the cache of `model` and calls `load` with its snapshot. Returns the
+  // number of tokens of the prefix, or 0 if none is found or `load` fails.
+  int Lookup(const std::string &model, const std::vector<gpt_vocab::id> &tokens,
+             const int max_tokens,
+             const std::function<bool(const char *data, int n_tokens)> &load) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = roots_.find(model);
+    if (it == roots_.end()) {
+      return 0;
+    }
+    Node *node = it->second.get();
+    int n = 0;
+    while (n < max_tokens) {
+      const auto child = node->children.find(tokens[n]);
+      if (child == node->children.end()) {
+        break;
+      }
+      node = child->second.get();
+      const std::vector<gpt_vocab::id> &edge = node->edge;
+      int i = 0;
+      while (i < (int)edge.size() && n < max_tokens && edge[i] == tokens[n]) {
+        i++;
+        n++;
+      }
+      if (i < (int)edge.size()) {
+        break;
+      }
+    }
+    if (n == 0) {
+      return 0;
+    }
+
+    // Every snapshot below the node starts with the prefix.
+    while (node->entry == nullptr) {
+      node = node->children.begin()->second.get();
+    }
+    Entry *entry = node->entry;
+    Touch(entry);
+    if (!entry->data.empty()) {
+      return load(entry->data.data(), n) ? n : 0;
+    }
+    MappedFile file;
+    if (!file.Open(entry->path, entry->size)) {
+      Remove(entry);
+      return 0;
+    }
+    return load(file.data, n) ? n : 0;
+  }
+
+  // Adds the snapshot of `tokens` of `model`, which takes `token_size` bytes
+  // per token and is written by `save`, unless it is already in the cache.
+  void Insert(const std::string &model,
+              const std::vector<gpt_vocab::id> &tokens, const size_t token_size,
+              const std::function<void(char *data)> &save) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t size = tokens.size() * token_size;
+    if (tokens.empty() || size > std::max(memory_size_, disk_size_)) {
+      return;
+    }
+    std::unique_ptr<Node> &root = roots_[model];
+    if (root == nullptr) {
+      root.reset(new Node);
+    }
+
+    Node *node = root.get();
+    size_t n = 0;
+    while (n < tokens.size()) {
+      const auto child = node->children.find(tokens[n]);
+      if (child == node->children.end()) {
+        std::unique_ptr<Node> leaf(new Node);
+        leaf->edge.assign(tokens.begin() + n, tokens.end());
+        leaf->parent = node;
+        node = node->children.emplace(tokens[n], std::move(leaf))
+                   .first->second.get();
+        n = tokens.size();
+        break;
+      }
+      Node *next = child->second.get();
+      const std::vector<gpt_vocab::id> &edge = next->edge;
+      size_t i = 0;
+      while (i < edge.size() && n < tokens.size() && edge[i] == tokens[n]) {
+        i++;
+        n++;
+      }
+      if (i < edge.size() && n < tokens.size()) {
+        next = Split(next, i);
+      }
+      node = next;
+    }
+
+    // The prompt is a prefix of a prompt in the cache.
+    if (node->entry != nullptr || !node->children.empty()) {
+      while (node->entry == nullptr) {
+        node = node->children.begin()->second.get();
+      }
+      Touch(node->entry);
+      return;
+    }
+
+    Entry *entry = new Entry;
+    entry->node = node;
+    entry->size = size;
+    entry->data.resize(size);
+    save(entry->data.data());
+    node->entry = entry;
+    lru_.push_front(entry);
+    entry->lru = lru_.begin();
+    memory_used_ += size;
+
+    // The prompts that are a prefix of this one are no longer needed.
+    for (Node *p = node->parent; p != nullptr;) {
+      Node *parent = p->parent;
+      if (p->entry != nullptr) {
+        Remove(p->entry);
+      }
+      p = parent;
+    }
+    Evict();
+  }
+
+ private:
+  struct Node;
+
+  struct Entry {
+    Node *node = nullptr;
+    size_t size = 0;
+    // The snapshot in memory, or the file it is written to.
+    std::vector<char> data;
+    std::string path;
+    std::list<Entry *>::iterator lru;
+  };
+
+  struct Node {
+    // The tokens from the parent to this node.
+    std::vector<gpt_vocab::id> edge;
+    std::map<gpt_vocab::id, std::unique_ptr<Node>> children;
+    Node *parent = nullptr;
+    // The prompt that ends at this node.
+    Entry *entry = nullptr;
+  };
+
+  // A read-only mapping of a snapshot file.
+  struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+
+    bool Open(const std::string &path, const size_t size) {
+      file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (file == INVALID_HANDLE_VALUE) {
+        return false;
+      }
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping == nullptr) {
+        return false;
+      }
+      data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+      this->size = size;
+      return data != nullptr;
+    }
+
+    ~MappedFile() {
+      if (data != nullptr) {
+        UnmapViewOfFile(data);
+      }
+      if (mapping != nullptr) {
+        CloseHandle(mapping);
+      }
+      if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+      }
+    }
+#else
+    bool Open(const std::string &path, const size_t size) {
+      const int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (addr == MAP_FAILED) {
+        return false;
+      }
+      data = (const char *)addr;
+      this->size = size;
+      return true;
+    }
+
+    ~MappedFile() {
+      if (data != nullptr) {
+        munmap(const_cast<char *>(data), size);
+      }
+    }
+#endif
+  };
+
+  std::mutex mutex_;
+  size_t memory_size_ = 0;
+  size_t disk_size_ = 0;
+  size_t memory_used_ = 0;
+  size_t disk_used_ = 0;
+  std::string dir_;
+  int n_files_ = 0;
+  std::map<std::string, std::unique_ptr<Node>> roots_;
+  // Most recently used first.
+  std::list<Entry *> lru_;
+
+  void Touch(Entry *entry) {
+    lru_.splice(lru_.begin(), lru_, entry->lru);
+  }
+
+  // Splits the edge of `node` after `n` tokens and returns the new node at
+  // the split.
+  Node *Split(Node *node, const size_t n) {
+    Node *parent = node->parent;
+    std::unique_ptr<Node> &slot = parent->children[node->edge[0]];
+    std::unique_ptr<Node> mid(new Node);
+    mid->edge.assign(node->edge.begin(), node->edge.begin() + n);
+    mid->parent = parent;
+    node->edge.erase(node->edge.begin(), node->edge.begin() + n);
+    node->parent = mid.get();
+    mid->children.emplace(node->edge[0], std::move(slot));
+    slot = std::move(mid);
+    return slot.get();
+  }
+
+  // Removes `entry` from the cache and the nodes that are no longer needed.
+  void Remove(Entry *entry) {
+    Node *node = entry->node;
+    node->entry = nullptr;
+    if (entry->data.empty()) {
+      std::remove(entry->path.c_str());
+      disk_used_ -= entry->size;
+    } else {
+      memory_used_ -= entry->size;
+    }
+    lru_.erase(entry->lru);
+    delete entry;
+
+    while (node->parent != nullptr && node->entry == nullptr &&
+           node->children.empty()) {
+      Node *parent = node->parent;
+      parent->children.erase(node->edge[0]);
+      node = parent;
+    }
+    // A node without a prompt needs at least two children.
+    if (node->parent != nullptr && node->entry == nullptr &&
+        node->children.size() == 1) {
+      std::unique_ptr<Node> child = std::move(node->children.begin()->second);
+      node->children.clear();
+      node->edge.insert(node->edge.end(), child->edge.begin(),
+                        child->edge.end());
+      node->children = std::move(child->children);
+      for (auto &it : node->children) {
+        it.second->parent = node;
+      }
+      node->entry = child->entry;
+      if (node->entry != nullptr) {
+        node->entry->node = node;
+      }
+    }
+  }
+
+  // Writes the least recently used snapshots to disk or drops them until they
+  // fit in the budgets.
+  void Evict() {
+    for (auto it = lru_.end(); memory_used_ > memory_size_;) {
+      Entry *entry = *--it;
+      if (!entry->data.empty() && !WriteFile(entry)) {
+        ++it;
+        Remove(entry);
+      }
+    }
+    for (auto it = lru_.end(); disk_used_ > disk_size_;) {
+      Entry *entry = *--it;
+      if (entry->data.empty()) {
+        ++it;
+        Remove(entry);
+      }
+    }
+  }
+
+  bool WriteFile(Entry *entry) {
+    if (entry->size > disk_size_) {
+      return false;
+    }
+#if defined(_WIN32)
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+    entry->path = dir_ + "/ctransformers-" + std::to_string(pid) + "-" +
+                  std::to_string(n_files_++) + ".kv";
+    FILE *file = std::fopen(entry->path.c_str(), "wb");
+    if (file == nullptr) {
+      fprintf(stderr, "Failed to create prompt cache file '%s'.\n",
+              entry->path.c_str());
+      return false;
+    }
+    const bool ok =
+        std::fwrite(entry->data.data(), 1, entry->size, file) == entry->size;
+    if (std::fclose(file) != 0 || !ok) {
+      std::remove(entry->path.c_str());
+      return false;
+    }
+    std::vector<char>().swap(entry->data);
+    memory_used_ -= entry->size;
+    disk_used_ += entry->size;
+    return true;
+  }
+
+  void Clear(Node *node) {
+    if (node->entry != nullptr) {
+      if (node->entry->data.empty()) {
+        std::remove(node->entry->path.c_str());
+      }
+      delete node->entry;
+    }
+    for (auto &it : node->children) {
+      Clear(it.second.get());
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Measures decode latency and CPU time of co-located model instances.
+
+Each instance runs in its own process and generates tokens at the same time as
+the others, so idle threads of one instance compete for CPU with the busy
+threads of the others.
+
+Example:
+
+    python scripts/benchmark.py marella/gpt-2-ggml --threads 4 --spin-us -1 0 200
+"""
+
+import argparse
+import multiprocessing as mp
+import resource
+import sys
+import time
+from pathlib import Path
+
+ROOT = Path(__file__).parent.parent.resolve()
+sys.path.append(str(ROOT))
+
+from ctransformers import AutoModelForCausalLM
+
+PROMPT = "AI is going to"
+
+
+def run(args, spin_us, barrier, results):
+    llm = AutoModelForCausalLM.from_pretrained(
+        args.model,
+        model_type=args.model_type,
+        model_file=args.model_file,
+        lib=args.lib,
+        threads=args.threads,
+        spin_us=spin_us,
+    )
+    tokens = llm.tokenize(PROMPT)
+    llm.eval(tokens)
+
+    barrier.wait()
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    start = time.perf_counter()
+    for _ in range(args.tokens):
+        llm.eval([llm.sample(seed=0)])
+    elapsed = time.perf_counter() - start
+    cpu = resource.getrusage(resource.RUSAGE_SELF)
+    cpu = (cpu.ru_utime - usage.ru_utime) + (cpu.ru_stime - usage.ru_stime)
+    results.put((elapsed, cpu))
+
+
+def benchmark(args, instances, spin_us):
+    barrier = mp.Barrier(instances)
+    results = mp.Queue()
+    processes = [
+        mp.Process(target=run, args=(args, spin_us, barrier, results))
+        for _ in range(instances)
+    ]
+    for p in processes:
+        p.start()
+    results = [results.get() for _ in processes]
+    for p in processes:
+        p.join()
+
+    latency = sum(elapsed for elapsed, _ in results) / instances / args.tokens
+    cpu = sum(cpu for _, cpu in results)
+    return latency, cpu
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("model", help="The path or repo id of a model.")
+    parser.add_argument("--model-type")
+    parser.add_argument("--model-file")
+    parser.add_argument("--lib")
+    parser.add_argument("--threads", type=int, default=-1)
+    parser.add_argument("--tokens", type=int, default=64)
+    parser.add_argument("--instances", type=int, nargs="+", default=[1, 2, 4])
+    parser.add_argument("--spin-us", type=int, nargs="+", default=[-1, 200])
+    args = parser.parse_args()
+
+    print("| spin_us | instances | latency (ms/token) | CPU time (s) |")
+    print("| ------: | --------: | -----------------: | -----------: |")
+    for spin_us in args.spin_us:
+        for instances in args.instances:
+            latency, cpu = benchmark(args, instances, spin_us)
+            print(f"| {spin_us} | {instances} | {latency * 1000:.2f} | {cpu:.2f} |")
+
+
+if __name__ == "__main__":
+    main()
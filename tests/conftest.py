@@ -5,7 +5,7 @@ def pytest_addoption(parser):
     parser.addoption(
         "--lib",
         action="store",
-        choices=("avx2", "avx", "basic", "cuda", "none"),
+        choices=("auto", "avx512", "avx2", "avx", "basic", "cuda", "none"),
     )
 
 
@@ -1,3 +1,7 @@
+import math
+
+import pytest
+
 from ctransformers import AutoModelForCausalLM
 
 
@@ -18,3 +22,64 @@ class TestModel:
         assert llm.eos_token_id == 50256
         assert llm.vocab_size == 50257
         assert llm.context_length == 1024
+
+    def test_batch_tokenize(self, lib):
+        llm = AutoModelForCausalLM.from_pretrained("marella/gpt-2-ggml", lib=lib)
+        texts = ["AI is going to", "", "Hello, world!"]
+        sequences = llm.batch_tokenize(texts, threads=2)
+        assert sequences == [llm.tokenize(text) for text in texts]
+        assert llm.batch_detokenize(sequences, threads=2) == texts
+
+    def test_kv_cache_type(self, lib):
+        llm = AutoModelForCausalLM.from_pretrained(
+            "marella/gpt-2-ggml", lib=lib, kv_cache_type="q8_0"
+        )
+        response = llm("AI is going to", seed=5, max_new_tokens=3)
+        assert isinstance(response, str) and response
+
+        with pytest.raises(RuntimeError):
+            AutoModelForCausalLM.from_pretrained(
+                "marella/gpt-2-ggml", lib=lib, kv_cache_type="q4_1"
+            )
+
+    def test_prompt_cache(self, lib, tmp_path):
+        # A memory budget smaller than the prompt's snapshot spills it to disk.
+        kwargs = dict(lib=lib, prompt_cache_size=1, prompt_cache_dir=str(tmp_path))
+        prompt = list(range(100, 200))
+        extra = list(range(200, 210))
+
+        llm = AutoModelForCausalLM.from_pretrained("marella/gpt-2-ggml", lib=lib)
+        llm.eval(prompt + extra)
+        expected = list(llm.logits)
+
+        llm = AutoModelForCausalLM.from_pretrained("marella/gpt-2-ggml", **kwargs)
+        llm.eval(prompt)
+        assert list(tmp_path.iterdir())
+
+        # A new model restores the prompt from the cache and only evaluates the
+        # tokens after it.
+        llm = AutoModelForCausalLM.from_pretrained("marella/gpt-2-ggml", **kwargs)
+        llm.eval(prompt + extra)
+        assert list(llm.logits) == pytest.approx(expected, abs=1e-4)
+
+    def test_kv_cache_budget(self, lib):
+        budget = 100
+        llm = AutoModelForCausalLM.from_pretrained("marella/gpt-2-ggml", lib=lib)
+        llm.eval(list(range(100, 150)))
+        expected = list(llm.logits)
+
+        llm = AutoModelForCausalLM.from_pretrained(
+            "marella/gpt-2-ggml", lib=lib, kv_cache_budget=budget
+        )
+        # Nothing is evicted while the tokens fit in the budget.
+        llm.eval(list(range(100, 150)))
+        assert list(llm.logits) == pytest.approx(expected, abs=1e-4)
+
+        # Generation goes on after tokens are evicted.
+        for _ in range(3 * budget):
+            llm.eval([llm.sample(seed=5)])
+        assert all(math.isfinite(x) for x in llm.logits)
+
+        # A batch of more tokens than the budget.
+        llm.eval(list(range(100, 100 + 2 * budget)), batch_size=2 * budget)
+        assert all(math.isfinite(x) for x in llm.logits)